@@ -0,0 +1,115 @@
+//
+// startup measures how long light takes from exec to its first frame,
+// for a scratch buffer and for a 100 MB file, on a pseudo-terminal:
+//
+//     make bench
+//
+// It fails when the median of either goes over LIGHT_STARTUP_BUDGET
+// milliseconds, 5 unless it is set.
+//
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdbool.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<signal.h>
+#include<time.h>
+#include<poll.h>
+#include<pty.h>
+#include<sys/wait.h>
+
+#define RUNS                  11
+#define FILE_SIZE             (100 * 1024 * 1024)
+#define FRAME_END             "\033[?2026l"
+
+double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Milliseconds from fork to the end of the first frame, or -1
+double first_frame(const char* light, const char* path) {
+    struct winsize size = { .ws_row = 40, .ws_col = 120 };
+    int terminal;
+    double begin = now_ms();
+    pid_t pid = forkpty(&terminal, NULL, NULL, &size);
+    if(pid == -1) return -1;
+    if(pid == 0) {
+        // A NULL path leaves light with no file, a scratch buffer
+        execl(light, light, path, (char*)NULL);
+        _exit(127);
+    }
+
+    // The end of a frame may be split over two reads
+    char seen[4096 + sizeof(FRAME_END)] = "";
+    size_t kept = 0;
+    double took = -1;
+    struct pollfd wait = { terminal, POLLIN, 0 };
+    while(poll(&wait, 1, 10000) == 1) {
+        ssize_t got = read(terminal, seen + kept, 4096);
+        if(got <= 0) break;
+        seen[kept + got] = '\0';
+        if(memmem(seen, kept + got, FRAME_END, strlen(FRAME_END))) {
+            took = now_ms() - begin;
+            break;
+        }
+        size_t total = kept + got;
+        kept = total < strlen(FRAME_END)? total: strlen(FRAME_END) - 1;
+        memmove(seen, seen + total - kept, kept);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(terminal);
+    return took;
+}
+
+int compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// The median of RUNS starts, or -1 when one of them drew no frame
+double median(const char* light, const char* path) {
+    double runs[RUNS];
+    for(int i = 0; i < RUNS; i++) {
+        runs[i] = first_frame(light, path);
+        if(runs[i] < 0) return -1;
+    }
+    qsort(runs, RUNS, sizeof(double), compare);
+    return runs[RUNS / 2];
+}
+
+int main(int argc, char* argv[]) {
+    char light[4096];
+    if(!realpath(argc > 1? argv[1]: "./light", light)) return 1;
+    const char* budget_text = getenv("LIGHT_STARTUP_BUDGET");
+    double budget = budget_text? atof(budget_text): 5;
+
+    // 100 MB of rows of 99 characters each, removed again at the end
+    char path[] = "/tmp/light-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd == -1) return 1;
+    char row[100];
+    memset(row, 'x', sizeof(row) - 1);
+    row[sizeof(row) - 1] = '\n';
+    FILE* file = fdopen(fd, "w");
+    for(size_t written = 0; written < FILE_SIZE; written += sizeof(row)) fwrite(row, 1, sizeof(row), file);
+    fclose(file);
+
+    // A scratch buffer is opened in an empty directory
+    char scratch[] = "/tmp/light-bench-dir-XXXXXX";
+    if(!mkdtemp(scratch) || chdir(scratch) == -1) return 1;
+    double empty = median(light, NULL);
+    double large = median(light, path);
+    unlink(path);
+    if(chdir("/") == 0) rmdir(scratch);
+
+    printf("scratch buffer:  %.2f ms\n", empty);
+    printf("100 MB file:     %.2f ms\n", large);
+    bool failed = empty < 0 || large < 0 || empty > budget || large > budget;
+    if(failed) printf("over the budget of %.2f ms\n", budget);
+    return failed;
+}
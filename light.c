@@ -3,6 +3,8 @@
 // It is different to Nano, in regards to supporting simple plugins, and shortcuts(similar to Vim)
 // 
 
+// copy_file_range
+#define _GNU_SOURCE
 #include<stdio.h>
 #include<unistd.h>
 #include<fcntl.h>
@@ -11,6 +13,8 @@
 #include<stdlib.h>
 #include<errno.h>
 #include<time.h>
+#include<stdarg.h>
+#include<poll.h>
 
 #include<malloc.h>
 #include<memory.h>
@@ -19,22 +23,35 @@
 #include<sys/ioctl.h>
 #include<sys/types.h>
 #include<sys/stat.h>
+#include<sys/mman.h>
+#include<sys/inotify.h>
+#include<sys/wait.h>
 
 #include<termios.h>
 #include<pthread.h>
+#include<dlfcn.h>
+#include<dirent.h>
+#include<spawn.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#endif
+
+#include"light_plugin.h"
 
 /*
 ------------------------------------
 
-- MAX_NUMBER_OF_ROWS is the maximum screen 
-size which is allowed
+- MAX_NUMBER_OF_ROWS is the most rows a
+buffer may grow to, rows are allocated only
+when they are used
 
 - MAX_NUMBER_OF_COLS defines the maximum number
 of ASCII characters you can use per line
 
 
-- DISPLAY_BUFFER_LEN defines the allocated
-space for the display buffer
+- ROW_ARENA_SLAB is how much memory the row
+arena asks malloc for at once, rows of every
+open buffer are cut from the same slabs
 
 - SCRATCH_FILE is the name of the file where
 your files are stored in case of an error
@@ -42,15 +59,24 @@ before crashing out
 
 - TABSPACE how many spaces a TAB expands to
 
+- SAVE_CHUNK how many bytes a save writes at once
+
+- SAVE_COPY_LEAST the fewest bytes of unchanged
+lines a DELTA_SAVE copies instead of writing,
+and SAVE_BLOCK the blocks a file system shares
+
 ------------------------------------
 */
-#define MAX_NUMBER_OF_ROWS    0xFFFF 
+#define MAX_NUMBER_OF_ROWS    0x7FFFFFFF 
 #define MAX_NUMBER_OF_COLS    0x0400 
-#define DISPLAY_BUFFER_LEN    MAX_NUMBER_OF_ROWS * MAX_NUMBER_OF_COLS 
+#define ROW_ARENA_SLAB        0x10000 
 #define SCRATCH_FILE          ".light-scratch-XXXXXX"
 #define PATHMAX               0x1000
 #define TABSPACE              4
 #define LINE_GUTTER           7
+#define SAVE_CHUNK            0x100000
+#define SAVE_COPY_LEAST       0x10000
+#define SAVE_BLOCK            0x1000
 
 /*
 ------------------------------------
@@ -73,22 +99,12 @@ shortcut_save_file is called
 /*
 ------------------------------------
 
-- NUMBER_OF_ROWS counts the current total 
-number of rows and is increased only
-when you press enter
-
-- CURRENT_ROW is the row we are at
-
-- CURRENT_COL records which column we are
-at CURRENT_ROW line
+- TERM_ROW and TERM_COL are the size of
+the terminal
 
 - EXIT_FLAG is set when we encounter '=quit' in
 last line or a signal like SIGINT
 
-- DISPLAY_BUFFER is the buffer that is written to 
-by the user, and stored to be used with display_buffer
-thread, to display
-
 - handler_SIGINT sets EXIT_FLAG and exits
 
 - SAVE_FILE is used if the last line in
@@ -97,586 +113,5389 @@ the buffer has '=<filename>' format
 - IGN_FILE is used if the buffer is to be
 scratched after writing to it
 
-- INIT_FILE is set if DISPLAY_BUFFER is 
-constructed using a file instead of from
-scratch
-
-- INIT_ARG_FNAME is set to argv[1] if initialized 
-with a file, like, so: light <fname>
-
 - check_EXIT exits, by checking EXIT_FLAG, and
 is aware if it was called_through_shortcut
 
 ------------------------------------
 */
-u_int16_t NUMBER_OF_ROWS = 0;
-u_int16_t CURRENT_ROW    = 0;
-u_int16_t CURRENT_COL    = 0;
 u_int16_t TERM_ROW       = 0;
 u_int16_t TERM_COL       = 0;
 volatile sig_atomic_t EXIT_FLAG = false;
 bool      SAVE_FILE      = false;
 bool      IGN_FILE       = true;
-bool      INIT_FILE      = false;
-bool      BUFFER_ENDS_NEWLINE = false;
-bool      BUFFER_DIRTY   = false;
-char      INIT_ARG_FNAME[PATHMAX];
-char      DISPLAY_BUFFER[MAX_NUMBER_OF_ROWS][MAX_NUMBER_OF_COLS];
 char      LINE_CLIPBOARD[MAX_NUMBER_OF_COLS];
-u_int16_t VIEW_START_ROW = 0;
-u_int16_t CURRENT_VIEW_COL = 0;
-u_int16_t SELECT_START_ROW = 0;
-u_int16_t SELECT_START_COL = 0;
-u_int16_t SELECT_END_ROW = 0;
-u_int16_t SELECT_END_COL = 0;
-bool      SELECT_VISIBLE = false;
-bool      SELECT_ACTIVE = false;
 bool      CONFIRM_EXIT = false;
-char*     TEXT_CLIPBOARD = NULL;
-size_t    TEXT_CLIPBOARD_LEN = 0;
 
-enum Language {
-    LANGUAGE_TEXT,
-    LANGUAGE_C,
-    LANGUAGE_PYTHON
-} FILE_LANGUAGE = LANGUAGE_TEXT;
+/*
+------------------------------------
+
+- SOFT_WRAP folds long rows onto several
+screen rows, instead of scrolling only the
+current row sideways, toggle it with :wrap
+
+------------------------------------
+*/
+bool      SOFT_WRAP      = false;
+
+/*
+------------------------------------
+
+- struct Language is one language definition,
+read at startup from a small file of lines
+like these, so a language needs no code:
+    name GO
+    extensions .go
+    keywords break case chan const
+    line_comment //
+    string "
+    numbers
+
+- Every definition is compiled into one DFA:
+LEX_CLASS folds the bytes no definition tells
+apart, and LEX_NEXT gives the state after each
+byte class, with LEX_BOUNDARY set when a token
+ended before that byte. A row is colored by one
+lookup per byte, and LEX_CARRY is where the
+next row starts, inside a block comment when
+this one ended in one
+
+------------------------------------
+*/
+#ifndef LANGUAGE_DIR
+#define LANGUAGE_DIR          "/usr/local/share/light/languages"
+#endif
+#define LANGUAGE_MAX          32
+#define LEX_DELIMITER_MAX     8
+#define LEX_TOKEN_MAX         16
+#define LEX_BOUNDARY          0x8000
+#define LEX_STATE_MAX         0x7fff
+
+enum LexColor {
+    LEX_PLAIN,
+    LEX_KEYWORD,
+    LEX_NUMBER,
+    LEX_STRING,
+    LEX_COMMENT,
+    LEX_COLORS
+};
+
+// A comment or a string, a comment with no close ends with the row
+struct LexDelimiter {
+    char open[LEX_TOKEN_MAX];
+    char close[LEX_TOKEN_MAX];
+    char escape;
+    bool multiline;
+    enum LexColor color;
+};
+
+// extensions and keywords are lists like " .c .h ", so a whole
+// word is found with strstr
+struct Language {
+    char      name[8];
+    char*     extensions;
+    char*     keywords;
+    char      directive;
+    bool      numbers;
+    bool      carries;
+    struct LexDelimiter delimiters[LEX_DELIMITER_MAX];
+    size_t    delimiter_count;
+    u_int16_t start;
+};
+
+struct Language LANGUAGES[LANGUAGE_MAX];
+size_t          LANGUAGE_COUNT = 0;
+u_int8_t        LEX_CLASS[256];
+size_t          LEX_CLASSES = 0;
+size_t          LEX_STATES  = 0;
+u_int16_t*      LEX_NEXT    = NULL;
+u_int16_t*      LEX_CARRY   = NULL;
+u_int8_t*       LEX_COLOR   = NULL;
+
+// One edit replaced new_rows rows at row, the rows which were
+// there before are kept in saved. Replaying it swaps them back,
+// so the same EditOp serves undo and redo.
+struct EditOp {
+    u_int32_t row;
+    u_int32_t old_rows;
+    u_int32_t new_rows;
+    char** saved;
+};
 
+// Rows written since remember_for_undo carry its group, they
+// are already recorded and are changed in place.
 struct UndoState {
-    char* buffer;
-    u_int16_t rows;
-    u_int16_t row;
+    struct EditOp* ops;
+    size_t count;
+    size_t capacity;
+    u_int32_t group;
+    u_int32_t row;
     u_int16_t col;
     bool ends_newline;
+    bool undone;
     bool valid;
-} UNDO_STATE = {0};
-void      save_buffer_to_file(const char*, bool);
-void      set_terminal_raw_mode(bool);
-
-void detect_language(const char* filename) {
-    const char* extension = strrchr(filename, '.');
-    FILE_LANGUAGE = LANGUAGE_TEXT;
-    if(!extension) return;
-    if(strcmp(extension, ".c") == 0 || strcmp(extension, ".cpp") == 0 ||
-       strcmp(extension, ".cu") == 0) FILE_LANGUAGE = LANGUAGE_C;
-    else if(strcmp(extension, ".py") == 0) FILE_LANGUAGE = LANGUAGE_PYTHON;
-}
-void      check_EXIT(char* filename, bool called_through_shortcut) {
-  (void)filename;
-
-  // if called_through_shortcut, just update that file, and continue  
-  if(called_through_shortcut == CALLED_THROUGH_SHORTCUT) { return; }
+};
 
-  if(EXIT_FLAG) {
-    printf("\033[H\033[2J");
-    fflush(stdout);
-    if(BUFFER_DIRTY) fprintf(stdout, "Exited without saving changes.\n");
+// How a row was measured for SOFT_WRAP
+struct WrapRow {
+    u_int16_t lines;
+    u_int16_t len;
+    u_int16_t width;
+};
 
-    set_terminal_raw_mode(false);
+// Where the cursor of a buffer is, and which part of it is in view
+struct Cursor {
+    u_int32_t row;
+    u_int16_t col;
+    u_int32_t view_start_row;
+    u_int16_t view_col;
+    u_int16_t view_start_wrap;
+};
 
-    _exit(0);
-  }
+// Rows first...last - 1, and a sorted list of them which do not touch,
+// the rows an index has to read again
+struct RowRange {
+    u_int32_t first;
+    u_int32_t last;
+};
 
-  return;
-}
-void      handler_SIGINT(int signal_number) {
-  (void)signal_number;
-  EXIT_FLAG = true;
-}
+struct RowRanges {
+    struct RowRange* ranges;
+    size_t           count;
+    size_t           capacity;
+};
 
-// Disable buffer and echo in terminal, to capture sequences
-// like up, down, left, right, enter as characters
-void set_terminal_raw_mode(bool yes) {
-  static struct termios old_t, new_t; 
+/*
+------------------------------------
 
-  if(yes) {
-    tcgetattr(STDIN_FILENO, &old_t);
-    new_t = old_t;
-    new_t.c_lflag &= ~( ICANON | ECHO | ISIG | IEXTEN );
-    new_t.c_iflag &= ~( IXON | ICRNL );
-    new_t.c_cc[VSUSP] = _POSIX_VDISABLE; // Ctrl+Z belongs to light, not the shell
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_t);
-  } else {
-    tcsetattr(STDIN_FILENO, TCSANOW, &old_t);
-  }
+- struct Buffer is one open file, or the
+scratch buffer, light keeps several of them
+in BUFFERS and edits ACTIVE_BUFFER
 
-  // SGR mouse mode is click-only; selection belongs to the keyboard.
-  printf(yes? "\033[?7l\033[?25l\033[?1000h\033[?1006h":
-              "\033[?1006l\033[?1000l\033[?25h\033[?7h");
-  fflush(stdout);     
+- rows point into the shared row arena, every
+row is only as large as its size class, so a
+buffer costs memory in proportion to its text
 
-  return;
-}
+- cursor is where the cursor was when the
+buffer was last shown, every view showing it
+has a cursor of its own
 
-// Get number of rows and columns in my terminal window
-void get_terminal_size() {
-    struct winsize ws;
+- follow is set for a file opened with -f, it
+is read-only, and follow_fd is read from
+follow_offset on whenever the file grows
 
-    // Get terminal size
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) {
-        fprintf(stderr, "grave error, can not recover(IOCTL), bye\n");
-        EXIT_FLAG = true;
-        check_EXIT("", !CALLED_THROUGH_SHORTCUT);
-    }
+- disk is the file as light last read or
+wrote it, when another program writes it
+disk_changed is set, and the user is asked
+whether to reload it before anything else
 
-    TERM_ROW = ws.ws_row;
-    TERM_COL = ws.ws_col;
-}
+- loading is set while a file is still read,
+from load_fd at load_offset on, the rows read
+so far are whole rows of it
 
-// What type of key are you pressing?
-enum KeyType {
-    KEY_UNKNOWN,
-    KEY_CHAR,        
-    KEY_CTRL,       
-    KEY_ARROW_UP,
-    KEY_ARROW_DOWN,
-    KEY_ARROW_LEFT,
-    KEY_ARROW_RIGHT,
-    KEY_WORD_LEFT,
-    KEY_WORD_RIGHT,
-    KEY_HOME,
-    KEY_END,
-    KEY_PAGE_UP,
-    KEY_PAGE_DOWN,
-    KEY_BACKSPACE,
-    KEY_ENTER,
-    KEY_TAB,
-    KEY_ESC,
-    KEY_MOUSE
-};
+- lex_states holds the DFA state every row
+starts in, for the first lex_known rows, and
+only for a language which carries states over
+rows. An edit in place leaves the rows from
+lex_check_first to lex_check_last to be lexed
+again before the next frame
 
-// Which key are you exactly pressing?
-// 'ch' is valid for KEY_CHAR and KEY_CTRL
-struct Key {
-    enum KeyType type;
-    char ch;
-    int mouse_button;
-    int mouse_x;
-    int mouse_y;
-    bool mouse_pressed;
+------------------------------------
+*/
+struct Buffer {
+    char**        rows;
+    u_int32_t     row_capacity;
+    u_int32_t     number_of_rows;
+    struct Cursor cursor;
+    u_int32_t     select_start_row;
+    u_int16_t     select_start_col;
+    u_int32_t     select_end_row;
+    u_int16_t     select_end_col;
+    bool          select_visible;
+    bool          select_active;
+    bool          init_file;
+    bool          ends_newline;
+    bool          dirty;
+    char*         filename;
+    struct Language* language;
+    u_int16_t*    lex_states;
+    u_int32_t     lex_known;
+    u_int32_t     lex_capacity;
+    u_int32_t     lex_check_first;
+    u_int32_t     lex_check_last;
+    struct UndoState undo;
+    bool          follow;
+    int           follow_fd;
+    off_t         follow_offset;
+    struct stat   disk;
+    bool          disk_changed;
+    bool          loading;
+    int           load_fd;
+    off_t         load_offset;
+    off_t*        origin_offsets;
+    u_int32_t     origin_count;
+    u_int32_t     origin_capacity;
+    bool          origin_ends_newline;
+    struct stat   origin_disk;
+    char*         history;
+    size_t        history_len;
+    size_t        history_at;
+    char*         lex_cache_map;
+    size_t        lex_cache_size;
+    u_int16_t*    lex_cache;
+    u_int32_t     lex_cached;
+    struct FindBlock* find_blocks;
+    u_int32_t     find_block_count;
+    u_int32_t     find_block_capacity;
+    u_int32_t     find_indexed;
+    u_int32_t     find_hint_block;
+    u_int32_t     find_hint_first;
+    bool          find_dirty;
+    bool          results;
+    u_int32_t*    symbols;
+    u_int32_t     symbol_count;
+    u_int32_t     symbol_capacity;
+    u_int32_t     symbol_indexed;
+    u_int32_t     symbol_shift_at;
+    int32_t       symbol_shift;
+    struct RowRanges symbol_dirty;
+    struct BracketNode* brackets;
+    u_int32_t     bracket_count;
+    u_int32_t     bracket_capacity;
+    u_int32_t     bracket_free;
+    u_int32_t     bracket_root;
+    u_int32_t     bracket_indexed;
+    u_int16_t     bracket_state;
+    u_int32_t     bracket_dirty_first;
+    u_int32_t     bracket_dirty_last;
+    u_int32_t     word_indexed;
+    struct RowRanges word_dirty;
 };
 
 /*
 ------------------------------------
 
-- current_char_lock is to avoid deadlock
-conditions 
+- struct View is a rectangle of the terminal
+showing one buffer, light keeps them in VIEWS
+and ACTIVE_VIEW gets the keys
+
+- x0, x1, y0 and y1 are the part of the screen
+the view owns, in LAYOUT_ONE units, splitting a
+view halves them, so views always tile the
+screen whatever size the terminal is
+
+- top, left, rows and cols are the text area
+of the view on screen, a view which does not
+touch the left edge gives its first column to
+a separator, and one which does not touch the
+bottom gives its last row to a title
+
+- damage_first...damage_last are the buffer
+rows which changed since the view was drawn,
+every edit marks every view of its buffer,
+so each view repaints only what it shows of
+the change
+
+- drawn_start_row and drawn_start_wrap are the
+viewport as it is on screen, a view which is not
+drawn yet is painted in full, drawn_row and
+drawn_col are where its cursor is on screen, so
+a cursor which moved far repaints two rows, not
+every row in between
+
+- BUFFER_CHANGES counts buffer_damage calls, a
+key which changed it was an edit, for plugins
+
+- The upper-case names below always mean the
+field of ACTIVE_VIEW, or of the buffer it shows,
+switching buffers only switches that pointer
 
-- current_char_cond wakes up display_buffer
-thread whenever get_input receives some ip
+- NUMBER_OF_ROWS counts the current total 
+number of rows and is increased only
+when you press enter
 
-- get_input is the thread that collects and 
-interprets the input at terminal
+- CURRENT_ROW is the row we are at
+
+- CURRENT_COL records which column we are
+at CURRENT_ROW line
+
+- DISPLAY_BUFFER is the buffer that is written to 
+by the user, and stored to be used with display_buffer
+thread, to display
+
+- INIT_FILE is set if DISPLAY_BUFFER is 
+constructed using a file instead of from
+scratch
+
+- INIT_ARG_FNAME is set to the file name if
+initialized with a file, like, so: light <fname>
+
+- VIEW_START_WRAP is the first visible piece
+of VIEW_START_ROW when SOFT_WRAP is set
+
+- WRAP_TREE is a Fenwick tree over the number
+of screen rows every buffer row takes, so a
+screen row maps back to a buffer row in O(log n),
+it belongs to the view because views differ in width
+
+- WRAP_ROWS remembers how a row was measured,
+a row is measured again only when it comes
+into view with another length or terminal width
 
-- display_buffer is the thread that is 
-responsible for displaying buffer after any
-event that triggers 'DISPLAY' flag is 
-performed
-  
 ------------------------------------
 */
-struct Key             current_char;
-#define KEY_QUEUE_LEN 256
-struct Key             key_queue[KEY_QUEUE_LEN];
-size_t                 key_queue_read = 0;
-size_t                 key_queue_write = 0;
-pthread_mutex_t        current_char_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t         current_char_cond = PTHREAD_COND_INITIALIZER;
-pthread_t              get_input, display_buffer; 
+#define LAYOUT_ONE            0x10000
+struct View {
+    struct Buffer*  buffer;
+    struct Cursor   cursor;
+    u_int32_t       x0, x1, y0, y1;
+    u_int16_t       top, left, rows, cols;
+    u_int32_t       damage_first;
+    u_int32_t       damage_last;
+    u_int32_t       drawn_start_row;
+    u_int16_t       drawn_start_wrap;
+    u_int32_t       drawn_row;
+    u_int16_t       drawn_col;
+    bool            drawn;
+    bool            match;
+    u_int32_t       match_row;
+    u_int16_t       match_col;
+    u_int32_t*      wrap_tree;
+    struct WrapRow* wrap_rows;
+    u_int32_t       wrap_capacity;
+};
 
-// Read input continously from terminal and 
-// interpret it as any valid struct Key
-void* input(void* unused) {
-  (void)unused;
-    
-  while(true) { 
-    int c = getchar();
+struct Buffer** BUFFERS      = NULL;
+size_t          BUFFER_COUNT = 0;
+struct View**   VIEWS        = NULL;
+size_t          VIEW_COUNT   = 0;
+struct View*    ACTIVE_VIEW  = NULL;
+u_int32_t       BUFFER_CHANGES = 0;
+
+#define ACTIVE_BUFFER        (ACTIVE_VIEW->buffer)
+#define DISPLAY_BUFFER       (ACTIVE_BUFFER->rows)
+#define NUMBER_OF_ROWS       (ACTIVE_BUFFER->number_of_rows)
+#define CURRENT_ROW          (ACTIVE_VIEW->cursor.row)
+#define CURRENT_COL          (ACTIVE_VIEW->cursor.col)
+#define VIEW_START_ROW       (ACTIVE_VIEW->cursor.view_start_row)
+#define CURRENT_VIEW_COL     (ACTIVE_VIEW->cursor.view_col)
+#define VIEW_START_WRAP      (ACTIVE_VIEW->cursor.view_start_wrap)
+#define VIEW_TOP             (ACTIVE_VIEW->top)
+#define VIEW_LEFT            (ACTIVE_VIEW->left)
+#define VIEW_ROWS            (ACTIVE_VIEW->rows)
+#define VIEW_COLS            (ACTIVE_VIEW->cols)
+#define SELECT_START_ROW     (ACTIVE_BUFFER->select_start_row)
+#define SELECT_START_COL     (ACTIVE_BUFFER->select_start_col)
+#define SELECT_END_ROW       (ACTIVE_BUFFER->select_end_row)
+#define SELECT_END_COL       (ACTIVE_BUFFER->select_end_col)
+#define SELECT_VISIBLE       (ACTIVE_BUFFER->select_visible)
+#define SELECT_ACTIVE        (ACTIVE_BUFFER->select_active)
+#define INIT_FILE            (ACTIVE_BUFFER->init_file)
+#define BUFFER_ENDS_NEWLINE  (ACTIVE_BUFFER->ends_newline)
+#define BUFFER_DIRTY         (ACTIVE_BUFFER->dirty)
+#define INIT_ARG_FNAME       (ACTIVE_BUFFER->filename)
+#define FILE_LANGUAGE        (ACTIVE_BUFFER->language)
+#define UNDO_STATE           (ACTIVE_BUFFER->undo)
+#define WRAP_TREE            (ACTIVE_VIEW->wrap_tree)
+#define WRAP_ROWS            (ACTIVE_VIEW->wrap_rows)
 
-    if(c == EOF) {
-        EXIT_FLAG = true;
-        pthread_mutex_lock(&current_char_lock);
-        pthread_cond_signal(&current_char_cond);
-        pthread_mutex_unlock(&current_char_lock);
-        break;
-    }
+void      save_buffer_to_file(const char*, bool);
+void      set_terminal_raw_mode(bool);
+void      watch_directory(const char*);
+void      frame_drain();
+void      remember_for_undo();
+bool      write_all(int, const char*, size_t);
+bool      buffer_disk_changed(struct Buffer*);
+void      lex_cache_drop(struct Buffer*);
+void      find_rows_changed(struct Buffer*, u_int32_t, u_int32_t, u_int32_t);
+void      symbol_rows_changed(struct Buffer*, u_int32_t, u_int32_t, u_int32_t);
+void      symbols_drop(struct Buffer*);
+void      bracket_rows_changed(struct Buffer*, u_int32_t, u_int32_t, u_int32_t);
+void      brackets_drop(struct Buffer*);
+void      words_uncount(struct Buffer*, u_int32_t, u_int32_t);
+void      word_rows_changed(struct Buffer*, u_int32_t, u_int32_t, u_int32_t);
+void      plugins_event(enum light_event);
+bool      key_apply(bool*);
 
-    struct Key key = { .type = KEY_UNKNOWN, .ch = 0 };
+/*
+------------------------------------
 
-    if (c == 27) {                        // ESC or arrow current_chars
-        int c2 = getchar();
-        if (c2 == '[') {
-            int sequence = getchar();
-            if(sequence == '<') {
-                char mouse[64];
-                size_t used = 0;
-                int end;
-                while((end = getchar()) != EOF && end != 'M' && end != 'm' && used < sizeof(mouse) - 1) {
-                    mouse[used++] = end;
-                }
-                mouse[used] = '\0';
-                if(sscanf(mouse, "%d;%d;%d", &key.mouse_button, &key.mouse_x, &key.mouse_y) == 3) {
-                    key.type = KEY_MOUSE;
-                    key.mouse_pressed = end == 'M';
-                }
-            } else if(sequence >= '0' && sequence <= '9') {
-                char control[32];
-                size_t used = 0;
-                control[used++] = sequence;
-                int end;
-                while((end = getchar()) != EOF && used < sizeof(control) - 1) {
-                    control[used++] = end;
-                    if((end >= 'A' && end <= 'Z') || end == '~') break;
+- struct RowHeader sits in front of every
+row, group is the undo group which wrote the
+row last and capacity counts the '\0'
+
+- origin is one more than the line of the file
+which the row was read from, and still holds, 0
+for a row light wrote, see DELTA_SAVE
+
+- pins counts the clipboards which refer to
+the row, a pinned row is never changed in
+place, and row_free only marks it ROW_FREED
+until row_unpin lets it go
+
+- ROW_FREE keeps a free list for every size
+class, ROW_SLAB is the part of the current
+slab which was never handed out
+
+- UNDO_GROUPS numbers every remember_for_undo
+of every buffer
+
+------------------------------------
+*/
+struct RowHeader {
+    u_int32_t group;
+    u_int16_t capacity;
+    u_int8_t  size_class;
+    u_int8_t  pins;
+    u_int32_t origin;
+};
+#define ROW_CLASSES           7
+#define ROW_FREED             0x80
+#define ROW_SMALLEST_BLOCK    32
+#define ROW_HEADER(row)       ((struct RowHeader*)(row) - 1)
+void*     ROW_FREE[ROW_CLASSES];
+char*     ROW_SLAB       = NULL;
+size_t    ROW_SLAB_LEFT  = 0;
+u_int32_t UNDO_GROUPS    = 0;
+
+// Running out of memory is handled like every other unrecoverable
+// error: the buffer is written to SCRATCH_FILE, and light exits
+void* must_realloc(void* memory, size_t bytes) {
+    void* grown = realloc(memory, bytes);
+    if(grown || bytes == 0) return grown;
+    fprintf(stderr, "out of memory(unrecoverable error)\n");
+    IGN_FILE = SAVE_FILE = EXIT_FLAG = true;
+    save_buffer_to_file(SCRATCH_FILE, !CALLED_THROUGH_SHORTCUT);
+    _exit(1);
+}
+
+// A new row with room for len characters, holding ""
+char* row_alloc(size_t len) {
+    u_int16_t size_class = 0;
+    while(((size_t)ROW_SMALLEST_BLOCK << size_class) - sizeof(struct RowHeader) < len + 1) size_class++;
+    size_t block = (size_t)ROW_SMALLEST_BLOCK << size_class;
+
+    struct RowHeader* header = ROW_FREE[size_class];
+    if(header) {
+        ROW_FREE[size_class] = *(void**)header;
+    } else {
+        if(ROW_SLAB_LEFT < block) {
+            // The tail of the old slab still serves smaller rows
+            for(int tail = ROW_CLASSES - 1; tail >= 0; tail--) {
+                size_t tail_block = (size_t)ROW_SMALLEST_BLOCK << tail;
+                while(ROW_SLAB_LEFT >= tail_block) {
+                    *(void**)ROW_SLAB = ROW_FREE[tail];
+                    ROW_FREE[tail] = ROW_SLAB;
+                    ROW_SLAB += tail_block;
+                    ROW_SLAB_LEFT -= tail_block;
                 }
-                control[used] = '\0';
-                if(strcmp(control, "1;5D") == 0) key.type = KEY_WORD_LEFT;
-                else if(strcmp(control, "1;5C") == 0) key.type = KEY_WORD_RIGHT;
-                else if(strcmp(control, "1;5A") == 0 || strcmp(control, "5~") == 0) key.type = KEY_PAGE_UP;
-                else if(strcmp(control, "1;5B") == 0 || strcmp(control, "6~") == 0) key.type = KEY_PAGE_DOWN;
-                else if(strcmp(control, "1~") == 0 || strcmp(control, "7~") == 0) key.type = KEY_HOME;
-                else if(strcmp(control, "4~") == 0 || strcmp(control, "8~") == 0) key.type = KEY_END;
-            } else switch (sequence) {
-                case 'A': key.type = KEY_ARROW_UP; break;
-                case 'B': key.type = KEY_ARROW_DOWN; break;
-                case 'C': key.type = KEY_ARROW_RIGHT; break;
-                case 'D': key.type = KEY_ARROW_LEFT; break;
-                case 'H': key.type = KEY_HOME; break;
-                case 'F': key.type = KEY_END; break;
-                default: break;
             }
-        } else {
-            key.type = KEY_ESC;
-      }
-    } else if (c == 0) {                  // Ctrl + Space
-        key.type = KEY_CTRL;
-        key.ch = ' ';
-    } else if (c == 127 || c == 8) {      // Backspace (127 on Linux, 8 in some cases)
-        key.type = KEY_BACKSPACE;
-    }
-    else if (c == 10 || c == 13) {        // Enter (LF=10, CR=13)
-        key.type = KEY_ENTER;
-    }
-    else if (c == 9) {                    // Tab
-        key.type = KEY_CHAR;
-        key.ch = '\t';
-    }
-    else if (c >= 1 && c <= 26) {         // Ctrl+A (1) to Ctrl+Z (26)
-        key.type = KEY_CTRL;
-        key.ch = 'A' + c - 1;
-    }
-    else if (c >= 32 && c <= 255) {       // Printable text, including pasted UTF-8 bytes
-        key.type = KEY_CHAR;
-        key.ch = c;
+            ROW_SLAB = must_realloc(NULL, ROW_ARENA_SLAB);
+            ROW_SLAB_LEFT = ROW_ARENA_SLAB;
+        }
+        header = (struct RowHeader*)ROW_SLAB;
+        ROW_SLAB += block;
+        ROW_SLAB_LEFT -= block;
     }
 
-    pthread_mutex_lock(&current_char_lock);
-    size_t next = (key_queue_write + 1) % KEY_QUEUE_LEN;
-    while(next == key_queue_read) {
-        pthread_cond_wait(&current_char_cond, &current_char_lock);
-        next = (key_queue_write + 1) % KEY_QUEUE_LEN;
-    }
-    key_queue[key_queue_write] = key;
-    key_queue_write = next;
-    pthread_cond_signal(&current_char_cond);
-    pthread_mutex_unlock(&current_char_lock);
-  }
-  
-  return NULL;
+    header->group = ACTIVE_BUFFER? UNDO_STATE.group: 0;
+    header->capacity = block - sizeof(struct RowHeader);
+    header->size_class = size_class;
+    header->pins = 0;
+    header->origin = 0;
+    char* row = (char*)(header + 1);
+    row[0] = '\0';
+    return row;
 }
 
+void row_free(char* row) {
+    struct RowHeader* header = ROW_HEADER(row);
+    if(header->pins) {
+        header->pins |= ROW_FREED;
+        return;
+    }
+    *(void**)header = ROW_FREE[header->size_class];
+    ROW_FREE[header->size_class] = header;
+}
 
-// You can add plugins, by working with char* result
-// in join_display_buffer function. 
-// Make sure, to only concatenate to it, and not 
-// overwrite it completely, because it stores past
-// lines, too.
-void plugin_show_line_colored(char* result, int line_no) {
-   char c_line_no[64];
-   snprintf(c_line_no, sizeof(c_line_no), "\033[2K\033[38;5;240m%5d;\033[0m ", line_no);
-   strcat(result, c_line_no);
-   return;
+// A clipboard refers to row, which keeps its text until row_unpin
+void row_pin(char* row) {
+    ROW_HEADER(row)->pins++;
 }
 
-// Highlight current row, and current column
-// Some style refactoring
-// Instead of highlighting entire row, and seperately
-// highlighting current col, only highlight curr col
-// in curr row, looks much better
-bool plugin_is_keyword(const char* word, size_t len) {
-    static const char* c_keywords[] = {
-        "break", "case", "char", "const", "continue", "default", "do",
-        "double", "else", "enum", "extern", "float", "for", "if", "int",
-        "long", "return", "short", "signed", "sizeof", "static", "struct",
-        "switch", "typedef", "union", "unsigned", "void", "volatile", "while"
-    };
-    static const char* python_keywords[] = {
-        "and", "as", "assert", "async", "await", "break", "class", "continue",
-        "def", "del", "elif", "else", "except", "False", "finally", "for",
-        "from", "global", "if", "import", "in", "is", "lambda", "None",
-        "nonlocal", "not", "or", "pass", "raise", "return", "True", "try",
-        "while", "with", "yield"
-    };
-    const char** keywords = FILE_LANGUAGE == LANGUAGE_PYTHON? python_keywords: c_keywords;
-    size_t count = FILE_LANGUAGE == LANGUAGE_PYTHON?
-        sizeof(python_keywords) / sizeof(python_keywords[0]):
-        sizeof(c_keywords) / sizeof(c_keywords[0]);
-    if(FILE_LANGUAGE == LANGUAGE_TEXT) return false;
-    for(size_t i = 0; i < count; i++) {
-        if(strlen(keywords[i]) == len && strncmp(word, keywords[i], len) == 0) return true;
+void row_unpin(char* row) {
+    struct RowHeader* header = ROW_HEADER(row);
+    header->pins--;
+    if(header->pins == ROW_FREED) {
+        header->pins = 0;
+        row_free(row);
     }
-    return false;
 }
 
-const char* plugin_color_at(char* row, size_t at) {
-    char quote = 0;
-    bool escaped = false;
-
-    for(size_t i = 0; i <= at; i++) {
-        if(!quote && FILE_LANGUAGE == LANGUAGE_C && row[i] == '/' && row[i + 1] == '/')
-            return "\033[38;5;244m";
-        if(!quote && FILE_LANGUAGE == LANGUAGE_PYTHON && row[i] == '#')
-            return "\033[38;5;244m";
-        if(!quote && (row[i] == '"' || row[i] == '\'')) quote = row[i];
-        else if(quote && row[i] == quote && !escaped && i > 0) quote = 0;
-        escaped = row[i] == '\\' && !escaped;
-        if(row[i] != '\\') escaped = false;
-    }
-    if(quote || row[at] == '"' || row[at] == '\'') return "\033[38;5;114m";
-    const char* first = row + strspn(row, " \t");
-    if(FILE_LANGUAGE == LANGUAGE_C && first[0] == '#') return "\033[38;5;176m";
-    if(FILE_LANGUAGE == LANGUAGE_PYTHON && first[0] == '@') return "\033[38;5;176m";
-    if(FILE_LANGUAGE == LANGUAGE_TEXT) return "";
-    if(row[at] >= '0' && row[at] <= '9') return "\033[38;5;215m";
-
-    size_t begin = at;
-    size_t end = at;
-    while(begin > 0 && ((row[begin - 1] >= 'A' && row[begin - 1] <= 'Z') ||
-          (row[begin - 1] >= 'a' && row[begin - 1] <= 'z') || row[begin - 1] == '_')) begin--;
-    while((row[end] >= 'A' && row[end] <= 'Z') ||
-          (row[end] >= 'a' && row[end] <= 'z') || row[end] == '_') end++;
-    if(plugin_is_keyword(row + begin, end - begin)) return "\033[38;5;81m";
-    return "";
-}
-
-int selection_compare(u_int16_t row_a, u_int16_t col_a, u_int16_t row_b, u_int16_t col_b) {
-    if(row_a != row_b) return row_a < row_b? -1: 1;
-    if(col_a != col_b) return col_a < col_b? -1: 1;
-    return 0;
+// Make room for at least count rows in buffer
+void rows_reserve(struct Buffer* buffer, u_int32_t count) {
+    if(count <= buffer->row_capacity) return;
+    u_int32_t capacity = buffer->row_capacity? buffer->row_capacity: 16;
+    while(capacity < count) capacity <<= 1;
+    buffer->rows = must_realloc(buffer->rows, (size_t)capacity * sizeof(char*));
+    buffer->row_capacity = capacity;
 }
 
-bool plugin_is_selected(u_int16_t row, u_int16_t col) {
-    if(!SELECT_VISIBLE) return false;
-    u_int16_t first_row = SELECT_START_ROW, first_col = SELECT_START_COL;
-    u_int16_t last_row = SELECT_END_ROW, last_col = SELECT_END_COL;
-    if(selection_compare(first_row, first_col, last_row, last_col) > 0) {
-        first_row = SELECT_END_ROW; first_col = SELECT_END_COL;
+void view_damage(struct View* view, u_int32_t first, u_int32_t last) {
+    if(first < view->damage_first) view->damage_first = first;
+    if(last > view->damage_last) view->damage_last = last;
+}
+
+// Rows first...last of buffer changed, every view showing it repaints them
+void buffer_damage(struct Buffer* buffer, u_int32_t first, u_int32_t last) {
+    BUFFER_CHANGES++;
+    if(first + 1 < buffer->lex_known && last != MAX_NUMBER_OF_ROWS) {
+        if(first < buffer->lex_check_first) buffer->lex_check_first = first;
+        if(last > buffer->lex_check_last) buffer->lex_check_last = last;
+    }
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        if(VIEWS[i]->buffer == buffer) view_damage(VIEWS[i], first, last);
+    }
+}
+
+// old_rows rows at row at were replaced by new_rows rows. Everything
+// below moved, and the other views of the buffer keep their cursor on
+// the text it was on
+void buffer_rows_replaced(u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    buffer_damage(ACTIVE_BUFFER, at, MAX_NUMBER_OF_ROWS);
+    lex_cache_drop(ACTIVE_BUFFER);
+    find_rows_changed(ACTIVE_BUFFER, at, old_rows, new_rows);
+    symbol_rows_changed(ACTIVE_BUFFER, at, old_rows, new_rows);
+    bracket_rows_changed(ACTIVE_BUFFER, at, old_rows, new_rows);
+    word_rows_changed(ACTIVE_BUFFER, at, old_rows, new_rows);
+    if(ACTIVE_BUFFER->lex_known > at + 1) ACTIVE_BUFFER->lex_known = at + 1;
+    for(size_t i = 0; i <= VIEW_COUNT; i++) {
+        // The cursor the buffer keeps for the next view to show it
+        // moves along with the views showing it
+        struct Cursor* cursor = i < VIEW_COUNT? &VIEWS[i]->cursor: &ACTIVE_BUFFER->cursor;
+        if(i < VIEW_COUNT && (VIEWS[i] == ACTIVE_VIEW || VIEWS[i]->buffer != ACTIVE_BUFFER)) continue;
+        if(cursor->row >= at + old_rows) cursor->row = cursor->row - old_rows + new_rows;
+        else if(cursor->row >= at + new_rows) cursor->row = at + new_rows;
+        if(cursor->view_start_row >= at + old_rows)
+            cursor->view_start_row = cursor->view_start_row - old_rows + new_rows;
+        if(cursor->row > NUMBER_OF_ROWS) cursor->row = NUMBER_OF_ROWS;
+        if(cursor->view_start_row > cursor->row) cursor->view_start_row = cursor->row;
+    }
+}
+
+void undo_record(u_int32_t row, u_int32_t old_rows, u_int32_t new_rows, char** rows) {
+    if(UNDO_STATE.count == UNDO_STATE.capacity) {
+        UNDO_STATE.capacity = UNDO_STATE.capacity? UNDO_STATE.capacity * 2: 8;
+        UNDO_STATE.ops = must_realloc(UNDO_STATE.ops, UNDO_STATE.capacity * sizeof(struct EditOp));
+    }
+    char** saved = NULL;
+    if(old_rows) {
+        saved = must_realloc(NULL, (size_t)old_rows * sizeof(char*));
+        memcpy(saved, rows, (size_t)old_rows * sizeof(char*));
+    }
+    UNDO_STATE.ops[UNDO_STATE.count++] = (struct EditOp){ row, old_rows, new_rows, saved };
+}
+
+// DISPLAY_BUFFER[row], ready to be changed in place and to hold
+// len characters. The first change after remember_for_undo copies
+// the row, and keeps the old one for shortcut_undo. A pinned row is
+// copied on every change, the clipboard keeps what it referred to,
+// and so is a row which still holds a line of the file.
+char* row_write(u_int32_t row, size_t len) {
+    char* text = DISPLAY_BUFFER[row];
+    struct RowHeader* header = ROW_HEADER(text);
+    bool recorded = header->group == UNDO_STATE.group;
+    buffer_damage(ACTIVE_BUFFER, row, row);
+    lex_cache_drop(ACTIVE_BUFFER);
+    find_rows_changed(ACTIVE_BUFFER, row, 1, 1);
+    symbol_rows_changed(ACTIVE_BUFFER, row, 1, 1);
+    bracket_rows_changed(ACTIVE_BUFFER, row, 1, 1);
+    words_uncount(ACTIVE_BUFFER, row, 1);
+    if(recorded && header->capacity > len && !header->pins && !header->origin) return text;
+
+    size_t used = strlen(text);
+    char* copy = row_alloc(len > used? len: used);
+    memcpy(copy, text, used + 1);
+    if(recorded) row_free(text);
+    else undo_record(row, 1, 1, &text);
+    DISPLAY_BUFFER[row] = copy;
+    return copy;
+}
+
+// Insert count empty rows before row at, at may be one past the last row
+void rows_insert(u_int32_t at, u_int32_t count) {
+    rows_reserve(ACTIVE_BUFFER, NUMBER_OF_ROWS + 1 + count);
+    memmove(DISPLAY_BUFFER + at + count, DISPLAY_BUFFER + at,
+            (size_t)(NUMBER_OF_ROWS + 1 - at) * sizeof(char*));
+    for(u_int32_t i = 0; i < count; i++) DISPLAY_BUFFER[at + i] = row_alloc(0);
+    NUMBER_OF_ROWS += count;
+    undo_record(at, 0, count, NULL);
+    buffer_rows_replaced(at, 0, count);
+}
+
+// Remove count rows beginning with at, one row always stays
+void rows_delete(u_int32_t at, u_int32_t count) {
+    words_uncount(ACTIVE_BUFFER, at, count);
+    undo_record(at, count, 0, DISPLAY_BUFFER + at);
+    memmove(DISPLAY_BUFFER + at, DISPLAY_BUFFER + at + count,
+            (size_t)(NUMBER_OF_ROWS + 1 - at - count) * sizeof(char*));
+    NUMBER_OF_ROWS -= count;
+    buffer_rows_replaced(at, count, 0);
+}
+
+// Put op->saved back at op->row, and keep the rows it replaces
+// in op->saved instead
+void undo_replay(struct EditOp* op) {
+    char** replaced = NULL;
+    words_uncount(ACTIVE_BUFFER, op->row, op->new_rows);
+    if(op->new_rows) {
+        replaced = must_realloc(NULL, (size_t)op->new_rows * sizeof(char*));
+        memcpy(replaced, DISPLAY_BUFFER + op->row, (size_t)op->new_rows * sizeof(char*));
+    }
+    rows_reserve(ACTIVE_BUFFER, NUMBER_OF_ROWS + 1 + op->old_rows);
+    memmove(DISPLAY_BUFFER + op->row + op->old_rows, DISPLAY_BUFFER + op->row + op->new_rows,
+            (size_t)(NUMBER_OF_ROWS + 1 - op->row - op->new_rows) * sizeof(char*));
+    if(op->old_rows) memcpy(DISPLAY_BUFFER + op->row, op->saved, (size_t)op->old_rows * sizeof(char*));
+    NUMBER_OF_ROWS = NUMBER_OF_ROWS + op->old_rows - op->new_rows;
+    buffer_rows_replaced(op->row, op->new_rows, op->old_rows);
+
+    free(op->saved);
+    op->saved = replaced;
+    u_int32_t old_rows = op->old_rows;
+    op->old_rows = op->new_rows;
+    op->new_rows = old_rows;
+}
+
+// Rows kept by the last undo group are not in DISPLAY_BUFFER any more
+void undo_forget(struct UndoState* undo) {
+    for(size_t i = 0; i < undo->count; i++) {
+        for(u_int32_t row = 0; row < undo->ops[i].old_rows; row++) row_free(undo->ops[i].saved[row]);
+        free(undo->ops[i].saved);
+    }
+    undo->count = 0;
+}
+
+// Show buffer in ACTIVE_VIEW, the buffer shown before keeps its cursor
+// for the next time it is shown
+void view_show(struct Buffer* buffer) {
+    if(ACTIVE_BUFFER) ACTIVE_BUFFER->cursor = ACTIVE_VIEW->cursor;
+    ACTIVE_BUFFER = buffer;
+    ACTIVE_VIEW->cursor = buffer->cursor;
+
+    // Other views may have removed rows, or shortened the row, since
+    struct Cursor* cursor = &ACTIVE_VIEW->cursor;
+    if(buffer->rows) {
+        if(cursor->row > buffer->number_of_rows) cursor->row = buffer->number_of_rows;
+        if(cursor->view_start_row > cursor->row) cursor->view_start_row = cursor->row;
+        size_t len = strlen(buffer->rows[cursor->row]);
+        if(cursor->col > len) cursor->col = len;
+    }
+    if(ACTIVE_VIEW->wrap_capacity) {
+        memset(WRAP_ROWS, 0, (size_t)ACTIVE_VIEW->wrap_capacity * sizeof(struct WrapRow));
+        memset(WRAP_TREE, 0, ((size_t)ACTIVE_VIEW->wrap_capacity + 1) * sizeof(u_int32_t));
+    }
+    ACTIVE_VIEW->drawn = false;
+}
+
+// Add a new, empty buffer to BUFFERS and show it in ACTIVE_VIEW
+struct Buffer* buffer_new() {
+    struct Buffer* buffer = must_realloc(NULL, sizeof(struct Buffer));
+    memset(buffer, 0, sizeof(struct Buffer));
+    BUFFERS = must_realloc(BUFFERS, (BUFFER_COUNT + 1) * sizeof(struct Buffer*));
+    BUFFERS[BUFFER_COUNT++] = buffer;
+    view_show(buffer);
+    return buffer;
+}
+
+bool buffer_any_dirty() {
+    for(size_t i = 0; i < BUFFER_COUNT; i++) if(BUFFERS[i]->dirty) return true;
+    return false;
+}
+
+// Ctrl+Q asks about every buffer with unsaved changes, one at a time
+bool buffer_switch_to_dirty() {
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+        if(BUFFERS[i]->dirty) {
+            view_show(BUFFERS[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void buffer_switch(int step) {
+    size_t at = 0;
+    while(at < BUFFER_COUNT && BUFFERS[at] != ACTIVE_BUFFER) at++;
+    view_show(BUFFERS[(at + BUFFER_COUNT + step) % BUFFER_COUNT]);
+}
+
+// Add a view right after ACTIVE_VIEW and make it ACTIVE_VIEW, it shows
+// nothing until view_show, and owns no part of the screen yet
+struct View* view_new() {
+    struct View* view = must_realloc(NULL, sizeof(struct View));
+    memset(view, 0, sizeof(struct View));
+    size_t at = 0;
+    while(at < VIEW_COUNT && VIEWS[at] != ACTIVE_VIEW) at++;
+    at = at < VIEW_COUNT? at + 1: VIEW_COUNT;
+    VIEWS = must_realloc(VIEWS, (VIEW_COUNT + 1) * sizeof(struct View*));
+    memmove(VIEWS + at + 1, VIEWS + at, (VIEW_COUNT - at) * sizeof(struct View*));
+    VIEWS[at] = view;
+    VIEW_COUNT++;
+    ACTIVE_VIEW = view;
+    return view;
+}
+
+// Screen positions of every view follow from their share of the screen
+void view_layout() {
+    int area_rows = TERM_ROW > 1? TERM_ROW - 1: 1;
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        struct View* view = VIEWS[i];
+        int left = (long)view->x0 * TERM_COL / LAYOUT_ONE;
+        int right = (long)view->x1 * TERM_COL / LAYOUT_ONE;
+        int top = (long)view->y0 * area_rows / LAYOUT_ONE;
+        int bottom = (long)view->y1 * area_rows / LAYOUT_ONE;
+        int separator = view->x0 > 0;
+        int title = view->y1 < LAYOUT_ONE;
+        view->left = left + 1 + separator;
+        view->top = top + 1;
+        view->cols = right - left - separator > 1? right - left - separator: 1;
+        view->rows = bottom - top - title > 1? bottom - top - title: 1;
+        view->drawn = false;
+    }
+}
+
+void view_focus(struct View* view) {
+    ACTIVE_VIEW = view;
+    if(CURRENT_ROW > NUMBER_OF_ROWS) CURRENT_ROW = NUMBER_OF_ROWS;
+    size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+    if(CURRENT_COL > len) CURRENT_COL = len;
+}
+
+// Alt + Down and Alt + Up walk through the views
+void view_cycle(int step) {
+    size_t at = 0;
+    while(at < VIEW_COUNT && VIEWS[at] != ACTIVE_VIEW) at++;
+    view_focus(VIEWS[(at + VIEW_COUNT + step) % VIEW_COUNT]);
+}
+
+// The other half of ACTIVE_VIEW becomes a new view of the same buffer,
+// at the same place in it. The new view gets the keys.
+bool view_split(bool side_by_side) {
+    struct View* old = ACTIVE_VIEW;
+    if(side_by_side? old->cols < 2 * (LINE_GUTTER + 2): old->rows < 3) return false;
+    u_int32_t middle = side_by_side? (old->x0 + old->x1) / 2: (old->y0 + old->y1) / 2;
+
+    struct View* view = view_new();
+    view->buffer = old->buffer;
+    view->cursor = old->cursor;
+    view->x0 = old->x0; view->x1 = old->x1;
+    view->y0 = old->y0; view->y1 = old->y1;
+    if(side_by_side) view->x0 = old->x1 = middle;
+    else view->y0 = old->y1 = middle;
+    view_layout();
+    return true;
+}
+
+// How much of the edge of closed the view touches, side is 0..3 for
+// the left, right, top and bottom edge of closed
+u_int32_t view_touches(struct View* view, struct View* closed, int side) {
+    if(side < 2 && view->y0 >= closed->y0 && view->y1 <= closed->y1 &&
+       (side == 0? view->x1 == closed->x0: view->x0 == closed->x1)) return view->y1 - view->y0;
+    if(side >= 2 && view->x0 >= closed->x0 && view->x1 <= closed->x1 &&
+       (side == 2? view->y1 == closed->y0: view->y0 == closed->y1)) return view->x1 - view->x0;
+    return 0;
+}
+
+// The views along one edge of ACTIVE_VIEW take over its part of the
+// screen. Views come from halving, so one edge is always covered exactly.
+void view_close() {
+    struct View* closed = ACTIVE_VIEW;
+    if(VIEW_COUNT < 2) return;
+    for(int side = 0; side < 4; side++) {
+        u_int32_t covered = 0;
+        for(size_t i = 0; i < VIEW_COUNT; i++) covered += view_touches(VIEWS[i], closed, side);
+        if(covered != (side < 2? closed->y1 - closed->y0: closed->x1 - closed->x0)) continue;
+        for(size_t i = 0; i < VIEW_COUNT; i++) {
+            struct View* view = VIEWS[i];
+            if(!view_touches(view, closed, side)) continue;
+            if(side == 0) view->x1 = closed->x1;
+            else if(side == 1) view->x0 = closed->x0;
+            else if(side == 2) view->y1 = closed->y1;
+            else view->y0 = closed->y0;
+        }
+        break;
+    }
+
+    size_t at = 0;
+    while(VIEWS[at] != closed) at++;
+    memmove(VIEWS + at, VIEWS + at + 1, (VIEW_COUNT - at - 1) * sizeof(struct View*));
+    VIEW_COUNT--;
+    closed->buffer->cursor = closed->cursor;
+    free(closed->wrap_tree);
+    free(closed->wrap_rows);
+    free(closed);
+    view_focus(VIEWS[at > 0? at - 1: 0]);
+    view_layout();
+}
+
+// The view showing the screen position x, y in its text area, or NULL
+struct View* view_at(int x, int y) {
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        struct View* view = VIEWS[i];
+        if(y >= view->top && y < view->top + view->rows &&
+           x >= view->left && x < view->left + view->cols) return view;
+    }
+    return NULL;
+}
+
+const char* LANGUAGE_C =
+    "name C\n"
+    "extensions .c .h .cpp .cu\n"
+    "keywords break case char const continue default do double else enum extern\n"
+    "keywords float for if int long return short signed sizeof static struct\n"
+    "keywords switch typedef union unsigned void volatile while\n"
+    "line_comment //\n"
+    "block_comment /* */\n"
+    "string \" \\\n"
+    "string ' \\\n"
+    "numbers\n"
+    "directive #\n";
+
+const char* LANGUAGE_PYTHON =
+    "name PY\n"
+    "extensions .py\n"
+    "keywords and as assert async await break class continue def del elif else\n"
+    "keywords except False finally for from global if import in is lambda None\n"
+    "keywords nonlocal not or pass raise return True try while with yield\n"
+    "line_comment #\n"
+    "string \"\"\" \\ multiline\n"
+    "string ''' \\ multiline\n"
+    "string \" \\\n"
+    "string ' \\\n"
+    "numbers\n"
+    "directive @\n";
+
+bool lex_is_word(char ch) {
+    return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_' ||
+           (ch >= '0' && ch <= '9');
+}
+
+// Add word to a list like " .c .h "
+void language_list_add(char** list, const char* word) {
+    size_t len = strlen(*list);
+    *list = must_realloc(*list, len + strlen(word) + 2);
+    sprintf(*list + len, "%s ", word);
+}
+
+// Read one definition, it replaces the language of the same name
+void language_define(const char* text) {
+    struct Language language = { .extensions = strdup(" "), .keywords = strdup(" ") };
+    char* copy = strdup(text);
+    char* lines;
+    for(char* line = strtok_r(copy, "\n", &lines); line; line = strtok_r(NULL, "\n", &lines)) {
+        char* words;
+        char* key = strtok_r(line, " \t\r", &words);
+        if(!key || key[0] == '#') continue;
+        char* first = strtok_r(NULL, " \t\r", &words);
+
+        if(strcmp(key, "name") == 0 && first) {
+            snprintf(language.name, sizeof(language.name), "%s", first);
+        } else if(strcmp(key, "directive") == 0 && first) {
+            language.directive = first[0];
+        } else if(strcmp(key, "numbers") == 0) {
+            language.numbers = true;
+        } else if(strcmp(key, "extensions") == 0 || strcmp(key, "keywords") == 0) {
+            char** list = key[0] == 'e'? &language.extensions: &language.keywords;
+            for(char* word = first; word; word = strtok_r(NULL, " \t\r", &words)) {
+                if(strlen(word) < LEX_TOKEN_MAX) language_list_add(list, word);
+            }
+        } else if(first && strlen(first) < LEX_TOKEN_MAX && language.delimiter_count < LEX_DELIMITER_MAX) {
+            struct LexDelimiter delimiter = { .color = LEX_COMMENT };
+            strcpy(delimiter.open, first);
+            if(strcmp(key, "block_comment") == 0) {
+                char* close = strtok_r(NULL, " \t\r", &words);
+                if(!close || strlen(close) >= LEX_TOKEN_MAX) continue;
+                strcpy(delimiter.close, close);
+                delimiter.multiline = true;
+            } else if(strcmp(key, "string") == 0) {
+                strcpy(delimiter.close, first);
+                delimiter.color = LEX_STRING;
+                for(char* word = strtok_r(NULL, " \t\r", &words); word; word = strtok_r(NULL, " \t\r", &words)) {
+                    if(strcmp(word, "multiline") == 0) delimiter.multiline = true;
+                    else delimiter.escape = word[0];
+                }
+            } else if(strcmp(key, "line_comment") != 0) {
+                continue;
+            }
+            language.carries = language.carries || delimiter.multiline;
+            language.delimiters[language.delimiter_count++] = delimiter;
+        }
+    }
+    free(copy);
+
+    size_t at = 0;
+    while(at < LANGUAGE_COUNT && strcmp(LANGUAGES[at].name, language.name) != 0) at++;
+    if(!language.name[0] || at == LANGUAGE_MAX) {
+        free(language.extensions);
+        free(language.keywords);
+        return;
+    }
+    if(at < LANGUAGE_COUNT) {
+        free(LANGUAGES[at].extensions);
+        free(LANGUAGES[at].keywords);
+    } else {
+        LANGUAGE_COUNT++;
+    }
+    LANGUAGES[at] = language;
+}
+
+// Every .lang file in directory, in name order
+void languages_read(const char* directory) {
+    struct dirent** entries;
+    int count = scandir(directory, &entries, NULL, alphasort);
+    for(int i = 0; i < count; i++) {
+        char path[PATHMAX];
+        const char* name = entries[i]->d_name;
+        size_t len = strlen(name);
+        FILE* file = NULL;
+        if(len > 5 && strcmp(name + len - 5, ".lang") == 0 &&
+           snprintf(path, sizeof(path), "%s/%s", directory, name) < (int)sizeof(path)) file = fopen(path, "re");
+        if(file) {
+            char text[0x10000];
+            size_t got = fread(text, 1, sizeof(text) - 1, file);
+            text[got] = '\0';
+            language_define(text);
+            fclose(file);
+        }
+        free(entries[i]);
+    }
+    if(count > 0) free(entries);
+}
+
+/*
+------------------------------------
+
+- struct LexCompiler holds one language while
+it is compiled, nodes is a trie of its keywords
+and opening delimiters, node 0 is the state
+between tokens
+
+- The states of a language are numbered: the
+trie nodes, then a word which is no keyword, a
+number, a comment which ends with the row, a
+token which has just closed for each LexColor,
+and last the inside of every delimiter, two
+states for every byte of its close matched so
+far, one of them right after an escape.
+lex_step says what follows every state, and
+language_compile tabulates it
+
+------------------------------------
+*/
+struct LexNode {
+    u_int16_t parent;
+    u_int8_t  depth;
+    char      byte;
+    int8_t    accepts;
+    int8_t    opens;
+    bool      keyword;
+    bool      word;
+};
+
+struct LexCompiler {
+    struct Language* language;
+    struct LexNode*  nodes;
+    u_int16_t*       child;
+    size_t           count;
+    size_t           body[LEX_DELIMITER_MAX];
+};
+
+#define LEX_IN_WORD(lc)       ((lc)->count)
+#define LEX_IN_NUMBER(lc)     ((lc)->count + 1)
+#define LEX_IN_LINE(lc)       ((lc)->count + 2)
+#define LEX_CLOSED(lc, color) ((lc)->count + 3 + (color))
+#define LEX_BODIES(lc)        ((lc)->count + 3 + LEX_COLORS)
+
+size_t lex_insert(struct LexCompiler* lc, const char* text) {
+    size_t node = 0;
+    for(size_t i = 0; text[i]; i++) {
+        u_int16_t* next = &lc->child[node * LEX_CLASSES + LEX_CLASS[(unsigned char)text[i]]];
+        if(!*next) {
+            struct LexNode* parent = &lc->nodes[node];
+            lc->nodes[lc->count] = (struct LexNode){ node, parent->depth + 1, text[i], -1, -1, false,
+                                                     parent->word && lex_is_word(text[i]) };
+            *next = lc->count++;
+        }
+        node = *next;
+    }
+    return node;
+}
+
+// The delimiter whose inside state is in
+size_t lex_delimiter(struct LexCompiler* lc, size_t state) {
+    size_t d = 0;
+    while(state >= lc->body[d] + 2 * strlen(lc->language->delimiters[d].close)) d++;
+    return d;
+}
+
+// How much of close is matched after ch, when matched bytes of it were
+size_t lex_match(const char* close, size_t matched, char ch) {
+    char seen[LEX_TOKEN_MAX];
+    memcpy(seen, close, matched);
+    seen[matched] = ch;
+    for(size_t skip = 0; skip <= matched; skip++) {
+        if(memcmp(seen + skip, close, matched + 1 - skip) == 0) return matched + 1 - skip;
+    }
+    return 0;
+}
+
+size_t lex_step(struct LexCompiler* lc, size_t state, char ch, bool* boundary);
+
+// A node which starts with a delimiter has opened it, the bytes
+// of the node after the delimiter are already inside
+size_t lex_opened(struct LexCompiler* lc, size_t node, bool* boundary) {
+    size_t d = lc->nodes[node].opens;
+    struct LexDelimiter* delimiter = &lc->language->delimiters[d];
+    size_t len = lc->nodes[node].depth - strlen(delimiter->open);
+    char rest[LEX_TOKEN_MAX];
+    for(size_t at = node, i = len; i > 0; at = lc->nodes[at].parent) rest[--i] = lc->nodes[at].byte;
+
+    size_t state = delimiter->close[0]? lc->body[d]: LEX_IN_LINE(lc);
+    *boundary = false;
+    for(size_t i = 0; i < len; i++) state = lex_step(lc, state, rest[i], boundary);
+    return state;
+}
+
+// The state after ch, boundary is set when a token ended before ch
+size_t lex_step(struct LexCompiler* lc, size_t state, char ch, bool* boundary) {
+    bool word = lex_is_word(ch);
+    u_int16_t next = state < lc->count? lc->child[state * LEX_CLASSES + LEX_CLASS[(unsigned char)ch]]: 0;
+    *boundary = true;
+    if(state == 0) {
+        if(next) return next;
+        if(ch >= '0' && ch <= '9' && lc->language->numbers) return LEX_IN_NUMBER(lc);
+        return word? LEX_IN_WORD(lc): 0;
+    }
+
+    *boundary = false;
+    if(state < lc->count) {
+        if(next) return next;
+        if(lc->nodes[state].opens >= 0) return lex_step(lc, lex_opened(lc, state, boundary), ch, boundary);
+        if(lc->nodes[state].word && word) return LEX_IN_WORD(lc);
+    } else if(state == LEX_IN_WORD(lc)) {
+        if(word) return state;
+    } else if(state == LEX_IN_NUMBER(lc)) {
+        if(word || ch == '.') return state;
+    } else if(state == LEX_IN_LINE(lc)) {
+        return state;
+    } else if(state >= LEX_BODIES(lc)) {
+        size_t d = lex_delimiter(lc, state);
+        struct LexDelimiter* delimiter = &lc->language->delimiters[d];
+        size_t matched = (state - lc->body[d]) / 2;
+        if((state - lc->body[d]) % 2) return lc->body[d];
+        if(delimiter->escape && ch == delimiter->escape) return lc->body[d] + 1;
+        matched = lex_match(delimiter->close, matched, ch);
+        if(!delimiter->close[matched]) return LEX_CLOSED(lc, delimiter->color);
+        return lc->body[d] + 2 * matched;
+    }
+    return lex_step(lc, 0, ch, boundary);
+}
+
+enum LexColor lex_color(struct LexCompiler* lc, size_t state) {
+    if(state < lc->count) {
+        struct LexNode* node = &lc->nodes[state];
+        if(node->opens >= 0) return lc->language->delimiters[(size_t)node->opens].color;
+        return node->keyword? LEX_KEYWORD: LEX_PLAIN;
+    }
+    if(state == LEX_IN_NUMBER(lc)) return LEX_NUMBER;
+    if(state == LEX_IN_LINE(lc)) return LEX_COMMENT;
+    if(state >= LEX_BODIES(lc)) return lc->language->delimiters[lex_delimiter(lc, state)].color;
+    return state >= LEX_CLOSED(lc, 0)? state - LEX_CLOSED(lc, 0): LEX_PLAIN;
+}
+
+// Where the next row starts, after a row which ended in state
+size_t lex_carry(struct LexCompiler* lc, size_t state) {
+    bool boundary;
+    if(state > 0 && state < lc->count && lc->nodes[state].opens >= 0) state = lex_opened(lc, state, &boundary);
+    if(state < LEX_BODIES(lc)) return 0;
+    size_t d = lex_delimiter(lc, state);
+    return lc->language->delimiters[d].multiline? lc->body[d]: 0;
+}
+
+// Tabulate lex_step for every state of language and every byte class,
+// after the states of the languages compiled before it
+void language_compile(struct Language* language) {
+    struct LexCompiler lc = { .language = language, .count = 1 };
+    size_t most = 1 + strlen(language->keywords);
+    for(size_t d = 0; d < language->delimiter_count; d++) most += strlen(language->delimiters[d].open);
+    lc.nodes = must_realloc(NULL, most * sizeof(struct LexNode));
+    lc.child = calloc(most * LEX_CLASSES, sizeof(u_int16_t));
+    lc.nodes[0] = (struct LexNode){ 0, 0, 0, -1, -1, false, true };
+
+    for(const char* at = language->keywords; *at; ) {
+        char keyword[LEX_TOKEN_MAX];
+        at += strspn(at, " ");
+        size_t len = strcspn(at, " ");
+        memcpy(keyword, at, len);
+        keyword[len] = '\0';
+        if(len > 0) lc.nodes[lex_insert(&lc, keyword)].keyword = true;
+        at += len;
+    }
+    for(size_t d = 0; d < language->delimiter_count; d++) {
+        lc.nodes[lex_insert(&lc, language->delimiters[d].open)].accepts = d;
+    }
+    // A parent is always inserted before its children
+    for(size_t node = 1; node < lc.count; node++) {
+        struct LexNode* it = &lc.nodes[node];
+        it->opens = it->accepts >= 0? it->accepts: lc.nodes[it->parent].opens;
+    }
+
+    size_t states = LEX_BODIES(&lc);
+    for(size_t d = 0; d < language->delimiter_count; d++) {
+        lc.body[d] = states;
+        states += 2 * strlen(language->delimiters[d].close);
+    }
+    if(LEX_STATES + states > LEX_STATE_MAX) {
+        // No room left in a u_int16_t state, the language is never detected
+        language->extensions[0] = '\0';
+    } else {
+        unsigned char sample[256];
+        for(int byte = 255; byte >= 0; byte--) sample[LEX_CLASS[byte]] = byte;
+        LEX_NEXT = must_realloc(LEX_NEXT, (LEX_STATES + states) * LEX_CLASSES * sizeof(u_int16_t));
+        LEX_CARRY = must_realloc(LEX_CARRY, (LEX_STATES + states) * sizeof(u_int16_t));
+        LEX_COLOR = must_realloc(LEX_COLOR, LEX_STATES + states);
+        language->start = LEX_STATES;
+        for(size_t state = 0; state < states; state++) {
+            for(size_t class = 0; class < LEX_CLASSES; class++) {
+                bool boundary;
+                size_t next = lex_step(&lc, state, sample[class], &boundary);
+                LEX_NEXT[(LEX_STATES + state) * LEX_CLASSES + class] = (LEX_STATES + next) | (boundary? LEX_BOUNDARY: 0);
+            }
+            LEX_CARRY[LEX_STATES + state] = LEX_STATES + lex_carry(&lc, state);
+            LEX_COLOR[LEX_STATES + state] = lex_color(&lc, state);
+        }
+        LEX_STATES += states;
+    }
+    free(lc.nodes);
+    free(lc.child);
+}
+
+// The built-in languages, then the installed definitions, then the
+// user's own. Bytes which are in no keyword or delimiter only matter
+// as letters, digits or anything else, so they share three classes
+void languages_load() {
+    language_define(LANGUAGE_C);
+    language_define(LANGUAGE_PYTHON);
+    languages_read(LANGUAGE_DIR);
+    const char* home = getenv("HOME");
+    char directory[PATHMAX];
+    if(home && snprintf(directory, sizeof(directory), "%s/.config/light/languages", home) < (int)sizeof(directory)) {
+        languages_read(directory);
+    }
+
+    bool special[256] = { false };
+    special['.'] = true;
+    for(size_t i = 0; i < LANGUAGE_COUNT; i++) {
+        struct Language* language = &LANGUAGES[i];
+        for(const char* at = language->keywords; *at; at++) special[(unsigned char)*at] = true;
+        for(size_t d = 0; d < language->delimiter_count; d++) {
+            struct LexDelimiter* delimiter = &language->delimiters[d];
+            for(const char* at = delimiter->open; *at; at++) special[(unsigned char)*at] = true;
+            for(const char* at = delimiter->close; *at; at++) special[(unsigned char)*at] = true;
+            special[(unsigned char)delimiter->escape] = true;
+        }
+    }
+    special[' '] = special[0] = false;
+    LEX_CLASSES = 3;
+    for(int byte = 0; byte < 256; byte++) {
+        if(special[byte] && LEX_CLASSES < 256) LEX_CLASS[byte] = LEX_CLASSES++;
+        else if(byte >= '0' && byte <= '9') LEX_CLASS[byte] = 2;
+        else LEX_CLASS[byte] = lex_is_word(byte)? 1: 0;
+    }
+    for(size_t i = 0; i < LANGUAGE_COUNT; i++) language_compile(&LANGUAGES[i]);
+}
+
+void detect_language(const char* filename) {
+    const char* extension = strrchr(filename, '.');
+    char word[PATHMAX + 2];
+    FILE_LANGUAGE = NULL;
+    ACTIVE_BUFFER->lex_known = 0;
+    symbols_drop(ACTIVE_BUFFER);
+    brackets_drop(ACTIVE_BUFFER);
+    lex_cache_drop(ACTIVE_BUFFER);
+    if(!extension) return;
+    snprintf(word, sizeof(word), " %s ", extension);
+    for(size_t i = 0; i < LANGUAGE_COUNT; i++) {
+        if(strstr(LANGUAGES[i].extensions, word)) FILE_LANGUAGE = &LANGUAGES[i];
+    }
+}
+
+// The state a row ends in is where the next row starts
+u_int16_t lex_row_end(u_int16_t state, const char* row) {
+    for(; *row; row++) state = LEX_NEXT[state * LEX_CLASSES + LEX_CLASS[(unsigned char)*row]] & LEX_STATE_MAX;
+    return LEX_CARRY[state];
+}
+
+// The state row starts in. Only a language which carries states over
+// rows needs the rows above, they are lexed once and remembered
+u_int16_t lex_row_start(struct Buffer* buffer, u_int32_t row) {
+    if(!buffer->language->carries) return buffer->language->start;
+    if(row >= buffer->lex_capacity) {
+        buffer->lex_capacity = row + 1 > 2 * buffer->lex_capacity? row + 1: 2 * buffer->lex_capacity;
+        buffer->lex_states = must_realloc(buffer->lex_states, buffer->lex_capacity * sizeof(u_int16_t));
+    }
+    if(buffer->lex_known == 0) {
+        buffer->lex_states[0] = buffer->language->start;
+        buffer->lex_known = 1;
+    }
+    if(buffer->lex_known < buffer->lex_cached) {
+        u_int32_t cached = row + 1 < buffer->lex_cached? row + 1: buffer->lex_cached;
+        if(cached > buffer->lex_known) {
+            memcpy(buffer->lex_states + buffer->lex_known, buffer->lex_cache + buffer->lex_known,
+                   (size_t)(cached - buffer->lex_known) * sizeof(u_int16_t));
+            buffer->lex_known = cached;
+        }
+    }
+    for(; buffer->lex_known <= row; buffer->lex_known++) {
+        u_int32_t above = buffer->lex_known - 1;
+        buffer->lex_states[above + 1] = lex_row_end(buffer->lex_states[above], buffer->rows[above]);
+    }
+    return buffer->lex_states[row];
+}
+
+// Rows edited in place change the rows below only when they end in
+// another state. Those are lexed again and repainted until the states
+// agree, and past every view the states are forgotten instead
+void lex_settle(struct Buffer* buffer) {
+    u_int32_t row = buffer->lex_check_first, shown = 0;
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        struct View* view = VIEWS[i];
+        if(view->buffer == buffer && view->cursor.view_start_row + view->rows > shown)
+            shown = view->cursor.view_start_row + view->rows;
+    }
+    for(; row + 1 < buffer->lex_known; row++) {
+        u_int16_t end = lex_row_end(buffer->lex_states[row], buffer->rows[row]);
+        if(end == buffer->lex_states[row + 1] && row >= buffer->lex_check_last) break;
+        if(row >= shown) {
+            buffer->lex_known = row + 1;
+            break;
+        }
+        if(end == buffer->lex_states[row + 1]) continue;
+        buffer->lex_states[row + 1] = end;
+        for(size_t i = 0; i < VIEW_COUNT; i++) {
+            if(VIEWS[i]->buffer == buffer) view_damage(VIEWS[i], row + 1, row + 1);
+        }
+    }
+    buffer->lex_check_first = MAX_NUMBER_OF_ROWS;
+    buffer->lex_check_last = 0;
+}
+
+/*
+------------------------------------
+
+- A file is read LOAD_FIRST bytes before the
+first frame, and then LOAD_STEP bytes at a time
+whenever no key is waiting, so opening a file
+of any size shows it as fast as a small one.
+LOAD_PENDING counts the buffers still loading
+
+- With LIGHT_DELTA_SAVE=1, DELTA_SAVE, every
+row also remembers the line it was read from,
+and origin_offsets of the buffer where every
+line begins, with the size of the file last.
+A save then only writes what changed, see
+save_rows
+
+------------------------------------
+*/
+#define LOAD_FIRST            0x40000
+#define LOAD_STEP             0x100000
+
+size_t LOAD_PENDING = 0;
+bool   DELTA_SAVE   = false;
+
+// The next line of the file of buffer begins at offset, and row holds
+// it when whole. A line cut at MAX_NUMBER_OF_COLS - 1 characters is
+// saved with a newline it did not have, so its row is never copied
+void origin_add(struct Buffer* buffer, char* row, off_t offset, bool whole) {
+    if(buffer->origin_count + 2 > buffer->origin_capacity) {
+        buffer->origin_capacity = buffer->origin_capacity? buffer->origin_capacity * 2: 1024;
+        buffer->origin_offsets = must_realloc(buffer->origin_offsets, (size_t)buffer->origin_capacity * sizeof(off_t));
+    }
+    buffer->origin_offsets[buffer->origin_count++] = offset;
+    if(whole) ROW_HEADER(row)->origin = buffer->origin_count;
+}
+
+// Read at least bytes more of a loading buffer, in whole rows which are
+// cut like fgets cuts them, at the end of the file the buffer is loaded
+void buffer_load(struct Buffer* buffer, size_t bytes) {
+    char chunk[0x10000];
+    u_int32_t count = buffer->load_offset == 0? 0: buffer->number_of_rows + 1;
+    u_int32_t old_count = count;
+    bool end = false;
+    for(size_t read = 0; read < bytes && !end;) {
+        ssize_t got = pread(buffer->load_fd, chunk, sizeof(chunk), buffer->load_offset);
+        char* at = chunk;
+        end = got <= 0;
+        while(at < chunk + got) {
+            size_t most = chunk + got - at;
+            if(most > MAX_NUMBER_OF_COLS - 1) most = MAX_NUMBER_OF_COLS - 1;
+            char* newline = memchr(at, '\n', most);
+            size_t len = newline? (size_t)(newline - at): most;
+            // A row which may go on past the chunk is read with the next one
+            if(!newline && len < MAX_NUMBER_OF_COLS - 1 && got == sizeof(chunk)) break;
+            if(count >= MAX_NUMBER_OF_ROWS) {
+                end = true;
+                break;
+            }
+            rows_reserve(buffer, count + 1);
+            buffer->rows[count] = row_alloc(len);
+            memcpy(buffer->rows[count], at, len);
+            buffer->rows[count][len] = '\0';
+            // A row read while a macro plays is not one its undo group
+            // wrote, and remember_for_undo never opens group 0
+            ROW_HEADER(buffer->rows[count])->group = 0;
+            if(DELTA_SAVE) origin_add(buffer, buffer->rows[count], buffer->load_offset + (at - chunk),
+                                      newline || len < MAX_NUMBER_OF_COLS - 1);
+            count++;
+            buffer->ends_newline = newline != NULL;
+            at += len + (newline != NULL);
+        }
+        buffer->load_offset += at - chunk;
+        read += at - chunk;
+    }
+
+    if(count == 0) {
+        rows_reserve(buffer, 1);
+        buffer->rows[count++] = row_alloc(0);
+    }
+    buffer->number_of_rows = count - 1;
+    if(count != old_count) buffer_damage(buffer, old_count, MAX_NUMBER_OF_ROWS);
+    if(buffer->origin_offsets) {
+        buffer->origin_offsets[buffer->origin_count] = buffer->load_offset;
+        buffer->origin_ends_newline = buffer->ends_newline;
+    }
+    if(end) {
+        close(buffer->load_fd);
+        buffer->loading = false;
+        LOAD_PENDING--;
+    }
+}
+
+// Saving, reloading, or going to the last row needs all of the file
+void buffer_load_all(struct Buffer* buffer) {
+    if(buffer->loading) buffer_load(buffer, (size_t)-1);
+}
+
+// Going to row only needs the file read up to it
+void buffer_load_to(struct Buffer* buffer, u_int32_t row) {
+    while(buffer->loading && row > buffer->number_of_rows) buffer_load(buffer, LOAD_STEP);
+}
+
+u_int64_t hash_bytes(u_int64_t hash, const void* bytes, size_t len) {
+    for(size_t i = 0; i < len; i++) hash = (hash ^ ((const unsigned char*)bytes)[i]) * 0x100000001b3;
+    return hash;
+}
+
+// What light keeps about filename goes to ~/.cache/light/kind/,
+// in a file named by a hash of its full path
+bool cache_path(const char* kind, const char* filename, char* path, size_t size) {
+    const char* home = getenv("HOME");
+    char full[PATHMAX];
+    if(!home || !realpath(filename, full)) return false;
+    u_int64_t hash = hash_bytes(0xcbf29ce484222325, full, strlen(full));
+    return snprintf(path, size, "%s/.cache/light/%s/%016llx", home, kind, (unsigned long long)hash) < (int)size;
+}
+
+// Create the directories path is in
+void cache_directories(char* path) {
+    for(char* slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+/*
+------------------------------------
+
+- With LIGHT_UNDO_HISTORY=1 every save, and
+the exit, appends the undo group and the
+cursor of a buffer to a file of its own in
+~/.cache/light/undo, named by a hash of the
+path. Opening the file again maps it, and
+when the last record was written for the
+file as it is on disk now, the cursor goes
+back where it was, and Ctrl+Z undoes the last
+edit of the last session
+
+- A record is struct HistoryHead, then every
+op as three u_int32_t and old_rows rows of a
+u_int16_t length and the text, then the
+record's length and HISTORY_MAGIC, so the
+last one is found from the end. The file
+starts over past HISTORY_MAX bytes
+
+------------------------------------
+*/
+#define HISTORY_MAGIC         0x6c756e31
+#define HISTORY_MAX           0x100000
+
+struct HistoryHead {
+    u_int32_t magic;
+    u_int32_t ops;
+    int64_t   dev;
+    int64_t   ino;
+    int64_t   size;
+    int64_t   mtime_sec;
+    int64_t   mtime_nsec;
+    u_int32_t row;
+    u_int32_t view_start_row;
+    u_int32_t undo_row;
+    u_int16_t col;
+    u_int16_t undo_col;
+    u_int8_t  ends_newline;
+    u_int8_t  undone;
+    u_int8_t  valid;
+    u_int8_t  unused;
+};
+
+// Where the history of filename is kept, false when it is not
+bool history_path(const char* filename, char* path, size_t size) {
+    const char* enabled = getenv("LIGHT_UNDO_HISTORY");
+    return enabled && strcmp(enabled, "1") == 0 && cache_path("undo", filename, path, size);
+}
+
+// Append the undo group and the cursor of buffer, which was written
+// to its file, or read from it, and not changed since
+void history_append(struct Buffer* buffer, struct Cursor* cursor) {
+    char path[PATHMAX];
+    if(buffer->follow || !buffer->filename || !history_path(buffer->filename, path, sizeof(path))) return;
+    cache_directories(path);
+    struct stat info;
+    bool large = stat(path, &info) == 0 && info.st_size > HISTORY_MAX;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (large? O_TRUNC: 0), 0600);
+    if(fd == -1) return;
+
+    struct UndoState* undo = &buffer->undo;
+    struct HistoryHead head = {
+        HISTORY_MAGIC, undo->valid? undo->count: 0, buffer->disk.st_dev, buffer->disk.st_ino,
+        buffer->disk.st_size, buffer->disk.st_mtim.tv_sec, buffer->disk.st_mtim.tv_nsec,
+        cursor->row, cursor->view_start_row, undo->row, cursor->col, undo->col,
+        undo->ends_newline, undo->undone, undo->valid, 0
+    };
+    char* record = must_realloc(NULL, sizeof(head));
+    size_t len = sizeof(head), capacity = sizeof(head);
+    memcpy(record, &head, sizeof(head));
+    for(size_t i = 0; i < head.ops; i++) {
+        struct EditOp* op = &undo->ops[i];
+        size_t need = len + 3 * sizeof(u_int32_t) + 12;
+        for(u_int32_t row = 0; row < op->old_rows; row++) need += sizeof(u_int16_t) + strlen(op->saved[row]);
+        if(need > capacity) record = must_realloc(record, capacity = need * 2);
+        u_int32_t fields[3] = { op->row, op->old_rows, op->new_rows };
+        memcpy(record + len, fields, sizeof(fields));
+        len += sizeof(fields);
+        for(u_int32_t row = 0; row < op->old_rows; row++) {
+            u_int16_t row_len = strlen(op->saved[row]);
+            memcpy(record + len, &row_len, sizeof(row_len));
+            memcpy(record + len + sizeof(row_len), op->saved[row], row_len);
+            len += sizeof(row_len) + row_len;
+        }
+    }
+    u_int64_t record_len = len;
+    u_int32_t magic = HISTORY_MAGIC;
+    record = must_realloc(record, len + 12);
+    memcpy(record + len, &record_len, sizeof(record_len));
+    memcpy(record + len + sizeof(record_len), &magic, sizeof(magic));
+    write_all(fd, record, len + 12);
+    close(fd);
+    free(record);
+}
+
+// Map the history of a buffer which was just opened, and put the
+// cursor back. Its ops are only read by history_restore.
+void history_open(struct Buffer* buffer) {
+    char path[PATHMAX];
+    if(!history_path(buffer->filename, path, sizeof(path))) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd == -1) return;
+    if(fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(struct HistoryHead) + 12) {
+        close(fd);
+        return;
+    }
+    char* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return;
+
+    u_int64_t record_len;
+    u_int32_t magic;
+    struct HistoryHead head;
+    memcpy(&record_len, map + info.st_size - 12, sizeof(record_len));
+    memcpy(&magic, map + info.st_size - 4, sizeof(magic));
+    if(magic == HISTORY_MAGIC && record_len >= sizeof(head) && record_len <= (u_int64_t)info.st_size - 12)
+        memcpy(&head, map + info.st_size - 12 - record_len, sizeof(head));
+    if(magic != HISTORY_MAGIC || record_len < sizeof(head) || record_len > (u_int64_t)info.st_size - 12 ||
+       head.magic != HISTORY_MAGIC || head.dev != (int64_t)buffer->disk.st_dev ||
+       head.ino != (int64_t)buffer->disk.st_ino || head.size != (int64_t)buffer->disk.st_size ||
+       head.mtime_sec != (int64_t)buffer->disk.st_mtim.tv_sec ||
+       head.mtime_nsec != (int64_t)buffer->disk.st_mtim.tv_nsec) {
+        munmap(map, info.st_size);
+        return;
+    }
+
+    buffer_load_to(buffer, head.row);
+    struct Cursor* cursor = &ACTIVE_VIEW->cursor;
+    cursor->row = head.row > buffer->number_of_rows? buffer->number_of_rows: head.row;
+    cursor->col = head.col;
+    cursor->view_start_row = head.view_start_row > cursor->row? cursor->row: head.view_start_row;
+    size_t row_len = strlen(buffer->rows[cursor->row]);
+    if(cursor->col > row_len) cursor->col = row_len;
+    buffer->history = map;
+    buffer->history_len = info.st_size;
+    buffer->history_at = info.st_size - 12 - record_len;
+}
+
+void history_drop(struct Buffer* buffer) {
+    if(!buffer->history) return;
+    munmap(buffer->history, buffer->history_len);
+    buffer->history = NULL;
+}
+
+// The undo group of the last session becomes the one of buffer, as
+// long as nothing was edited since it was opened
+void history_restore(struct Buffer* buffer) {
+    if(!buffer->history) return;
+    buffer_load_all(buffer);
+    struct HistoryHead head;
+    const char* at = buffer->history + buffer->history_at;
+    const char* end = buffer->history + buffer->history_len - 12;
+    memcpy(&head, at, sizeof(head));
+    at += sizeof(head);
+    struct UndoState* undo = &buffer->undo;
+    undo_forget(undo);
+    for(u_int32_t i = 0; i < head.ops; i++) {
+        u_int32_t fields[3];
+        if(at + sizeof(fields) > end) break;
+        memcpy(fields, at, sizeof(fields));
+        at += sizeof(fields);
+        char** saved = fields[1]? must_realloc(NULL, (size_t)fields[1] * sizeof(char*)): NULL;
+        u_int32_t row = 0;
+        for(; row < fields[1]; row++) {
+            u_int16_t row_len;
+            if(at + sizeof(row_len) > end) break;
+            memcpy(&row_len, at, sizeof(row_len));
+            if(row_len >= MAX_NUMBER_OF_COLS || at + sizeof(row_len) + row_len > end) break;
+            saved[row] = row_alloc(row_len);
+            memcpy(saved[row], at + sizeof(row_len), row_len);
+            saved[row][row_len] = '\0';
+            at += sizeof(row_len) + row_len;
+        }
+        if(undo->count == undo->capacity) {
+            undo->capacity = undo->capacity? undo->capacity * 2: 8;
+            undo->ops = must_realloc(undo->ops, undo->capacity * sizeof(struct EditOp));
+        }
+        undo->ops[undo->count++] = (struct EditOp){ fields[0], row, fields[2], saved };
+        if(row < fields[1]) break;
+    }
+    undo->group = ++UNDO_GROUPS;
+    undo->row = head.undo_row;
+    undo->col = head.undo_col;
+    undo->ends_newline = head.ends_newline;
+    undo->undone = head.undone;
+    undo->valid = head.valid && undo->count == head.ops;
+    history_drop(buffer);
+
+    // The ops must fit the rows they are replayed on
+    u_int64_t rows = buffer->number_of_rows + 1;
+    for(size_t i = 0; i < undo->count && undo->valid; i++) {
+        struct EditOp* op = &undo->ops[undo->undone? i: undo->count - 1 - i];
+        if((u_int64_t)op->row + op->new_rows > rows || rows - op->new_rows + op->old_rows == 0) undo->valid = false;
+        else rows = rows - op->new_rows + op->old_rows;
+    }
+    if(!undo->valid) undo_forget(undo);
+}
+
+/*
+------------------------------------
+
+- A file whose language carries states over
+rows costs lexing every row above the ones
+drawn, once. light keeps those states in
+~/.cache/light/lex at exit, for a file of at
+least LEX_CACHE_MIN rows, and when the file
+is opened again unchanged, and the language
+tables hash to the same LEX_SIGNATURE, the
+states are mapped instead of lexed, and the
+rows are reserved for the whole file at once
+
+- The first edit of the buffer drops the
+cache, the rows below may lex differently
+
+------------------------------------
+*/
+#define LEX_CACHE_MAGIC       0x6c6c6531
+#define LEX_CACHE_MIN         0x4000
+
+struct LexCacheHead {
+    u_int32_t magic;
+    u_int32_t rows;
+    int64_t   dev;
+    int64_t   ino;
+    int64_t   size;
+    int64_t   mtime_sec;
+    int64_t   mtime_nsec;
+    u_int64_t signature;
+    char      language[8];
+    u_int32_t states;
+    u_int32_t unused;
+};
+
+u_int64_t LEX_SIGNATURE = 0;
+
+// Tables compiled from other definitions number their states otherwise
+u_int64_t lex_signature() {
+    if(LEX_SIGNATURE) return LEX_SIGNATURE;
+    u_int64_t hash = hash_bytes(0xcbf29ce484222325, LEX_CLASS, sizeof(LEX_CLASS));
+    hash = hash_bytes(hash, LEX_NEXT, LEX_STATES * LEX_CLASSES * sizeof(u_int16_t));
+    hash = hash_bytes(hash, LEX_CARRY, LEX_STATES * sizeof(u_int16_t));
+    return LEX_SIGNATURE = hash;
+}
+
+// The header a cache of buffer's states has to have
+struct LexCacheHead lex_cache_head(struct Buffer* buffer) {
+    struct LexCacheHead head = {
+        LEX_CACHE_MAGIC, 0, buffer->disk.st_dev, buffer->disk.st_ino, buffer->disk.st_size,
+        buffer->disk.st_mtim.tv_sec, buffer->disk.st_mtim.tv_nsec, lex_signature(), { 0 }, 0, 0
+    };
+    memcpy(head.language, buffer->language->name, sizeof(head.language));
+    return head;
+}
+
+void lex_cache_open(struct Buffer* buffer) {
+    char path[PATHMAX];
+    if(!buffer->language || !buffer->language->carries ||
+       !cache_path("lex", buffer->filename, path, sizeof(path))) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd == -1) return;
+    if(fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(struct LexCacheHead)) {
+        close(fd);
+        return;
+    }
+    char* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return;
+
+    struct LexCacheHead head, expected = lex_cache_head(buffer);
+    memcpy(&head, map, sizeof(head));
+    u_int32_t rows = head.rows;
+    head.rows = expected.rows;
+    expected.states = head.states;
+    if(memcmp(&head, &expected, sizeof(head)) != 0 ||
+       (off_t)(sizeof(head) + (size_t)head.states * sizeof(u_int16_t)) > info.st_size) {
+        munmap(map, info.st_size);
+        return;
+    }
+    if(rows && rows <= MAX_NUMBER_OF_ROWS) rows_reserve(buffer, rows);
+    buffer->lex_cache_map = map;
+    buffer->lex_cache_size = info.st_size;
+    buffer->lex_cache = (u_int16_t*)(map + sizeof(head));
+    buffer->lex_cached = head.states;
+}
+
+void lex_cache_drop(struct Buffer* buffer) {
+    if(!buffer->lex_cache_map) return;
+    munmap(buffer->lex_cache_map, buffer->lex_cache_size);
+    buffer->lex_cache_map = NULL;
+    buffer->lex_cache = NULL;
+    buffer->lex_cached = 0;
+}
+
+// Keep the states of a buffer which is what its file holds, when
+// lexing them was worth it and they are more than the cache had
+void lex_cache_write(struct Buffer* buffer) {
+    char path[PATHMAX], temporary[PATHMAX + 16];
+    if(!buffer->language || !buffer->language->carries || buffer->follow ||
+       !cache_path("lex", buffer->filename, path, sizeof(path))) return;
+    lex_settle(buffer);
+    if(buffer->lex_known < LEX_CACHE_MIN || buffer->lex_known <= buffer->lex_cached) return;
+
+    struct LexCacheHead head = lex_cache_head(buffer);
+    head.rows = buffer->loading? 0: buffer->number_of_rows + 1;
+    head.states = buffer->lex_known;
+    cache_directories(path);
+    snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path);
+    int fd = mkostemp(temporary, O_CLOEXEC);
+    if(fd == -1) return;
+    bool written = write_all(fd, (const char*)&head, sizeof(head)) &&
+                   write_all(fd, (const char*)buffer->lex_states, (size_t)head.states * sizeof(u_int16_t));
+    if(close(fd) == -1 || !written || rename(temporary, path) == -1) unlink(temporary);
+}
+
+// Read path into a new buffer, a missing file is created. If path
+// can not be opened, ACTIVE_BUFFER stays what it was. Only the start
+// of the file is read here, the rest is loaded by buffer_display
+bool buffer_open(const char* path) {
+    if(strlen(path) >= PATHMAX) {
+        fprintf(stderr, "File path is too long\n");
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if(fd == -1 && errno == ENOENT) fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if(fd == -1) {
+        fprintf(stderr, "could, not open file: %s\n", path);
+        return false;
+    }
+
+    buffer_new();
+    INIT_ARG_FNAME = strdup(path);
+    detect_language(INIT_ARG_FNAME);
+    fstat(fd, &ACTIVE_BUFFER->disk);
+    ACTIVE_BUFFER->origin_disk = ACTIVE_BUFFER->disk;
+    watch_directory(path);
+
+    ACTIVE_BUFFER->loading = true;
+    ACTIVE_BUFFER->load_fd = fd;
+    LOAD_PENDING++;
+    lex_cache_open(ACTIVE_BUFFER);
+    buffer_load(ACTIVE_BUFFER, LOAD_FIRST);
+    history_open(ACTIVE_BUFFER);
+    INIT_FILE = true;
+    plugins_event(LIGHT_EVENT_OPEN);
+    return true;
+}
+
+// The buffer which has path open, or NULL
+struct Buffer* buffer_find(const char* path) {
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+        if(BUFFERS[i]->filename && strcmp(BUFFERS[i]->filename, path) == 0) return BUFFERS[i];
+    }
+    return NULL;
+}
+void      check_EXIT(char* filename, bool called_through_shortcut) {
+  (void)filename;
+
+  // if called_through_shortcut, just update that file, and continue  
+  if(called_through_shortcut == CALLED_THROUGH_SHORTCUT) { return; }
+
+  if(EXIT_FLAG) {
+    // The history and the lexer states of every buffer which is what
+    // its file holds
+    ACTIVE_BUFFER->cursor = ACTIVE_VIEW->cursor;
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+      if(BUFFERS[i]->dirty || !BUFFERS[i]->init_file || buffer_disk_changed(BUFFERS[i])) continue;
+      history_restore(BUFFERS[i]);
+      history_append(BUFFERS[i], &BUFFERS[i]->cursor);
+      lex_cache_write(BUFFERS[i]);
+    }
+    frame_drain();
+    printf("\033[H\033[2J");
+    fflush(stdout);
+    if(buffer_any_dirty()) fprintf(stdout, "Exited without saving changes.\n");
+
+    set_terminal_raw_mode(false);
+
+    _exit(0);
+  }
+
+  return;
+}
+void      handler_SIGINT(int signal_number) {
+  (void)signal_number;
+  EXIT_FLAG = true;
+}
+
+// Disable buffer and echo in terminal, to capture sequences
+// like up, down, left, right, enter as characters
+void set_terminal_raw_mode(bool yes) {
+  static struct termios old_t, new_t; 
+
+  if(yes) {
+    tcgetattr(STDIN_FILENO, &old_t);
+    new_t = old_t;
+    new_t.c_lflag &= ~( ICANON | ECHO | ISIG | IEXTEN );
+    new_t.c_iflag &= ~( IXON | ICRNL );
+    new_t.c_cc[VSUSP] = _POSIX_VDISABLE; // Ctrl+Z belongs to light, not the shell
+    new_t.c_cc[VMIN] = 1;                // input reads whatever has arrived
+    new_t.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &new_t);
+  } else {
+    tcsetattr(STDIN_FILENO, TCSANOW, &old_t);
+  }
+
+  // SGR mouse mode is click-only; selection belongs to the keyboard.
+  printf(yes? "\033[?7l\033[?25l\033[?1000h\033[?1006h":
+              "\033[?1006l\033[?1000l\033[?25h\033[?7h");
+  fflush(stdout);     
+
+  return;
+}
+
+// Get number of rows and columns in my terminal window
+void get_terminal_size() {
+    struct winsize ws;
+
+    // Get terminal size
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) {
+        fprintf(stderr, "grave error, can not recover(IOCTL), bye\n");
+        EXIT_FLAG = true;
+        check_EXIT("", !CALLED_THROUGH_SHORTCUT);
+    }
+
+    TERM_ROW = ws.ws_row;
+    TERM_COL = ws.ws_col;
+}
+
+// What type of key are you pressing?
+enum KeyType {
+    KEY_UNKNOWN,
+    KEY_CHAR,        
+    KEY_CTRL,       
+    KEY_ARROW_UP,
+    KEY_ARROW_DOWN,
+    KEY_ARROW_LEFT,
+    KEY_ARROW_RIGHT,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_PAGE_UP,
+    KEY_PAGE_DOWN,
+    KEY_BACKSPACE,
+    KEY_ENTER,
+    KEY_TAB,
+    KEY_ESC,
+    KEY_MOUSE,
+    KEY_NEXT_BUFFER,
+    KEY_PREVIOUS_BUFFER,
+    KEY_NEXT_VIEW,
+    KEY_PREVIOUS_VIEW,
+    KEY_MACRO_RECORD,
+    KEY_MACRO_PLAY,
+    KEY_FILE_CHANGED,
+    KEY_GREP_HITS,
+    KEY_REDRAW
+};
+
+// Which key are you exactly pressing?
+// 'ch' is valid for KEY_CHAR and KEY_CTRL
+struct Key {
+    enum KeyType type;
+    char ch;
+    int mouse_button;
+    int mouse_x;
+    int mouse_y;
+    bool mouse_pressed;
+};
+
+/*
+------------------------------------
+
+- current_char_lock is to avoid deadlock
+conditions 
+
+- current_char_cond wakes up display_buffer
+thread whenever get_input receives some ip
+
+- get_input is the thread that collects and 
+interprets the input at terminal
+
+- display_buffer is the thread that is 
+responsible for displaying buffer after any
+event that triggers 'DISPLAY' flag is 
+performed
+
+- watch_files is the thread which sleeps on
+WATCH_FD, an inotify descriptor, and queues a
+KEY_FILE_CHANGED when a watched file changes,
+WATCH_PENDING keeps it to one such key at a time
+
+- render_frames is the thread which writes the
+frames display_buffer composes to the terminal,
+through FRAME_FD which never blocks, FRAME_BUSY
+is set while it writes FRAME_OUT, and a frame
+wanted meanwhile is composed once it is done
+  
+------------------------------------
+*/
+struct Key             current_char;
+#define KEY_QUEUE_LEN 256
+struct Key             key_queue[KEY_QUEUE_LEN];
+size_t                 key_queue_read = 0;
+size_t                 key_queue_write = 0;
+pthread_mutex_t        current_char_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t         current_char_cond = PTHREAD_COND_INITIALIZER;
+pthread_t              get_input, display_buffer, watch_files, render_frames; 
+int                    WATCH_FD = -1;
+volatile sig_atomic_t  WATCH_PENDING = false;
+
+struct Frame {
+    char*  text;
+    size_t len;
+    size_t capacity;
+};
+struct Frame           FRAME_NEXT, FRAME_OUT;
+int                    FRAME_FD = STDOUT_FILENO;
+bool                   FRAME_BUSY = false;
+bool                   FRAME_WANTED = false;
+pthread_mutex_t        frame_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t         frame_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+------------------------------------
+
+- struct Clipboard is the text copied last,
+as pieces of the rows it was copied from,
+with a '\n' between two pieces. The rows are
+pinned, so neither an edit nor an undo changes
+what a piece refers to
+
+- CLIPBOARD_NEXT is written to the terminal
+as OSC 52 by render_output after its current
+frame, CLIPBOARD_EXPORT while it is, and
+CLIPBOARD_CANCEL stops it early when a newer
+copy is waiting. An old clipboard which is
+still written is CLIPBOARD_RETIRED until
+render_output is done with it
+
+- EXPORT_CHUNK bytes of the clipboard are
+encoded and written at a time
+
+------------------------------------
+*/
+struct ClipPiece {
+    char*     row;
+    u_int32_t begin;
+    u_int32_t len;
+};
+struct Clipboard {
+    struct ClipPiece* pieces;
+    size_t            count;
+    size_t            len;
+};
+#define EXPORT_CHUNK          0xc000
+struct Clipboard*      TEXT_CLIPBOARD = NULL;
+struct Clipboard*      CLIPBOARD_RETIRED = NULL;
+struct Clipboard*      CLIPBOARD_NEXT = NULL;
+struct Clipboard*      CLIPBOARD_EXPORT = NULL;
+bool                   CLIPBOARD_CANCEL = false;
+
+// Wait for room in key_queue, then queue key for display_buffer
+void key_queue_push(struct Key key) {
+    pthread_mutex_lock(&current_char_lock);
+    size_t next = (key_queue_write + 1) % KEY_QUEUE_LEN;
+    while(next == key_queue_read) {
+        pthread_cond_wait(&current_char_cond, &current_char_lock);
+        next = (key_queue_write + 1) % KEY_QUEUE_LEN;
+    }
+    key_queue[key_queue_write] = key;
+    key_queue_write = next;
+    pthread_cond_signal(&current_char_cond);
+    pthread_mutex_unlock(&current_char_lock);
+}
+
+// Ctrl + C typed while light waits on something stops the wait, the
+// key is taken out of key_queue so it does not copy afterwards
+bool key_queue_take_interrupt() {
+    bool found = false;
+    pthread_mutex_lock(&current_char_lock);
+    for(size_t i = key_queue_read; i != key_queue_write; i = (i + 1) % KEY_QUEUE_LEN) {
+        if(key_queue[i].type != KEY_CTRL || key_queue[i].ch != 'C') continue;
+        key_queue[i] = (struct Key){ .type = KEY_UNKNOWN, .ch = 0 };
+        found = true;
+    }
+    pthread_mutex_unlock(&current_char_lock);
+    return found;
+}
+
+/*
+------------------------------------
+
+- KEY_SEQUENCES are the escape sequences light
+knows, KEY_TRIE is built from them, and input
+walks it one byte at a time, so a sequence
+which ends in a later read than it began in
+is decoded all the same
+
+- The rest of a CSI sequence which is not in
+KEY_TRIE is skipped, up to its final byte, and
+a mouse report is read field by field
+
+- A lone ESC is told from the start of a
+sequence by time: when ESC_TIMEOUT ms pass
+with a sequence unfinished, its ESC is a key
+of its own and the bytes after it are read
+again, LIGHT_ESC_TIMEOUT=<ms> changes it
+
+------------------------------------
+*/
+#define KEY_TRIE_MAX          128
+#define KEY_PENDING_MAX       16
+
+struct KeySequence {
+    const char*  bytes;
+    enum KeyType type;
+};
+
+const struct KeySequence KEY_SEQUENCES[] = {
+    { "\033[A", KEY_ARROW_UP },       { "\033OA", KEY_ARROW_UP },
+    { "\033[B", KEY_ARROW_DOWN },     { "\033OB", KEY_ARROW_DOWN },
+    { "\033[C", KEY_ARROW_RIGHT },    { "\033OC", KEY_ARROW_RIGHT },
+    { "\033[D", KEY_ARROW_LEFT },     { "\033OD", KEY_ARROW_LEFT },
+    { "\033[H", KEY_HOME },           { "\033OH", KEY_HOME },
+    { "\033[F", KEY_END },            { "\033OF", KEY_END },
+    { "\033[1~", KEY_HOME },          { "\033[7~", KEY_HOME },
+    { "\033[4~", KEY_END },           { "\033[8~", KEY_END },
+    { "\033[5~", KEY_PAGE_UP },       { "\033[1;5A", KEY_PAGE_UP },
+    { "\033[6~", KEY_PAGE_DOWN },     { "\033[1;5B", KEY_PAGE_DOWN },
+    { "\033[1;5D", KEY_WORD_LEFT },   { "\033[1;5C", KEY_WORD_RIGHT },
+    { "\033[1;3C", KEY_NEXT_BUFFER }, { "\033[1;3D", KEY_PREVIOUS_BUFFER },
+    { "\033[1;3B", KEY_NEXT_VIEW },   { "\033[1;3A", KEY_PREVIOUS_VIEW },
+    { "\033OP", KEY_UNKNOWN },        { "\033OQ", KEY_UNKNOWN },
+    { "\033OR", KEY_MACRO_RECORD },   { "\033OS", KEY_MACRO_PLAY },
+    { "\033[13~", KEY_MACRO_RECORD }, { "\033[14~", KEY_MACRO_PLAY },
+    { "\033[<", KEY_MOUSE }
+};
+
+// known is set where a sequence ends, a KEY_MOUSE node starts a report
+struct KeyNode {
+    u_int8_t     child[128];
+    enum KeyType type;
+    bool         known;
+    bool         csi;
+};
+
+struct KeyNode KEY_TRIE[KEY_TRIE_MAX];
+size_t         KEY_NODES = 1;
+int            ESC_TIMEOUT = 25;
+
+// Where input is in KEY_TRIE, pending are the bytes which led there
+struct KeyDecoder {
+    char      pending[KEY_PENDING_MAX];
+    size_t    len;
+    u_int8_t  node;
+    bool      skipping;
+    bool      mouse;
+    int       fields[3];
+    size_t    field;
+};
+
+void key_trie_build() {
+    const char* timeout = getenv("LIGHT_ESC_TIMEOUT");
+    if(timeout && atoi(timeout) > 0) ESC_TIMEOUT = atoi(timeout);
+    for(size_t i = 0; i < sizeof(KEY_SEQUENCES) / sizeof(KEY_SEQUENCES[0]); i++) {
+        size_t node = 0;
+        for(const char* at = KEY_SEQUENCES[i].bytes; *at; at++) {
+            u_int8_t* next = &KEY_TRIE[node].child[(unsigned char)*at];
+            if(!*next && KEY_NODES < KEY_TRIE_MAX) {
+                KEY_TRIE[KEY_NODES].csi = KEY_TRIE[node].csi || (node == KEY_TRIE[0].child[27] && *at == '[');
+                *next = KEY_NODES++;
+            }
+            node = *next;
+        }
+        KEY_TRIE[node].type = KEY_SEQUENCES[i].type;
+        KEY_TRIE[node].known = true;
+    }
+}
+
+// A byte which starts no sequence is a key by itself
+struct Key key_from_byte(unsigned char c) {
+    struct Key key = { .type = KEY_UNKNOWN, .ch = 0 };
+    if (c == 0) {                         // Ctrl + Space
+        key.type = KEY_CTRL;
+        key.ch = ' ';
+    } else if (c == 127 || c == 8) {      // Backspace (127 on Linux, 8 in some cases)
+        key.type = KEY_BACKSPACE;
+    }
+    else if (c == 10 || c == 13) {        // Enter (LF=10, CR=13)
+        key.type = KEY_ENTER;
+    }
+    else if (c == 9) {                    // Tab
+        key.type = KEY_CHAR;
+        key.ch = '\t';
+    }
+    else if (c == 29) {                   // Ctrl+]
+        key.type = KEY_CTRL;
+        key.ch = ']';
+    }
+    else if (c >= 1 && c <= 26) {         // Ctrl+A (1) to Ctrl+Z (26)
+        key.type = KEY_CTRL;
+        key.ch = 'A' + c - 1;
+    }
+    else if (c >= 32) {                   // Printable text, including pasted UTF-8 bytes
+        key.type = KEY_CHAR;
+        key.ch = c;
+    }
+    return key;
+}
+
+void key_decode(struct KeyDecoder* decoder, unsigned char c);
+
+// The pending bytes are no sequence after all: their ESC is a key,
+// and the bytes after it are decoded again
+void key_decode_flush(struct KeyDecoder* decoder) {
+    char again[KEY_PENDING_MAX];
+    size_t len = decoder->len;
+    memcpy(again, decoder->pending, len);
+    decoder->len = decoder->node = 0;
+    if(len == 0) return;
+    key_queue_push((struct Key){ .type = KEY_ESC, .ch = 0 });
+    for(size_t i = 1; i < len; i++) key_decode(decoder, again[i]);
+}
+
+// Nothing came for ESC_TIMEOUT ms, a report or a CSI sequence which
+// stops half way is dropped
+void key_decode_timeout(struct KeyDecoder* decoder) {
+    if(decoder->mouse || decoder->skipping) {
+        decoder->mouse = decoder->skipping = false;
+        decoder->len = decoder->node = 0;
+    }
+    key_decode_flush(decoder);
+}
+
+void key_decode(struct KeyDecoder* decoder, unsigned char c) {
+    if(decoder->mouse) {
+        if(c >= '0' && c <= '9') {
+            int* field = &decoder->fields[decoder->field < 3? decoder->field: 2];
+            if(*field < 100000) *field = *field * 10 + c - '0';
+            return;
+        }
+        if(c == ';') {
+            decoder->field++;
+            return;
+        }
+        struct Key key = { .type = KEY_UNKNOWN, .ch = 0 };
+        if((c == 'M' || c == 'm') && decoder->field == 2) {
+            key = (struct Key){ .type = KEY_MOUSE, .mouse_button = decoder->fields[0],
+                                .mouse_x = decoder->fields[1], .mouse_y = decoder->fields[2],
+                                .mouse_pressed = c == 'M' };
+        }
+        decoder->mouse = false;
+        key_queue_push(key);
+        return;
+    }
+    if(decoder->skipping) {
+        decoder->skipping = c < 0x40 || c > 0x7e;
+        if(!decoder->skipping) key_queue_push((struct Key){ .type = KEY_UNKNOWN, .ch = 0 });
+        return;
+    }
+    if(decoder->node == 0 && c != 27) {
+        key_queue_push(key_from_byte(c));
+        return;
+    }
+
+    struct KeyNode* node = &KEY_TRIE[decoder->node];
+    u_int8_t next = c < 128? node->child[c]: 0;
+    if(next && decoder->len < KEY_PENDING_MAX) {
+        decoder->pending[decoder->len++] = c;
+        decoder->node = next;
+        if(!KEY_TRIE[next].known) return;
+        decoder->len = decoder->node = 0;
+        if(KEY_TRIE[next].type != KEY_MOUSE) {
+            key_queue_push((struct Key){ .type = KEY_TRIE[next].type, .ch = 0 });
+        } else {
+            decoder->mouse = true;
+            decoder->field = 0;
+            memset(decoder->fields, 0, sizeof(decoder->fields));
+        }
+    } else if(node->csi) {
+        decoder->len = decoder->node = 0;
+        decoder->skipping = true;
+        key_decode(decoder, c);
+    } else {
+        key_decode_flush(decoder);
+        key_decode(decoder, c);
+    }
+}
+
+// Read input continously from terminal and interpret it as any valid
+// struct Key. A read may end anywhere in a sequence, the decoder goes
+// on with the next one, or gives up after ESC_TIMEOUT ms
+void* input(void* unused) {
+  (void)unused;
+  struct KeyDecoder decoder = { .len = 0 };
+  unsigned char bytes[4096];
+  key_trie_build();
+
+  while(true) {
+    struct pollfd terminal = { STDIN_FILENO, POLLIN, 0 };
+    if(decoder.len > 0 || decoder.mouse || decoder.skipping) {
+        int ready = poll(&terminal, 1, ESC_TIMEOUT);
+        if(ready == 0) key_decode_timeout(&decoder);
+        if(ready <= 0) continue;
+    }
+
+    ssize_t got = read(STDIN_FILENO, bytes, sizeof(bytes));
+    if(got == -1 && errno == EINTR) continue;
+    if(got <= 0) {
+        EXIT_FLAG = true;
+        pthread_mutex_lock(&current_char_lock);
+        pthread_cond_signal(&current_char_cond);
+        pthread_mutex_unlock(&current_char_lock);
+        break;
+    }
+    for(ssize_t i = 0; i < got; i++) key_decode(&decoder, bytes[i]);
+  }
+
+  return NULL;
+}
+
+// Sleeps in read until a watched file changes, so a quiet file costs
+// nothing. A burst of writes becomes a single KEY_FILE_CHANGED.
+void* watch_changes(void* unused) {
+  (void)unused;
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while(read(WATCH_FD, events, sizeof(events)) > 0 || errno == EINTR) {
+    if(WATCH_PENDING) continue;
+    WATCH_PENDING = true;
+    key_queue_push((struct Key){ .type = KEY_FILE_CHANGED, .ch = 0 });
+  }
+  return NULL;
+}
+
+// The watcher thread is started with the first watched file
+void watch_file(const char* path, u_int32_t events) {
+    if(WATCH_FD == -1) {
+        WATCH_FD = inotify_init1(IN_CLOEXEC);
+        if(WATCH_FD == -1) return;
+        pthread_create(&watch_files, NULL, watch_changes, NULL);
+    }
+    inotify_add_watch(WATCH_FD, path, events | IN_MASK_ADD);
+}
+
+// An open file is watched through its directory, so a program which
+// saves by renaming a new file over it is noticed as well
+void watch_directory(const char* path) {
+    char directory[PATHMAX];
+    const char* slash = strrchr(path, '/');
+    if(slash == NULL) strcpy(directory, ".");
+    else snprintf(directory, sizeof(directory), "%.*s", slash == path? 1: (int)(slash - path), path);
+    watch_file(directory, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+}
+
+// Append to the frame display_buffer is composing, like printf
+void frame_printf(const char* format, ...) {
+    va_list arguments;
+    while(true) {
+        size_t room = FRAME_NEXT.capacity - FRAME_NEXT.len;
+        va_start(arguments, format);
+        int len = vsnprintf(FRAME_NEXT.text + FRAME_NEXT.len, room, format, arguments);
+        va_end(arguments);
+        if(len < 0) return;
+        if((size_t)len < room) {
+            FRAME_NEXT.len += len;
+            return;
+        }
+        FRAME_NEXT.capacity = (FRAME_NEXT.len + len + 1) * 2;
+        FRAME_NEXT.text = must_realloc(FRAME_NEXT.text, FRAME_NEXT.capacity);
+    }
+}
+
+const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#if defined(__x86_64__) || defined(__i386__)
+// 12 bytes become 16 characters at once: the bytes are spread so
+// every 32 bits hold one 3 byte group, the multiplies shift the four
+// 6 bit fields of a group into bytes of their own, and one shuffle
+// looks up what each field is offset by in BASE64. It loads 16
+// bytes for every 12, len is what it leaves to base64_encode.
+__attribute__((target("ssse3")))
+size_t base64_ssse3(const unsigned char* in, size_t len, char* out) {
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+    for(; done + 16 <= len; done += 12, out += 16) {
+        __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + done)), spread);
+        __m128i high = _mm_mulhi_epu16(_mm_and_si128(bytes, _mm_set1_epi32(0x0fc0fc00)),
+                                       _mm_set1_epi32(0x04000040));
+        __m128i low = _mm_mullo_epi16(_mm_and_si128(bytes, _mm_set1_epi32(0x003f03f0)),
+                                      _mm_set1_epi32(0x01000010));
+        __m128i fields = _mm_or_si128(high, low);
+        // 0...25 look up 13, 26...51 look up 0, 52...63 look up 1...12
+        __m128i range = _mm_subs_epu8(fields, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), fields),
+                                                  _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i*)out, _mm_add_epi8(fields, _mm_shuffle_epi8(offsets, range)));
+    }
+    return done;
+}
+#endif
+
+// Encode len bytes into out, which has room for 4 characters for
+// every 3 bytes. Only the last call of a text has finish set, and
+// pads it with '=', any other call encodes whole 3 byte groups and
+// returns how many bytes it used.
+size_t base64_encode(const unsigned char* in, size_t len, char* out, bool finish, size_t* used) {
+    size_t done = 0;
+    char* start = out;
+#if defined(__x86_64__) || defined(__i386__)
+    static int ssse3 = -1;
+    if(ssse3 == -1) ssse3 = __builtin_cpu_supports("ssse3");
+    if(ssse3) {
+        done = base64_ssse3(in, len, out);
+        out += done / 3 * 4;
+    }
+#endif
+    for(; done + 3 <= len; done += 3) {
+        unsigned int value = in[done] << 16 | in[done + 1] << 8 | in[done + 2];
+        *out++ = BASE64[value >> 18];
+        *out++ = BASE64[(value >> 12) & 63];
+        *out++ = BASE64[(value >> 6) & 63];
+        *out++ = BASE64[value & 63];
+    }
+    if(finish && done < len) {
+        unsigned int value = in[done] << 16 | (done + 1 < len? in[done + 1] << 8: 0);
+        *out++ = BASE64[value >> 18];
+        *out++ = BASE64[(value >> 12) & 63];
+        *out++ = done + 1 < len? BASE64[(value >> 6) & 63]: '=';
+        *out++ = '=';
+        done = len;
+    }
+    *used = done;
+    return out - start;
+}
+
+// Write all of text to the terminal, waiting for it when it is slow
+void terminal_write(const char* text, size_t len) {
+    for(size_t done = 0; done < len;) {
+        ssize_t written = write(FRAME_FD, text + done, len - done);
+        if(written > 0) done += written;
+        else if(errno == EAGAIN) poll(&(struct pollfd){ .fd = FRAME_FD, .events = POLLOUT }, 1, -1);
+        else if(errno != EINTR) break;
+    }
+}
+
+// Offer clipboard to the terminal's clipboard as OSC 52. The text is
+// gathered from the pinned rows EXPORT_CHUNK bytes at a time, so
+// copying a large part of a file never holds it in memory twice.
+void clipboard_export(struct Clipboard* clipboard) {
+    static unsigned char plain[EXPORT_CHUNK + 2];
+    static char encoded[(EXPORT_CHUNK + 2) / 3 * 4 + 4];
+    size_t kept = 0, used;
+    terminal_write("\033]52;c;", 7);
+    for(size_t i = 0; i < clipboard->count; i++) {
+        struct ClipPiece* piece = &clipboard->pieces[i];
+        size_t len = piece->len + (i + 1 < clipboard->count);
+        for(size_t at = 0; at < len;) {
+            size_t take = len - at < EXPORT_CHUNK - kept? len - at: EXPORT_CHUNK - kept;
+            size_t text = at < piece->len? piece->len - at: 0;
+            if(text > take) text = take;
+            memcpy(plain + kept, piece->row + piece->begin + at, text);
+            if(text < take) plain[kept + text] = '\n';
+            kept += take;
+            at += take;
+            if(kept < EXPORT_CHUNK) continue;
+
+            terminal_write(encoded, base64_encode(plain, kept, encoded, false, &used));
+            memmove(plain, plain + used, kept - used);
+            kept -= used;
+            pthread_mutex_lock(&frame_lock);
+            bool cancel = CLIPBOARD_CANCEL;
+            pthread_mutex_unlock(&frame_lock);
+            if(cancel) {
+                kept = 0;
+                i = clipboard->count;
+                break;
+            }
+        }
+    }
+    size_t len = base64_encode(plain, kept, encoded, true, &used);
+    encoded[len++] = '\a';
+    terminal_write(encoded, len);
+}
+
+// Writes each frame it is handed. A terminal which can not keep up
+// only keeps this thread waiting in poll, display_buffer goes on
+// editing, and composes a single frame of the newest state when the
+// last one is out, the states in between are never drawn.
+void* render_output(void* unused) {
+  (void)unused;
+  pthread_mutex_lock(&frame_lock);
+  while(true) {
+    while(!FRAME_BUSY) pthread_cond_wait(&frame_cond, &frame_lock);
+    pthread_mutex_unlock(&frame_lock);
+
+    terminal_write(FRAME_OUT.text, FRAME_OUT.len);
+
+    pthread_mutex_lock(&frame_lock);
+    while(CLIPBOARD_NEXT) {
+      CLIPBOARD_EXPORT = CLIPBOARD_NEXT;
+      CLIPBOARD_NEXT = NULL;
+      CLIPBOARD_CANCEL = false;
+      pthread_mutex_unlock(&frame_lock);
+      clipboard_export(CLIPBOARD_EXPORT);
+      pthread_mutex_lock(&frame_lock);
+      CLIPBOARD_EXPORT = NULL;
+    }
+    FRAME_BUSY = false;
+    pthread_cond_broadcast(&frame_cond);
+    if(FRAME_WANTED) {
+      FRAME_WANTED = false;
+      pthread_mutex_unlock(&frame_lock);
+      key_queue_push((struct Key){ .type = KEY_REDRAW, .ch = 0 });
+      pthread_mutex_lock(&frame_lock);
+    }
+  }
+  return NULL;
+}
+
+// The terminal gets a file description of its own, so O_NONBLOCK
+// does not reach stdin, which is usually the same terminal
+void frame_start() {
+    FRAME_NEXT.text = must_realloc(NULL, FRAME_NEXT.capacity = 0x10000);
+    FRAME_OUT.text = must_realloc(NULL, FRAME_OUT.capacity = 0x10000);
+    char* terminal = isatty(STDOUT_FILENO)? ttyname(STDOUT_FILENO): NULL;
+    int fd = terminal? open(terminal, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC): -1;
+    if(fd != -1) FRAME_FD = fd;
+    pthread_create(&render_frames, NULL, render_output, NULL);
+}
+
+// Hand FRAME_NEXT to render_output, false while it still writes
+// the last frame, the caller composes its frame later then
+bool frame_idle() {
+    pthread_mutex_lock(&frame_lock);
+    bool idle = !FRAME_BUSY;
+    if(!idle) FRAME_WANTED = true;
+    pthread_mutex_unlock(&frame_lock);
+    return idle;
+}
+
+void frame_send() {
+    pthread_mutex_lock(&frame_lock);
+    struct Frame sent = FRAME_OUT;
+    FRAME_OUT = FRAME_NEXT;
+    FRAME_NEXT = sent;
+    FRAME_NEXT.len = 0;
+    FRAME_BUSY = true;
+    pthread_cond_broadcast(&frame_cond);
+    pthread_mutex_unlock(&frame_lock);
+}
+
+// Wait until every frame is on the terminal, before writing to it directly
+void frame_drain() {
+    pthread_mutex_lock(&frame_lock);
+    while(FRAME_BUSY) pthread_cond_wait(&frame_cond, &frame_lock);
+    pthread_mutex_unlock(&frame_lock);
+}
+
+// a and b are the same file, which was not written in between
+bool stat_same(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Another program wrote the file of buffer since light read or wrote it
+bool buffer_disk_changed(struct Buffer* buffer) {
+    struct stat info;
+    if(stat(buffer->filename, &info) == -1) return false;
+    return !stat_same(&info, &buffer->disk);
+}
+
+// The last row of buffer gets len more characters
+void follow_append(struct Buffer* buffer, const char* text, size_t len) {
+    char* row = buffer->rows[buffer->number_of_rows];
+    size_t used = strlen(row);
+    if(ROW_HEADER(row)->capacity <= used + len || ROW_HEADER(row)->pins) {
+        char* grown = row_alloc(used + len);
+        memcpy(grown, row, used + 1);
+        row_free(row);
+        buffer->rows[buffer->number_of_rows] = row = grown;
+    }
+    memcpy(row + used, text, len);
+    row[used + len] = '\0';
+}
+
+// Read only the bytes appended to a followed file since the last time.
+// They continue the last row, or become new rows, like the first read
+// did, and a view whose cursor was on the last row moves along.
+void follow_read(struct Buffer* buffer) {
+    struct stat info;
+    if(fstat(buffer->follow_fd, &info) == -1) return;
+    bool truncated = info.st_size < buffer->follow_offset;
+    if(truncated) {
+        // Truncated, read it again from the start
+        for(u_int32_t row = 0; row <= buffer->number_of_rows; row++) row_free(buffer->rows[row]);
+        buffer->number_of_rows = 0;
+        buffer->rows[0] = row_alloc(0);
+        buffer->ends_newline = false;
+        buffer->follow_offset = 0;
+        for(size_t i = 0; i < VIEW_COUNT; i++) {
+            if(VIEWS[i]->buffer == buffer) memset(&VIEWS[i]->cursor, 0, sizeof(struct Cursor));
+        }
+    }
+
+    u_int32_t old_last = buffer->number_of_rows;
+    char chunk[0x10000];
+    ssize_t got;
+    while((got = pread(buffer->follow_fd, chunk, sizeof(chunk), buffer->follow_offset)) > 0) {
+        buffer->follow_offset += got;
+        for(char* at = chunk; at < chunk + got;) {
+            if(buffer->ends_newline || strlen(buffer->rows[buffer->number_of_rows]) == MAX_NUMBER_OF_COLS - 1) {
+                if(buffer->number_of_rows >= MAX_NUMBER_OF_ROWS - 1) return;
+                rows_reserve(buffer, buffer->number_of_rows + 2);
+                buffer->rows[++buffer->number_of_rows] = row_alloc(0);
+                buffer->ends_newline = false;
+            }
+            char* newline = memchr(at, '\n', chunk + got - at);
+            size_t len = (newline? newline: chunk + got) - at;
+            size_t room = MAX_NUMBER_OF_COLS - 1 - strlen(buffer->rows[buffer->number_of_rows]);
+            if(len > room) {
+                len = room;
+                newline = NULL;
+            }
+            follow_append(buffer, at, len);
+            buffer->ends_newline = newline != NULL;
+            at += len + (newline != NULL);
+        }
+    }
+
+    if(!truncated && buffer->number_of_rows == old_last) {
+        buffer_damage(buffer, old_last, old_last);
+        return;
+    }
+    buffer_damage(buffer, truncated? 0: old_last, MAX_NUMBER_OF_ROWS);
+    if(buffer->lex_known > old_last + 1) buffer->lex_known = old_last + 1;
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        struct Cursor* cursor = &VIEWS[i]->cursor;
+        if(VIEWS[i]->buffer != buffer || cursor->row != old_last) continue;
+        cursor->row = buffer->number_of_rows;
+        cursor->col = 0;
+    }
+}
+
+// light -f <file> follows a growing file, read-only, like tail -f
+bool buffer_follow(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1 || strlen(path) >= PATHMAX) {
+        fprintf(stderr, "could, not open file: %s\n", path);
+        if(fd != -1) close(fd);
+        return false;
+    }
+
+    buffer_new();
+    INIT_ARG_FNAME = strdup(path);
+    detect_language(INIT_ARG_FNAME);
+    INIT_FILE = true;
+    ACTIVE_BUFFER->follow = true;
+    ACTIVE_BUFFER->follow_fd = fd;
+    rows_reserve(ACTIVE_BUFFER, 1);
+    DISPLAY_BUFFER[0] = row_alloc(0);
+    follow_read(ACTIVE_BUFFER);
+    CURRENT_ROW = NUMBER_OF_ROWS;
+    watch_file(path, IN_MODIFY);
+    return true;
+}
+
+// Every followed file reads what was appended to it, any other file
+// which another program wrote is marked, so its buffer offers a reload
+void file_changes() {
+    WATCH_PENDING = false;
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+        struct Buffer* buffer = BUFFERS[i];
+        if(buffer->follow) follow_read(buffer);
+        else if(buffer->init_file && !buffer->disk_changed) buffer->disk_changed = buffer_disk_changed(buffer);
+    }
+}
+
+/*
+------------------------------------
+
+- :grep <text> finds text in every file below
+the current directory. One thread walks the
+tree, and a thread per processor, at most
+GREP_WORKERS, maps each file it finds and looks
+for text in it. The walker joins them once it
+is done
+
+- Every hit is queued in GREP_FOUND, and a
+KEY_GREP_HITS wakes display_buffer, which adds
+the hits as rows of GREP_BUFFER, a read-only
+buffer whose row n + 1 is GREP_HITS[n]. Enter
+on a hit opens its file, like :e does, and
+moves to it
+
+- GREP_GENERATION counts the searches, the
+workers of an older one stop at the next file,
+and what they found is dropped
+
+- GREP_RUNNING is cleared by the last worker,
+display_buffer reads it into GREP_SEARCHING
+when it takes the hits, so the status bar says
+searching until then
+
+------------------------------------
+*/
+#define GREP_WORKERS          16
+#define GREP_LINE             160
+
+struct GrepHit {
+    char*     path;
+    u_int32_t row;
+    u_int16_t col;
+    char*     text;
+};
+
+struct GrepSearch {
+    char      text[MAX_NUMBER_OF_COLS];
+    size_t    len;
+    u_int32_t generation;
+    char**    paths;
+    size_t    path_count;
+    size_t    path_capacity;
+    size_t    path_next;
+    bool      walked;
+    bool      stopped;
+    int       workers;
+};
+
+pthread_mutex_t   grep_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t    grep_cond = PTHREAD_COND_INITIALIZER;
+u_int32_t         GREP_GENERATION = 0;
+bool              GREP_RUNNING = false;
+bool              GREP_SEARCHING = false;
+bool              GREP_NOTIFIED = false;
+struct GrepHit*   GREP_FOUND = NULL;
+size_t            GREP_FOUND_COUNT = 0;
+size_t            GREP_FOUND_CAPACITY = 0;
+struct Buffer*    GREP_BUFFER = NULL;
+struct GrepHit*   GREP_HITS = NULL;
+size_t            GREP_HIT_COUNT = 0;
+size_t            GREP_HIT_CAPACITY = 0;
+
+// The first needle in text. 16 places are checked at once for the
+// first and the last byte of needle, only those which have both are
+// compared in full.
+const char* find_bytes(const char* text, size_t len, const char* needle, size_t needle_len) {
+    size_t at = 0;
+#if defined(__SSE2__)
+    if(needle_len >= 2) {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+        for(; at + needle_len + 15 <= len; at += 16) {
+            __m128i start = _mm_loadu_si128((const __m128i*)(text + at));
+            __m128i end = _mm_loadu_si128((const __m128i*)(text + at + needle_len - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(start, first),
+                                                                _mm_cmpeq_epi8(end, last)));
+            for(; mask; mask &= mask - 1) {
+                const char* candidate = text + at + __builtin_ctz(mask);
+                if(memcmp(candidate + 1, needle + 1, needle_len - 2) == 0) return candidate;
+            }
+        }
+    }
+#endif
+    while(at + needle_len <= len) {
+        const char* candidate = memchr(text + at, needle[0], len - at - needle_len + 1);
+        if(!candidate) return NULL;
+        if(memcmp(candidate, needle, needle_len) == 0) return candidate;
+        at = candidate - text + 1;
+    }
+    return NULL;
+}
+
+// Queue a hit of search for display_buffer, which only hears of the
+// first hit it has not taken yet
+void grep_found(struct GrepSearch* search, struct GrepHit hit) {
+    pthread_mutex_lock(&grep_lock);
+    bool current = search->generation == GREP_GENERATION;
+    bool wake = current && !GREP_NOTIFIED;
+    if(current) {
+        if(GREP_FOUND_COUNT == GREP_FOUND_CAPACITY) {
+            GREP_FOUND_CAPACITY = GREP_FOUND_CAPACITY? GREP_FOUND_CAPACITY * 2: 64;
+            GREP_FOUND = must_realloc(GREP_FOUND, GREP_FOUND_CAPACITY * sizeof(struct GrepHit));
+        }
+        GREP_FOUND[GREP_FOUND_COUNT++] = hit;
+        GREP_NOTIFIED = true;
+    }
+    pthread_mutex_unlock(&grep_lock);
+    if(!current) {
+        free(hit.path);
+        free(hit.text);
+    }
+    if(wake) key_queue_push((struct Key){ .type = KEY_GREP_HITS, .ch = 0 });
+}
+
+// Every line of path with the text of search is a hit. Its row and
+// column are where light puts them, a line is cut into rows of
+// MAX_NUMBER_OF_COLS - 1 characters like buffer_load cuts it
+void grep_file(struct GrepSearch* search, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd == -1) return;
+    if(fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return;
+    }
+    const char* text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) return;
+    const char* end = text + info.st_size;
+    if(memchr(text, '\0', info.st_size < 4096? info.st_size: 4096)) {
+        munmap((void*)text, info.st_size);
+        return;
+    }
+
+    const size_t cut = MAX_NUMBER_OF_COLS - 1;
+    const char* line = text;
+    u_int32_t row = 0;
+    for(const char* at = text; (at = find_bytes(at, end - at, search->text, search->len));) {
+        for(const char* newline; (newline = memchr(line, '\n', at - line)); line = newline + 1) {
+            row += (newline - line) / cut + 1;
+        }
+        const char* line_end = memchr(at, '\n', end - at);
+        if(!line_end) line_end = end;
+        size_t offset = at - line;
+        const char* shown = line + offset / cut * cut;
+        size_t shown_len = line_end - shown < GREP_LINE? (size_t)(line_end - shown): GREP_LINE;
+
+        struct GrepHit hit = { strdup(path), row + offset / cut, offset % cut, must_realloc(NULL, shown_len + 1) };
+        memcpy(hit.text, shown, shown_len);
+        hit.text[shown_len] = '\0';
+        grep_found(search, hit);
+        at = line_end;
+    }
+    munmap((void*)text, info.st_size);
+}
+
+// A worker of search stopped, the last one ends the search
+void grep_worker_done(struct GrepSearch* search) {
+    pthread_mutex_lock(&grep_lock);
+    bool last = --search->workers == 0;
+    bool wake = false;
+    if(last && search->generation == GREP_GENERATION) {
+        GREP_RUNNING = false;
+        wake = !GREP_NOTIFIED;
+        GREP_NOTIFIED = true;
+    }
+    pthread_mutex_unlock(&grep_lock);
+    if(last) {
+        while(search->path_next < search->path_count) free(search->paths[search->path_next++]);
+        free(search->paths);
+        free(search);
+    }
+    if(wake) key_queue_push((struct Key){ .type = KEY_GREP_HITS, .ch = 0 });
+}
+
+// Take the files the walker found until it is done and none are left
+void* grep_work(void* argument) {
+    struct GrepSearch* search = argument;
+    pthread_mutex_lock(&grep_lock);
+    while(true) {
+        while(search->path_next == search->path_count && !search->walked) pthread_cond_wait(&grep_cond, &grep_lock);
+        if(search->path_next == search->path_count || search->generation != GREP_GENERATION) break;
+        char* path = search->paths[search->path_next++];
+        pthread_mutex_unlock(&grep_lock);
+        grep_file(search, path);
+        free(path);
+        pthread_mutex_lock(&grep_lock);
+    }
+    pthread_mutex_unlock(&grep_lock);
+    grep_worker_done(search);
+    return NULL;
+}
+
+// Hidden files and directories, like .git, are left out, and links
+// are not followed
+void grep_walk_directory(struct GrepSearch* search, const char* directory) {
+    DIR* listing = opendir(directory);
+    if(!listing) return;
+    for(struct dirent* entry; (entry = readdir(listing));) {
+        if(entry->d_name[0] == '.' || search->stopped) continue;
+        char path[PATHMAX];
+        if(strcmp(directory, ".") == 0) snprintf(path, sizeof(path), "%s", entry->d_name);
+        else if(snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name) >= (int)sizeof(path)) continue;
+        unsigned char type = entry->d_type;
+        if(type == DT_UNKNOWN) {
+            struct stat info;
+            if(lstat(path, &info) == -1) continue;
+            type = S_ISDIR(info.st_mode)? DT_DIR: S_ISREG(info.st_mode)? DT_REG: DT_LNK;
+        }
+        if(type == DT_DIR) {
+            grep_walk_directory(search, path);
+        } else if(type == DT_REG) {
+            pthread_mutex_lock(&grep_lock);
+            search->stopped = search->generation != GREP_GENERATION;
+            if(search->path_count == search->path_capacity) {
+                search->path_capacity = search->path_capacity? search->path_capacity * 2: 256;
+                search->paths = must_realloc(search->paths, search->path_capacity * sizeof(char*));
+            }
+            search->paths[search->path_count++] = strdup(path);
+            pthread_cond_signal(&grep_cond);
+            pthread_mutex_unlock(&grep_lock);
+        }
+    }
+    closedir(listing);
+}
+
+void* grep_walk(void* argument) {
+    struct GrepSearch* search = argument;
+    grep_walk_directory(search, ".");
+    pthread_mutex_lock(&grep_lock);
+    search->walked = true;
+    pthread_cond_broadcast(&grep_cond);
+    pthread_mutex_unlock(&grep_lock);
+    return grep_work(search);
+}
+
+void grep_hits_clear() {
+    for(size_t i = 0; i < GREP_HIT_COUNT; i++) {
+        free(GREP_HITS[i].path);
+        free(GREP_HITS[i].text);
+    }
+    GREP_HIT_COUNT = 0;
+}
+
+// Show GREP_BUFFER with nothing but its title, and search for text
+// below the current directory
+void grep_start(const char* text) {
+    pthread_mutex_lock(&grep_lock);
+    GREP_GENERATION++;
+    GREP_RUNNING = GREP_SEARCHING = true;
+    for(size_t i = 0; i < GREP_FOUND_COUNT; i++) {
+        free(GREP_FOUND[i].path);
+        free(GREP_FOUND[i].text);
+    }
+    GREP_FOUND_COUNT = 0;
+    struct GrepSearch* search = must_realloc(NULL, sizeof(struct GrepSearch));
+    memset(search, 0, sizeof(struct GrepSearch));
+    snprintf(search->text, sizeof(search->text), "%s", text);
+    search->len = strlen(search->text);
+    search->generation = GREP_GENERATION;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = 1 + (processors < 1? 1: processors > GREP_WORKERS? GREP_WORKERS: processors);
+    search->workers = workers;
+    pthread_mutex_unlock(&grep_lock);
+
+    if(GREP_BUFFER) view_show(GREP_BUFFER);
+    else GREP_BUFFER = buffer_new();
+    ACTIVE_BUFFER->results = true;
+    for(u_int32_t row = 0; row <= NUMBER_OF_ROWS && DISPLAY_BUFFER; row++) row_free(DISPLAY_BUFFER[row]);
+    rows_reserve(ACTIVE_BUFFER, 1);
+    DISPLAY_BUFFER[0] = row_alloc(MAX_NUMBER_OF_COLS - 1);
+    snprintf(DISPLAY_BUFFER[0], MAX_NUMBER_OF_COLS, "find in files: %s", search->text);
+    NUMBER_OF_ROWS = 0;
+    memset(&ACTIVE_VIEW->cursor, 0, sizeof(struct Cursor));
+    buffer_damage(ACTIVE_BUFFER, 0, MAX_NUMBER_OF_ROWS);
+    grep_hits_clear();
+
+    pthread_t thread;
+    for(int i = 0; i < workers; i++) {
+        if(pthread_create(&thread, NULL, i == 0? grep_walk: grep_work, search) != 0) {
+            // The workers which did not start are done already, search
+            // is gone once the last of them is
+            while(i++ < workers) grep_worker_done(search);
+            break;
+        }
+        pthread_detach(thread);
+    }
+}
+
+// The hits found since the last time become rows of GREP_BUFFER. Only
+// when one of them is on screen, or the search ended, is the screen
+// drawn again, many hits would draw it for every few of them otherwise
+bool grep_hits_take() {
+    pthread_mutex_lock(&grep_lock);
+    struct GrepHit* found = GREP_FOUND;
+    size_t count = GREP_FOUND_COUNT;
+    GREP_FOUND = NULL;
+    GREP_FOUND_COUNT = GREP_FOUND_CAPACITY = 0;
+    GREP_NOTIFIED = false;
+    bool ended = GREP_SEARCHING && !GREP_RUNNING;
+    GREP_SEARCHING = GREP_RUNNING;
+    pthread_mutex_unlock(&grep_lock);
+    if(!GREP_BUFFER) return ended;
+
+    struct Buffer* buffer = GREP_BUFFER;
+    u_int32_t first = buffer->number_of_rows + 1;
+    for(size_t i = 0; i < count; i++) {
+        struct GrepHit* hit = &found[i];
+        if(buffer->number_of_rows >= MAX_NUMBER_OF_ROWS - 1) {
+            free(hit->path);
+            free(hit->text);
+            continue;
+        }
+        if(GREP_HIT_COUNT == GREP_HIT_CAPACITY) {
+            GREP_HIT_CAPACITY = GREP_HIT_CAPACITY? GREP_HIT_CAPACITY * 2: 64;
+            GREP_HITS = must_realloc(GREP_HITS, GREP_HIT_CAPACITY * sizeof(struct GrepHit));
+        }
+        GREP_HITS[GREP_HIT_COUNT++] = *hit;
+        char row[MAX_NUMBER_OF_COLS];
+        int len = snprintf(row, sizeof(row), "%s:%u: %s", hit->path, hit->row + 1, hit->text);
+        if(len < 0) len = 0;
+        if(len >= (int)sizeof(row)) len = sizeof(row) - 1;
+        rows_reserve(buffer, buffer->number_of_rows + 2);
+        buffer->rows[++buffer->number_of_rows] = row_alloc(len);
+        memcpy(buffer->rows[buffer->number_of_rows], row, len + 1);
+    }
+    free(found);
+    if(first > buffer->number_of_rows) return ended;
+    buffer_damage(buffer, first, MAX_NUMBER_OF_ROWS);
+    bool shown = false;
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        if(VIEWS[i]->buffer == buffer && VIEWS[i]->cursor.view_start_row + VIEWS[i]->rows > first) shown = true;
+    }
+    return ended || shown;
+}
+
+// Enter on a hit of GREP_BUFFER opens its file, or shows it when it
+// is open already, and puts the cursor on the hit
+void grep_open_hit() {
+    if(CURRENT_ROW == 0 || CURRENT_ROW > GREP_HIT_COUNT) return;
+    struct GrepHit* hit = &GREP_HITS[CURRENT_ROW - 1];
+    struct Buffer* open = buffer_find(hit->path);
+    if(open) view_show(open);
+    else if(!buffer_open(hit->path)) return;
+    buffer_load_to(ACTIVE_BUFFER, hit->row);
+    CURRENT_ROW = hit->row > NUMBER_OF_ROWS? NUMBER_OF_ROWS: hit->row;
+    size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+    CURRENT_COL = hit->col > len? len: hit->col;
+}
+
+
+// You can add plugins, by working with char* result
+// in join_display_buffer function. 
+// Make sure, to only concatenate to it, and not 
+// overwrite it completely, because it stores past
+// lines, too.
+void plugin_show_line_colored(char* result, int line_no) {
+   char c_line_no[64];
+   snprintf(c_line_no, sizeof(c_line_no), "\033[38;5;240m%5d;\033[0m ", line_no);
+   strcat(result, c_line_no);
+   return;
+}
+
+/*
+------------------------------------
+
+- struct Span gives the columns first...last-1
+of the row being drawn a color, fg and bg are
+256-color palette entries and style is an SGR
+code like 7 for reverse, SPAN_KEEP leaves a field
+to the spans added before it
+
+- Display plugins only add spans to SPANS, for
+the row being drawn, plugin_highlight_piece then
+lays them over each other in the order they
+were added and encodes the row once, so a plugin
+costs only its own spans
+
+------------------------------------
+*/
+#define SPAN_KEEP             -1
+#define SPAN_MAX              (MAX_NUMBER_OF_COLS + 8)
+#define SPAN_COL_BYTES        32
+
+struct Span {
+    u_int16_t first;
+    u_int16_t last;
+    int16_t   fg;
+    int16_t   bg;
+    int16_t   style;
+};
+
+struct Span SPANS[SPAN_MAX];
+size_t      SPAN_COUNT = 0;
+
+// Columns past the longest row are never drawn, and do not fit a Span
+void span_add(size_t first, size_t last, int fg, int bg, int style) {
+    if(last > MAX_NUMBER_OF_COLS) last = MAX_NUMBER_OF_COLS;
+    if(first >= last || SPAN_COUNT == SPAN_MAX) return;
+    SPANS[SPAN_COUNT++] = (struct Span){ first, last, fg, bg, style };
+}
+
+bool plugin_is_word(char ch) {
+    return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_';
+}
+
+// Comments, strings, directives, numbers and keywords, from one DFA
+// lookup per byte, a span is added whenever a colored token ends
+void plugin_syntax_spans(char* row, size_t len, u_int32_t line_no) {
+    static const int colors[LEX_COLORS] = { SPAN_KEEP, 81, 215, 114, 244 };
+    struct Language* language = FILE_LANGUAGE;
+    if(!language) return;
+    u_int16_t state = lex_row_start(ACTIVE_BUFFER, line_no);
+    bool directive = state == language->start && language->directive &&
+                     row[strspn(row, " \t")] == language->directive;
+    if(directive) span_add(0, len, 176, SPAN_KEEP, SPAN_KEEP);
+
+    size_t token = 0;
+    for(size_t i = 0; i <= len; i++) {
+        u_int16_t next = i < len? LEX_NEXT[state * LEX_CLASSES + LEX_CLASS[(unsigned char)row[i]]]: LEX_BOUNDARY;
+        if(next & LEX_BOUNDARY) {
+            enum LexColor color = LEX_COLOR[state];
+            if(color != LEX_PLAIN && (!directive || color >= LEX_STRING))
+                span_add(token, i, colors[color], SPAN_KEEP, SPAN_KEEP);
+            token = i;
+        }
+        state = next & LEX_STATE_MAX;
+    }
+}
+
+int selection_compare(u_int32_t row_a, u_int16_t col_a, u_int32_t row_b, u_int16_t col_b) {
+    if(row_a != row_b) return row_a < row_b? -1: 1;
+    if(col_a != col_b) return col_a < col_b? -1: 1;
+    return 0;
+}
+
+/*
+------------------------------------
+
+- c in the selection mode puts a cursor on every
+selected row long enough, at the column of the
+cursor, and :cursors <text> puts one at every
+<text> of the buffer. Characters, Tab, Backspace,
+Ctrl + P, Left and Right then work at every
+cursor, and any other key but Ctrl + N leaves
+only the cursor light had before
+
+- MULTI_CURSORS is kept sorted by row and column.
+A key goes through it once, and a row is written
+with one row_write however many cursors it has,
+so the rows are one undo group and the key draws
+one frame, with tens of thousands of cursors too
+
+------------------------------------
+*/
+struct MultiCursor {
+    u_int32_t row;
+    u_int16_t col;
+    bool      primary;
+};
+
+struct MultiCursor* MULTI_CURSORS  = NULL;
+size_t              MULTI_COUNT    = 0;
+size_t              MULTI_CAPACITY = 0;
+struct Buffer*      MULTI_BUFFER   = NULL;
+
+void multi_add(u_int32_t row, u_int16_t col, bool primary) {
+    if(MULTI_COUNT == MULTI_CAPACITY) {
+        MULTI_CAPACITY = MULTI_CAPACITY? MULTI_CAPACITY * 2: 64;
+        MULTI_CURSORS = must_realloc(MULTI_CURSORS, MULTI_CAPACITY * sizeof(struct MultiCursor));
+    }
+    MULTI_CURSORS[MULTI_COUNT++] = (struct MultiCursor){ row, col, primary };
+}
+
+// Every view of the buffer repaints the rows between the first and the
+// last cursor
+void multi_damage() {
+    if(!MULTI_COUNT) return;
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        if(VIEWS[i]->buffer == MULTI_BUFFER)
+            view_damage(VIEWS[i], MULTI_CURSORS[0].row, MULTI_CURSORS[MULTI_COUNT - 1].row);
+    }
+}
+
+void multi_clear() {
+    multi_damage();
+    MULTI_COUNT = 0;
+    MULTI_BUFFER = NULL;
+}
+
+// The first cursor on row or below it
+size_t multi_first(u_int32_t row) {
+    size_t low = 0, high = MULTI_COUNT;
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        if(MULTI_CURSORS[middle].row < row) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Cursors which met are one, CURRENT_ROW and CURRENT_COL follow the
+// one light had before. Fewer than two cursors are none.
+void multi_merge() {
+    size_t kept = 0;
+    for(size_t i = 0; i < MULTI_COUNT; i++) {
+        struct MultiCursor* last = kept? &MULTI_CURSORS[kept - 1]: NULL;
+        if(last && last->row == MULTI_CURSORS[i].row && last->col == MULTI_CURSORS[i].col) {
+            last->primary = last->primary || MULTI_CURSORS[i].primary;
+        } else {
+            MULTI_CURSORS[kept++] = MULTI_CURSORS[i];
+        }
+    }
+    MULTI_COUNT = kept;
+    for(size_t i = 0; i < MULTI_COUNT; i++) {
+        if(!MULTI_CURSORS[i].primary) continue;
+        CURRENT_ROW = MULTI_CURSORS[i].row;
+        CURRENT_COL = MULTI_CURSORS[i].col;
+    }
+    multi_damage();
+    if(MULTI_COUNT < 2) multi_clear();
+}
+
+// c in the selection mode
+void multi_from_selection() {
+    u_int32_t first = SELECT_START_ROW < SELECT_END_ROW? SELECT_START_ROW: SELECT_END_ROW;
+    u_int32_t last = SELECT_START_ROW < SELECT_END_ROW? SELECT_END_ROW: SELECT_START_ROW;
+    multi_clear();
+    MULTI_BUFFER = ACTIVE_BUFFER;
+    for(u_int32_t row = first; row <= last; row++) {
+        if(row == CURRENT_ROW || strlen(DISPLAY_BUFFER[row]) >= CURRENT_COL)
+            multi_add(row, CURRENT_COL, row == CURRENT_ROW);
+    }
+    SELECT_ACTIVE = SELECT_VISIBLE = false;
+    multi_merge();
+}
+
+// :cursors <text>, the cursor moves to the first one at or after it.
+// False when there is no text in the buffer.
+bool multi_from_text(const char* text) {
+    size_t len = strlen(text);
+    bool moved = false;
+    multi_clear();
+    buffer_load_all(ACTIVE_BUFFER);
+    MULTI_BUFFER = ACTIVE_BUFFER;
+    for(u_int32_t row = 0; row <= NUMBER_OF_ROWS; row++) {
+        for(const char* at = strstr(DISPLAY_BUFFER[row], text); at; at = strstr(at + len, text)) {
+            u_int16_t col = at - DISPLAY_BUFFER[row];
+            bool primary = !moved && selection_compare(row, col, CURRENT_ROW, CURRENT_COL) >= 0;
+            moved = moved || primary;
+            multi_add(row, col, primary);
+        }
+    }
+    if(MULTI_COUNT && !moved) MULTI_CURSORS[0].primary = true;
+    bool found = MULTI_COUNT > 0;
+    multi_merge();
+    return found;
+}
+
+// Cursors first...last-1 are on one row. Typing puts added characters
+// ch at each of them, Backspace removes the one before each, and
+// Ctrl + P the one under each.
+void multi_edit_row(size_t first, size_t last, struct Key key) {
+    u_int32_t number = MULTI_CURSORS[first].row;
+    const char* row = DISPLAY_BUFFER[number];
+    size_t len = strlen(row), added = key.type == KEY_CHAR? (key.ch == '\t'? TABSPACE: 1): 0;
+    if(len + added * (last - first) >= MAX_NUMBER_OF_COLS) return;
+    char text[MAX_NUMBER_OF_COLS];
+    size_t out = 0, from = 0;
+    for(size_t i = first; i < last; i++) {
+        struct MultiCursor* cursor = &MULTI_CURSORS[i];
+        // The character removed for this cursor, if there is one
+        size_t gone = key.type == KEY_BACKSPACE? cursor->col - 1: cursor->col;
+        bool removes = key.type == KEY_BACKSPACE? cursor->col > 0: key.type == KEY_CTRL && cursor->col < len;
+        size_t upto = removes? gone: cursor->col;
+        if(upto < from) upto = from;
+        memcpy(text + out, row + from, upto - from);
+        out += upto - from;
+        from = upto;
+        cursor->col = out;
+        if(removes && gone >= from) from = gone + 1;
+        for(size_t j = 0; j < added; j++) text[out++] = key.ch == '\t'? ' ': key.ch;
+        if(added) cursor->col = out;
+    }
+    memcpy(text + out, row + from, len - from + 1);
+    out += len - from;
+    if(out == len && memcmp(text, row, len) == 0) return;
+    memcpy(row_write(number, out), text, out + 1);
+}
+
+// The extra cursors take the keys they know, true when they took key
+bool multi_key(struct Key key) {
+    bool edit = key.type == KEY_CHAR || key.type == KEY_BACKSPACE || (key.type == KEY_CTRL && key.ch == 'P');
+    if(!edit && key.type != KEY_ARROW_LEFT && key.type != KEY_ARROW_RIGHT) return false;
+    for(size_t i = 0; i < MULTI_COUNT;) {
+        size_t last = i;
+        while(last < MULTI_COUNT && MULTI_CURSORS[last].row == MULTI_CURSORS[i].row) last++;
+        if(edit) {
+            multi_edit_row(i, last, key);
+        } else {
+            size_t len = strlen(DISPLAY_BUFFER[MULTI_CURSORS[i].row]);
+            for(size_t j = i; j < last; j++) {
+                struct MultiCursor* cursor = &MULTI_CURSORS[j];
+                if(key.type == KEY_ARROW_LEFT && cursor->col > 0) cursor->col--;
+                if(key.type == KEY_ARROW_RIGHT && cursor->col < len) cursor->col++;
+            }
+        }
+        i = last;
+    }
+    if(edit) BUFFER_DIRTY = true;
+    multi_merge();
+    return true;
+}
+
+// An extra cursor at the end of row line_no of len characters
+bool multi_at_end(u_int32_t line_no, size_t len) {
+    if(MULTI_BUFFER != ACTIVE_BUFFER) return false;
+    for(size_t i = multi_first(line_no); i < MULTI_COUNT && MULTI_CURSORS[i].row == line_no; i++) {
+        if(MULTI_CURSORS[i].col >= len) return true;
+    }
+    return false;
+}
+
+/*
+------------------------------------
+
+- F3 starts recording the keys which edit and
+move, F3 again stops it. F4 plays them back,
+on every selected row from its start in the
+selection mode, and :macro <n> plays them n
+times, or until they move past the first or the
+last row, or leave the buffer and the cursor as
+they were
+
+- A replay goes through key_apply alone: there
+is no frame, no plugin sees its keys, and the
+whole replay is one undo group, so the keys
+cost what their edits cost
+
+------------------------------------
+*/
+struct Key* MACRO_KEYS      = NULL;
+size_t      MACRO_COUNT     = 0;
+size_t      MACRO_CAPACITY  = 0;
+bool        MACRO_RECORDING = false;
+bool        MACRO_PLAYING   = false;
+
+// Undo, quitting and the mouse depend on more than the buffer, they
+// are never recorded
+void macro_record_key(struct Key key) {
+    if(key.type == KEY_UNKNOWN || key.type == KEY_MOUSE || key.type == KEY_MACRO_RECORD ||
+       key.type == KEY_MACRO_PLAY || (key.type == KEY_CTRL && (key.ch == 'Z' || key.ch == 'Q'))) return;
+    if(MACRO_COUNT == MACRO_CAPACITY) {
+        MACRO_CAPACITY = MACRO_CAPACITY? MACRO_CAPACITY * 2: 64;
+        MACRO_KEYS = must_realloc(MACRO_KEYS, MACRO_CAPACITY * sizeof(struct Key));
+    }
+    MACRO_KEYS[MACRO_COUNT++] = key;
+}
+
+void macro_record() {
+    if(MACRO_PLAYING) return;
+    if(!MACRO_RECORDING) MACRO_COUNT = 0;
+    MACRO_RECORDING = !MACRO_RECORDING;
+}
+
+void macro_play(unsigned long times) {
+    if(MACRO_RECORDING || MACRO_PLAYING || !MACRO_COUNT) return;
+    struct Buffer* buffer = ACTIVE_BUFFER;
+    struct Key typed = current_char;
+    bool rows = SELECT_ACTIVE;
+    int64_t row = CURRENT_ROW, last = CURRENT_ROW;
+    if(rows) {
+        row = SELECT_START_ROW < SELECT_END_ROW? SELECT_START_ROW: SELECT_END_ROW;
+        last = SELECT_START_ROW < SELECT_END_ROW? SELECT_END_ROW: SELECT_START_ROW;
+        SELECT_ACTIVE = SELECT_VISIBLE = false;
+    }
+    remember_for_undo();
+    MACRO_PLAYING = true;
+    for(unsigned long i = 0; rows? row <= last: i < times; i++) {
+        if(rows) {
+            CURRENT_ROW = (u_int32_t)row;
+            CURRENT_COL = 0;
+        }
+        u_int32_t from_row = CURRENT_ROW, from_rows = NUMBER_OF_ROWS, changes = BUFFER_CHANGES;
+        u_int16_t from_col = CURRENT_COL;
+        bool stuck = false;
+        for(size_t k = 0; k < MACRO_COUNT && ACTIVE_BUFFER == buffer && !stuck; k++) {
+            bool vertical;
+            current_char = MACRO_KEYS[k];
+            // A move past the first or the last row ends the replay
+            enum KeyType type = current_char.type;
+            stuck = ((type == KEY_ARROW_DOWN || type == KEY_PAGE_DOWN) && CURRENT_ROW == NUMBER_OF_ROWS) ||
+                    ((type == KEY_ARROW_UP || type == KEY_PAGE_UP) && CURRENT_ROW == 0);
+            if(!stuck) key_apply(&vertical);
+        }
+        if(ACTIVE_BUFFER != buffer || stuck) break;
+        // The rows a replay added or took away move the rows after it
+        if(rows) {
+            row += 1 + (int64_t)NUMBER_OF_ROWS - from_rows;
+            last += (int64_t)NUMBER_OF_ROWS - from_rows;
+            if(row > NUMBER_OF_ROWS) break;
+        } else if(CURRENT_ROW == from_row && CURRENT_COL == from_col && BUFFER_CHANGES == changes) {
+            break;
+        }
+    }
+    MACRO_PLAYING = false;
+    current_char = typed;
+}
+
+// The cursor is reversed, unless the selection is drawn over it, and
+// so are the extra cursors
+void plugin_cursor_span(u_int32_t line_no) {
+    if(line_no == CURRENT_ROW) span_add(CURRENT_COL, CURRENT_COL + 1, SPAN_KEEP, SPAN_KEEP, 7);
+    if(MULTI_BUFFER != ACTIVE_BUFFER) return;
+    for(size_t i = multi_first(line_no); i < MULTI_COUNT && MULTI_CURSORS[i].row == line_no; i++)
+        span_add(MULTI_CURSORS[i].col, MULTI_CURSORS[i].col + 1, SPAN_KEEP, SPAN_KEEP, 7);
+}
+
+// The bracket matching the one under the cursor is bold on grey
+void plugin_bracket_span(u_int32_t line_no) {
+    if(ACTIVE_VIEW->match && line_no == ACTIVE_VIEW->match_row)
+        span_add(ACTIVE_VIEW->match_col, ACTIVE_VIEW->match_col + 1, SPAN_KEEP, 239, 1);
+}
+
+// The part of row line_no which is selected, displayed_len columns at most
+void plugin_selection_span(u_int32_t line_no, size_t displayed_len) {
+    if(!SELECT_VISIBLE) return;
+    u_int32_t first_row = SELECT_START_ROW, last_row = SELECT_END_ROW;
+    u_int16_t first_col = SELECT_START_COL, last_col = SELECT_END_COL;
+    if(selection_compare(first_row, first_col, last_row, last_col) > 0) {
+        first_row = SELECT_END_ROW; first_col = SELECT_END_COL;
         last_row = SELECT_START_ROW; last_col = SELECT_START_COL;
     }
-    return selection_compare(row, col, first_row, first_col) >= 0 &&
-           selection_compare(row, col, last_row, last_col) < 0;
+    if(line_no < first_row || line_no > last_row) return;
+    size_t first = line_no == first_row? first_col: 0;
+    size_t last = line_no == last_row? last_col: displayed_len;
+    if(last > displayed_len) last = displayed_len;
+    span_add(first, last, SPAN_KEEP, 24, 0);
+}
+
+/*
+------------------------------------
+
+- struct Plugin is a plugin loaded from
+~/.config/light/plugins, see light_plugin.h,
+cost is the time its hooks took since the last
+frame, a plugin whose cost is over PLUGIN_BUDGET
+is disabled, LIGHT_PLUGIN_BUDGET sets it in
+microseconds
+
+- PLUGIN_EDITS is set while a key hook runs,
+only then a plugin may change the buffer, and
+PLUGIN_EDITED once it did, in one undo group
+
+- STATUS_MESSAGE replaces the status bar until
+the next key
+
+------------------------------------
+*/
+struct Plugin {
+    const struct light_plugin* hooks;
+    long cost;
+    bool disabled;
+};
+
+struct Plugin* PLUGINS        = NULL;
+size_t         PLUGIN_COUNT   = 0;
+long           PLUGIN_BUDGET  = 4000000;
+bool           PLUGIN_EDITS   = false;
+bool           PLUGIN_EDITED  = false;
+char           STATUS_MESSAGE[128] = "";
+
+long plugin_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// The spans of every loaded plugin go over the syntax colors
+void plugins_spans(char* row, size_t len, u_int32_t line_no) {
+    for(size_t i = 0; i < PLUGIN_COUNT; i++) {
+        struct Plugin* plugin = &PLUGINS[i];
+        if(plugin->disabled || !plugin->hooks->spans) continue;
+        long begin = plugin_clock();
+        plugin->hooks->spans(row, len, line_no);
+        plugin->cost += plugin_clock() - begin;
+    }
+}
+
+// Syntax color is deliberately only a display plugin: file content stays clean.
+// Only the columns start...start + width of the row are drawn, every column
+// gets the colors of the spans over it, and an SGR sequence is written only
+// where they change. result needs SPAN_COL_BYTES for every column.
+void plugin_highlight_piece(char* result, char* row, u_int32_t line_no, size_t start) {
+    size_t len = strlen(row);
+    size_t width = VIEW_COLS > LINE_GUTTER? VIEW_COLS - LINE_GUTTER: 1;
+    size_t finish = start + width;
+    size_t displayed_len = len + (line_no == CURRENT_ROW || multi_at_end(line_no, len));
+    if(finish > displayed_len) finish = displayed_len;
+
+    SPAN_COUNT = 0;
+    plugin_syntax_spans(row, len, line_no);
+    plugins_spans(row, len, line_no);
+    plugin_cursor_span(line_no);
+    plugin_bracket_span(line_no);
+    plugin_selection_span(line_no, displayed_len);
+
+    struct Span columns[MAX_NUMBER_OF_COLS];
+    size_t count = finish > start? finish - start: 0;
+    for(size_t i = 0; i < count; i++) columns[i] = (struct Span){ 0, 0, SPAN_KEEP, SPAN_KEEP, 0 };
+    for(size_t i = 0; i < SPAN_COUNT; i++) {
+        struct Span* span = &SPANS[i];
+        size_t first = span->first > start? span->first: start;
+        size_t last = span->last < finish? span->last: finish;
+        for(size_t col = first; col < last; col++) {
+            struct Span* column = &columns[col - start];
+            if(span->fg != SPAN_KEEP) column->fg = span->fg;
+            if(span->bg != SPAN_KEEP) column->bg = span->bg;
+            if(span->style != SPAN_KEEP) column->style = span->style;
+        }
+    }
+
+    char* ptr = result + strlen(result);
+    struct Span drawn = { 0, 0, SPAN_KEEP, SPAN_KEEP, 0 };
+    for(size_t i = 0; i < count; i++) {
+        struct Span* column = &columns[i];
+        if(column->fg != drawn.fg || column->bg != drawn.bg || column->style != drawn.style) {
+            ptr += sprintf(ptr, "\033[0");
+            if(column->fg != SPAN_KEEP) ptr += sprintf(ptr, ";38;5;%d", column->fg);
+            if(column->bg != SPAN_KEEP) ptr += sprintf(ptr, ";48;5;%d", column->bg);
+            if(column->style > 0) ptr += sprintf(ptr, ";%d", column->style);
+            *ptr++ = 'm';
+            drawn = *column;
+        }
+        *ptr++ = start + i < len? row[start + i]: ' ';
+    }
+    if(drawn.fg != SPAN_KEEP || drawn.bg != SPAN_KEEP || drawn.style > 0) ptr += sprintf(ptr, "\033[0m");
+    strcpy(ptr, "\n");
+}
+
+// Without SOFT_WRAP, the current row scrolls sideways to keep the cursor visible.
+void plugin_highlight(char* result, char* row, u_int32_t line_no) {
+    size_t width = VIEW_COLS > LINE_GUTTER? VIEW_COLS - LINE_GUTTER: 1;
+    size_t start = 0;
+    if(line_no == CURRENT_ROW && CURRENT_COL >= width) start = CURRENT_COL - width + 1;
+    if(line_no == CURRENT_ROW) CURRENT_VIEW_COL = start;
+    plugin_highlight_piece(result, row, line_no, start);
+}
+
+// Wrapped pieces after the first one have no line number.
+void plugin_show_wrap_gutter(char* result) {
+   strcat(result, "\033[38;5;240m     ~\033[0m ");
+}
+
+// The name of the active buffer, in the status bar and view titles
+const char* buffer_label() {
+    return INIT_FILE? INIT_ARG_FNAME: ACTIVE_BUFFER->results? "[grep]": "[scratch]";
+}
+
+// Keep the important state visible without taking space from the buffer.
+void plugin_status_bar() {
+    char status[PATHMAX + 128];
+    const char* filename = buffer_label();
+    const char* language = FILE_LANGUAGE? FILE_LANGUAGE->name: "TEXT";
+    if(CONFIRM_EXIT && INIT_FILE) {
+        snprintf(status, sizeof(status), " Save changes before exit?  y save | n discard | c cancel ");
+    } else if(CONFIRM_EXIT) {
+        snprintf(status, sizeof(status), " No filename: c cancel, then use =filename and Ctrl+N | n discard ");
+    } else if(ACTIVE_BUFFER->disk_changed) {
+        snprintf(status, sizeof(status), " %s changed on disk:  r reload | k keep this buffer ", filename);
+    } else if(STATUS_MESSAGE[0]) {
+        snprintf(status, sizeof(status), " %s ", STATUS_MESSAGE);
+    } else {
+        char position[48] = "";
+        if(BUFFER_COUNT > 1) {
+            size_t at = 0;
+            while(BUFFERS[at] != ACTIVE_BUFFER) at++;
+            snprintf(position, sizeof(position), " [%zu/%zu]", at + 1, BUFFER_COUNT);
+        }
+        if(MULTI_BUFFER == ACTIVE_BUFFER) {
+            size_t used = strlen(position);
+            snprintf(position + used, sizeof(position) - used, " %zu cursors", MULTI_COUNT);
+        }
+        if(MACRO_RECORDING) {
+            size_t used = strlen(position);
+            snprintf(position + used, sizeof(position) - used, " recording");
+        }
+        if(ACTIVE_BUFFER->loading) {
+            size_t used = strlen(position);
+            off_t size = ACTIVE_BUFFER->disk.st_size > 0? ACTIVE_BUFFER->disk.st_size: 1;
+            snprintf(position + used, sizeof(position) - used, " loading %d%%", (int)(ACTIVE_BUFFER->load_offset * 100 / size));
+        } else if(ACTIVE_BUFFER->results && GREP_SEARCHING) {
+            size_t used = strlen(position);
+            snprintf(position + used, sizeof(position) - used, " searching");
+        } else if(ACTIVE_BUFFER->find_block_count && ACTIVE_BUFFER->find_indexed <= NUMBER_OF_ROWS) {
+            size_t used = strlen(position);
+            snprintf(position + used, sizeof(position) - used, " indexing %d%%",
+                     (int)((u_int64_t)ACTIVE_BUFFER->find_indexed * 100 / (NUMBER_OF_ROWS + 1)));
+        }
+        snprintf(status, sizeof(status), " light | %s | %s | %s%s%s | %u:%d | ^Space select  Enter copy  d delete  ^V paste ",
+                 SELECT_ACTIVE? "SELECT": ACTIVE_BUFFER->follow? "FOLLOW": "EDIT", language, filename, BUFFER_DIRTY? " [+]": "", position,
+                 CURRENT_ROW + 1, CURRENT_COL + 1);
+    }
+    frame_printf("\033[%d;1H\033[7m%-*.*s\033[0m", TERM_ROW, TERM_COL, TERM_COL, status);
+}
+
+// A view right of another view is fenced off by a column of '|'
+void plugin_view_separator() {
+    if(ACTIVE_VIEW->x0 == 0) return;
+    for(int row = 0; row < VIEW_ROWS; row++) {
+        frame_printf("\033[%d;%dH\033[38;5;240m|\033[0m", VIEW_TOP + row, VIEW_LEFT - 1);
+    }
+}
+
+// A view above another view names its file in a title row
+void plugin_view_title() {
+    if(ACTIVE_VIEW->y1 < LAYOUT_ONE) {
+        char title[PATHMAX + 16];
+        int left = VIEW_LEFT - (ACTIVE_VIEW->x0 > 0);
+        int width = VIEW_COLS + (ACTIVE_VIEW->x0 > 0);
+        snprintf(title, sizeof(title), " %s%s ", buffer_label(), BUFFER_DIRTY? " [+]": "");
+        frame_printf("\033[%d;%dH\033[38;5;240m\033[7m%-*.*s\033[0m", VIEW_TOP + VIEW_ROWS, left, width, width, title);
+    }
+}
+
+
+// plugins and shortcuts go hand in hand, this is an example
+// where a plugin might call a shortcut 
+void shortcut_delete_curr_line(char);
+void normalize_COL();
+
+size_t wrap_width() {
+    return VIEW_COLS > LINE_GUTTER? VIEW_COLS - LINE_GUTTER: 1;
+}
+
+// The tree grows in powers of two, and is built again from WRAP_ROWS
+void wrap_reserve(u_int32_t row) {
+    u_int32_t capacity = ACTIVE_VIEW->wrap_capacity;
+    if(row < capacity) return;
+    if(capacity == 0) capacity = 1024;
+    while(capacity <= row) capacity <<= 1;
+
+    WRAP_ROWS = must_realloc(WRAP_ROWS, (size_t)capacity * sizeof(struct WrapRow));
+    memset(WRAP_ROWS + ACTIVE_VIEW->wrap_capacity, 0,
+           (size_t)(capacity - ACTIVE_VIEW->wrap_capacity) * sizeof(struct WrapRow));
+    WRAP_TREE = must_realloc(WRAP_TREE, ((size_t)capacity + 1) * sizeof(u_int32_t));
+    memset(WRAP_TREE, 0, ((size_t)capacity + 1) * sizeof(u_int32_t));
+    for(u_int32_t i = 1; i <= capacity; i++) {
+        WRAP_TREE[i] += WRAP_ROWS[i - 1].lines;
+        if(i + (i & -i) <= capacity) WRAP_TREE[i + (i & -i)] += WRAP_TREE[i];
+    }
+    ACTIVE_VIEW->wrap_capacity = capacity;
+}
+
+void wrap_tree_add(u_int32_t row, u_int32_t delta) {
+    for(u_int32_t i = row + 1; i <= ACTIVE_VIEW->wrap_capacity; i += i & -i) WRAP_TREE[i] += delta;
+}
+
+// Screen rows taken by every buffer row above row
+u_int32_t wrap_rows_before(u_int32_t row) {
+    u_int32_t sum = 0;
+    if(row > ACTIVE_VIEW->wrap_capacity) row = ACTIVE_VIEW->wrap_capacity;
+    for(u_int32_t i = row; i > 0; i -= i & -i) sum += WRAP_TREE[i];
+    return sum;
+}
+
+// Buffer row holding the screen row 'screen', counted from row 0.
+// before is set to the screen rows above the returned row.
+u_int32_t wrap_find_row(u_int32_t screen, u_int32_t* before) {
+    u_int32_t at = 0, sum = 0;
+    for(u_int32_t step = ACTIVE_VIEW->wrap_capacity; step > 0; step >>= 1) {
+        if(at + step <= ACTIVE_VIEW->wrap_capacity && sum + WRAP_TREE[at + step] <= screen) {
+            at += step;
+            sum += WRAP_TREE[at];
+        }
+    }
+    *before = sum;
+    return at > NUMBER_OF_ROWS? NUMBER_OF_ROWS: at;
+}
+
+// Rows out of view keep whatever they measured last time, only
+// rows which are about to be drawn are measured again.
+u_int16_t wrap_measure(u_int32_t row) {
+    wrap_reserve(row);
+    struct WrapRow* wrap = &WRAP_ROWS[row];
+    size_t width = wrap_width();
+    size_t len = strlen(DISPLAY_BUFFER[row]);
+    if(wrap->lines == 0 || wrap->len != len || wrap->width != width) {
+        u_int16_t lines = len / width + 1;
+        wrap_tree_add(row, (u_int32_t)lines - wrap->lines);
+        wrap->lines = lines;
+        wrap->len = len;
+        wrap->width = width;
+    }
+    return wrap->lines;
+}
+
+// Move VIEW_START_ROW/VIEW_START_WRAP just enough to show the
+// piece of the current row holding the cursor
+void wrap_follow_cursor(int viewport_rows) {
+    u_int16_t piece = CURRENT_COL / wrap_width();
+    if(VIEW_START_ROW > NUMBER_OF_ROWS) VIEW_START_ROW = NUMBER_OF_ROWS;
+    if(VIEW_START_WRAP >= wrap_measure(VIEW_START_ROW)) VIEW_START_WRAP = 0;
+    if(CURRENT_ROW < VIEW_START_ROW ||
+       (CURRENT_ROW == VIEW_START_ROW && piece < VIEW_START_WRAP)) {
+        VIEW_START_ROW = CURRENT_ROW;
+        VIEW_START_WRAP = piece;
+        return;
+    }
+
+    // Every row takes at least one screen row, so only a near cursor can be visible
+    if(CURRENT_ROW - VIEW_START_ROW < (u_int32_t)viewport_rows) {
+        int used = -VIEW_START_WRAP;
+        for(u_int32_t row = VIEW_START_ROW; row < CURRENT_ROW; row++) used += wrap_measure(row);
+        if(used + piece < viewport_rows) return;
+    }
+
+    // Put the cursor on the last screen row, and walk upwards
+    int remaining = viewport_rows - 1 - piece;
+    u_int32_t row = CURRENT_ROW;
+    if(remaining < 0) {
+        VIEW_START_ROW = CURRENT_ROW;
+        VIEW_START_WRAP = -remaining;
+        return;
+    }
+    while(remaining > 0 && row > 0) {
+        u_int16_t lines = wrap_measure(row - 1);
+        row--;
+        if(lines > remaining) {
+            VIEW_START_ROW = row;
+            VIEW_START_WRAP = lines - remaining;
+            return;
+        }
+        remaining -= lines;
+    }
+    VIEW_START_ROW = row;
+    VIEW_START_WRAP = 0;
+}
+
+// Screen row(1 based) of the first piece of row, may lie outside of the viewport
+int wrap_screen_row(u_int32_t row) {
+    return (int)(wrap_rows_before(row) - wrap_rows_before(VIEW_START_ROW)) - VIEW_START_WRAP + 1;
+}
+
+// SOFT_WRAP version of join_display_buffer
+char* join_wrapped_display_buffer(int viewport_rows) {
+    wrap_follow_cursor(viewport_rows);
+    CURRENT_VIEW_COL = 0;
+
+    size_t width = wrap_width();
+    char *result = malloc(viewport_rows * (width * SPAN_COL_BYTES + 64) + 1);
+    if (!result) return NULL;
+
+    result[0] = '\0';
+    int used = 0;
+    u_int16_t piece = VIEW_START_WRAP;
+    for (u_int32_t row = VIEW_START_ROW; used < viewport_rows && row <= NUMBER_OF_ROWS; row++) {
+        u_int16_t lines = wrap_measure(row);
+        for(; piece < lines && used < viewport_rows; piece++, used++) {
+            if(piece == 0) plugin_show_line_colored(result, row);
+            else plugin_show_wrap_gutter(result);
+            plugin_highlight_piece(result, DISPLAY_BUFFER[row], row, piece * width);
+        }
+        piece = 0;
+    }
+
+    return result;
+}
+
+// Move VIEW_START_ROW just enough to show the cursor, without
+// leaving empty rows below the last row
+void view_follow_cursor() {
+    long start_line = VIEW_START_ROW;
+    long latest_start = (long)NUMBER_OF_ROWS - VIEW_ROWS + 1;
+    if(CURRENT_ROW < start_line) start_line = CURRENT_ROW;
+    if(CURRENT_ROW >= start_line + VIEW_ROWS) start_line = (long)CURRENT_ROW - VIEW_ROWS + 1;
+    if(start_line < 0) start_line = 0;
+    if(latest_start < 0) latest_start = 0;
+    if(start_line > latest_start) start_line = latest_start;
+    VIEW_START_ROW = start_line;
+}
+
+// Concatenate strings in DISPLAY_BUFFER with newline character
+// char* result iterates over all ROWS and COLUMNS, this is a 
+// nice place to use your plugins
+char* join_display_buffer() {
+    int viewport_rows = VIEW_ROWS;
+    if(SOFT_WRAP) return join_wrapped_display_buffer(viewport_rows);
+    view_follow_cursor();
+    long start_line = VIEW_START_ROW;
+    long end_line = start_line + viewport_rows - 1;
+    if(end_line > NUMBER_OF_ROWS) end_line = NUMBER_OF_ROWS;
+
+    size_t total_len = 0;
+    for (long i = start_line; i <= end_line; i++) {
+        total_len += strlen(DISPLAY_BUFFER[i]) + 1;   
+    }
+
+    // line number + highlight escape codes + the cursor's extra blank
+    size_t visible_rows = end_line - start_line + 1;
+    char *result = malloc((total_len + visible_rows) * SPAN_COL_BYTES + visible_rows * 64 + 1);
+    if (!result) return NULL;
+
+    result[0] = '\0'; 
+    for (long i = start_line; i <= end_line; i++) {
+            
+        // Add your plugins here
+        plugin_show_line_colored(result, i);
+        plugin_highlight(result, DISPLAY_BUFFER[i], i);
+    }
+
+    return result;
+}
+
+// normal IO compared to before scatter gather io
+bool write_all(int fd, const char* buffer, size_t len) {
+    while(len > 0) {
+        ssize_t written = write(fd, buffer, len);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        buffer += written;
+        len -= written;
+    }
+    return true;
+}
+
+// Copy len bytes at offset of from to the end of to, at at. On file
+// systems which can, copy_file_range shares the whole blocks which
+// line up in both files, so the start of the first one is copied on
+// its own. The others copy in the kernel, or are read and written
+bool save_copy(int from, off_t offset, size_t len, int to, off_t at, char* chunk) {
+    size_t part = offset % SAVE_BLOCK == at % SAVE_BLOCK? (SAVE_BLOCK - offset % SAVE_BLOCK) % SAVE_BLOCK: 0;
+    while(len > 0) {
+        ssize_t copied = copy_file_range(from, &offset, to, NULL, part && part < len? part: len, 0);
+        if(copied == -1 && errno == EINTR) continue;
+        if(copied == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            copied = pread(from, chunk, len < SAVE_CHUNK? len: SAVE_CHUNK, offset);
+            if(copied > 0 && !write_all(to, chunk, copied)) return false;
+            offset += copied;
+        }
+        if(copied <= 0) return false;
+        len -= copied;
+        part = part > (size_t)copied? part - copied: 0;
+    }
+    return true;
+}
+
+// Write every row of ACTIVE_BUFFER to fd. The rows are gathered
+// SAVE_CHUNK bytes at a time, a write for every row would make saving
+// a large file take seconds. Rows which still hold lines following
+// each other in from, the file they were read from, are copied from
+// it instead when they are SAVE_COPY_LEAST bytes or more, so a small
+// edit of a large file is saved in about the time of the edit.
+// offsets, when not NULL, gets where every row begins in fd
+bool save_rows(int fd, int from, off_t* offsets) {
+    off_t* lines = ACTIVE_BUFFER->origin_offsets;
+    char* chunk = must_realloc(NULL, SAVE_CHUNK);
+    size_t used = 0;
+    off_t at = 0;
+    bool written = true;
+    u_int32_t gathered = 0;
+    for (u_int32_t i = 0; i <= NUMBER_OF_ROWS && written; i++) {
+        u_int32_t origin = from == -1 || i < gathered? 0: ROW_HEADER(DISPLAY_BUFFER[i])->origin;
+        u_int32_t last = i;
+        while(origin && last < NUMBER_OF_ROWS && ROW_HEADER(DISPLAY_BUFFER[last + 1])->origin == origin + last + 1 - i) last++;
+
+        // The run of lines is copied with the newline after it, unless
+        // the buffer ends there without one, or the file ended without
+        // one and the buffer goes on
+        u_int32_t next = origin + last - i;
+        bool had_newline = next < ACTIVE_BUFFER->origin_count || ACTIVE_BUFFER->origin_ends_newline;
+        bool newline = last < NUMBER_OF_ROWS || BUFFER_ENDS_NEWLINE;
+        off_t begin = origin? lines[origin - 1]: 0;
+        off_t end = origin? lines[next] - (had_newline && !newline): 0;
+        if(origin && end - begin >= SAVE_COPY_LEAST) {
+            written = write_all(fd, chunk, used);
+            at += used;
+            used = 0;
+            if(offsets) {
+                for(u_int32_t row = i; row <= last; row++) offsets[row] = at + lines[origin - 1 + row - i] - begin;
+            }
+            written = written && save_copy(from, begin, end - begin, fd, at, chunk);
+            at += end - begin;
+            if(newline && !had_newline) chunk[used++] = '\n';
+            i = last;
+            continue;
+        }
+        if(origin) gathered = last + 1;
+
+        size_t len = strlen(DISPLAY_BUFFER[i]);
+        if(used + len + 1 > SAVE_CHUNK) {
+            written = write_all(fd, chunk, used);
+            at += used;
+            used = 0;
+        }
+        if(offsets) offsets[i] = at + used;
+        memcpy(chunk + used, DISPLAY_BUFFER[i], len);
+        used += len;
+        if(i < NUMBER_OF_ROWS || BUFFER_ENDS_NEWLINE) chunk[used++] = '\n';
+    }
+    if(written) written = write_all(fd, chunk, used);
+    if(offsets) offsets[NUMBER_OF_ROWS + 1] = at + used;
+    free(chunk);
+    return written;
+}
+
+// The rows of buffer are what its file, as disk tells, holds now, row
+// i begins at offsets[i]. The rows kept for Ctrl + Z are no longer in
+// the file
+void origins_take(struct Buffer* buffer, off_t* offsets, bool ends_newline, const struct stat* disk) {
+    for(u_int32_t i = 0; i <= buffer->number_of_rows; i++) ROW_HEADER(buffer->rows[i])->origin = i + 1;
+    for(size_t i = 0; i < buffer->undo.count; i++) {
+        struct EditOp* op = &buffer->undo.ops[i];
+        for(u_int32_t row = 0; row < op->old_rows; row++) ROW_HEADER(op->saved[row])->origin = 0;
+    }
+    free(buffer->origin_offsets);
+    buffer->origin_offsets = offsets;
+    buffer->origin_count = buffer->number_of_rows + 1;
+    buffer->origin_capacity = buffer->number_of_rows + 2;
+    buffer->origin_ends_newline = ends_newline;
+    buffer->origin_disk = *disk;
+}
+
+// The file of buffer changed, and the buffer was kept as it is. Its
+// rows no longer say what the file holds, the next save writes them all
+void origins_drop(struct Buffer* buffer) {
+    free(buffer->origin_offsets);
+    buffer->origin_offsets = NULL;
+    buffer->origin_count = buffer->origin_capacity = 0;
+}
+
+void save_buffer_to_file(const char* filename, bool called_through_shortcut) {
+    if(filename == NULL || filename[0] == '\0') {
+        fprintf(stderr, "Can not save: filename is empty\n");
+        return;
+    }
+
+    // Never overwrite what another program wrote without asking
+    buffer_load_all(ACTIVE_BUFFER);
+    if(filename == INIT_ARG_FNAME && buffer_disk_changed(ACTIVE_BUFFER)) {
+        ACTIVE_BUFFER->disk_changed = true;
+        return;
+    }
+
+    char temporary[PATHMAX + 16];
+    if(snprintf(temporary, sizeof(temporary), "%s.light-XXXXXX", filename) >= (int)sizeof(temporary)) {
+        fprintf(stderr, "Can not save: file path is too long\n");
+        return;
+    }
+
+    struct stat old_file;
+    mode_t mode = stat(filename, &old_file) == 0? old_file.st_mode & 0777: 0644;
+    int fd = mkostemp(temporary, O_CLOEXEC);
+    if (fd == -1) {
+        perror("save");
+        return;
+    }
+    fchmod(fd, mode);
+
+    // A DELTA_SAVE copies from the file the rows were read from, when
+    // it is still the same file, and learns where the rows are saved
+    off_t* offsets = NULL;
+    int from = -1;
+    if(DELTA_SAVE && filename == INIT_ARG_FNAME && !ACTIVE_BUFFER->follow) {
+        offsets = must_realloc(NULL, ((size_t)NUMBER_OF_ROWS + 2) * sizeof(off_t));
+        struct stat info;
+        if(ACTIVE_BUFFER->origin_offsets) from = open(filename, O_RDONLY | O_CLOEXEC);
+        if(from != -1 && (fstat(from, &info) == -1 || !stat_same(&info, &ACTIVE_BUFFER->origin_disk) ||
+                          info.st_size != ACTIVE_BUFFER->origin_offsets[ACTIVE_BUFFER->origin_count])) {
+            close(from);
+            from = -1;
+        }
+    }
+    bool written = save_rows(fd, from, offsets);
+    if(from != -1) close(from);
+    if(!written) {
+        perror("write");
+        free(offsets);
+        close(fd);
+        unlink(temporary);
+        return;
+    }
+
+    if(fsync(fd) == -1 || close(fd) == -1) {
+        perror("save");
+        free(offsets);
+        unlink(temporary);
+        return;
+    }
+    if(rename(temporary, filename) == -1) {
+        perror("rename");
+        free(offsets);
+        unlink(temporary);
+        return;
+    }
+
+    BUFFER_DIRTY = false;
+    if(filename == INIT_ARG_FNAME) {
+        stat(filename, &ACTIVE_BUFFER->disk);
+        if(offsets) origins_take(ACTIVE_BUFFER, offsets, BUFFER_ENDS_NEWLINE, &ACTIVE_BUFFER->disk);
+        history_append(ACTIVE_BUFFER, &ACTIVE_VIEW->cursor);
+        plugins_event(LIGHT_EVENT_SAVE);
+    }
+
+    if (called_through_shortcut) {
+        IGN_FILE = SAVE_FILE = EXIT_FLAG = false;
+    } else {
+        IGN_FILE = false;
+        SAVE_FILE = true;
+        EXIT_FLAG = true;
+    }
+
+    check_EXIT((char*)filename, called_through_shortcut); // type checker : discard const qualifier
+}
+
+// A line containing =<filename> chooses a filename. Ctrl+N remains
+// the only shortcut which writes the buffer.
+bool checkpoint() {
+    char* command = DISPLAY_BUFFER[NUMBER_OF_ROWS];
+    if(command[0] != '=') return false;
+
+    char filename[PATHMAX];
+    size_t len = strcspn(command + 1, " \t");
+    if(len == 0 || len >= sizeof(filename)) {
+        fprintf(stderr, "Can not save: invalid filename\n");
+        return false;
+    }
+
+    memcpy(filename, command + 1, len);
+    filename[len] = '\0';
+
+    if(NUMBER_OF_ROWS > 0) {
+        rows_delete(NUMBER_OF_ROWS, 1);
+        BUFFER_ENDS_NEWLINE = true;
+    } else {
+        row_write(0, 0)[0] = '\0';
+        BUFFER_ENDS_NEWLINE = false;
+    }
+    free(INIT_ARG_FNAME);
+    INIT_ARG_FNAME = strdup(filename);
+    detect_language(INIT_ARG_FNAME);
+    if(stat(INIT_ARG_FNAME, &ACTIVE_BUFFER->disk) == -1) memset(&ACTIVE_BUFFER->disk, 0, sizeof(struct stat));
+    watch_directory(INIT_ARG_FNAME);
+    INIT_FILE = true;
+    BUFFER_DIRTY = true;
+    CURRENT_ROW = NUMBER_OF_ROWS;
+    CURRENT_COL = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+    return true;
 }
 
-// Syntax color is deliberately only a display plugin: file content stays clean.
-void plugin_highlight(char* result, char* row, int line_no) {
-    char temp_line[MAX_NUMBER_OF_COLS << 8];
-    char* ptr = temp_line;
-    ptr[0] = '\0';
+/*
+------------------------------------
 
-    size_t len = strlen(row);
-    size_t width = TERM_COL > LINE_GUTTER? TERM_COL - LINE_GUTTER: 1;
-    size_t start = 0;
-    if(line_no == CURRENT_ROW && CURRENT_COL >= width) start = CURRENT_COL - width + 1;
-    size_t finish = start + width;
-    size_t displayed_len = len + (line_no == CURRENT_ROW);
-    if(finish > displayed_len) finish = displayed_len;
-    if(line_no == CURRENT_ROW) CURRENT_VIEW_COL = start;
+- A buffer of at least FIND_INDEX_MIN rows
+gets a find index: its rows are split into
+blocks of about FIND_BLOCK_ROWS rows, and
+every block keeps a FIND_BLOOM_BITS bit filter
+of the three character strings in it. A find
+of three or more characters reads only the
+blocks which may have all of them
+
+- The index is built FIND_STEP_ROWS rows at a
+time whenever no key is waiting, like a file is
+loaded. An edit marks the blocks it touched
+dirty, and moves rows between blocks, dirty
+blocks are searched row by row until they are
+built again. FIND_PENDING is set while any
+buffer has index work to do
+
+- FIND_TEXT is what :find looked for last,
+Ctrl + F finds it again
+
+------------------------------------
+*/
+#define FIND_INDEX_MIN        0x10000
+#define FIND_BLOCK_ROWS       0x400
+#define FIND_BLOOM_BITS       0x10000
+#define FIND_STEP_ROWS        0x10000
+#define FIND_HASH(at)         ((((unsigned char)(at)[0] * 0x9e3779b1u) ^ ((unsigned char)(at)[1] * 0x85ebca77u) ^ \
+                                ((unsigned char)(at)[2] * 0xc2b2ae3du)) >> 16)
+
+struct FindBlock {
+    u_int64_t* bloom;
+    u_int32_t  rows;
+    bool       dirty;
+};
+
+bool FIND_PENDING = false;
+char FIND_TEXT[MAX_NUMBER_OF_COLS] = "";
+
+// Build the filter of count rows of buffer, starting with row first
+void find_block_build(struct Buffer* buffer, struct FindBlock* block, u_int32_t first) {
+    if(!block->bloom) block->bloom = must_realloc(NULL, FIND_BLOOM_BITS / 8);
+    memset(block->bloom, 0, FIND_BLOOM_BITS / 8);
+    for(u_int32_t row = first; row < first + block->rows; row++) {
+        const char* text = buffer->rows[row];
+        for(size_t at = 0; text[at] && text[at + 1] && text[at + 2]; at++) {
+            u_int32_t bit = FIND_HASH(text + at);
+            block->bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+    block->dirty = false;
+}
+
+// Index up to FIND_STEP_ROWS more rows of buffer, dirty blocks first,
+// true while there is more to do
+bool find_index_step(struct Buffer* buffer) {
+    u_int32_t rows = buffer->number_of_rows + 1;
+    if(buffer->follow || buffer->results || (!buffer->find_blocks && rows < FIND_INDEX_MIN)) return false;
+    int64_t budget = FIND_STEP_ROWS;
+    if(buffer->find_dirty) {
+        u_int32_t first = 0;
+        buffer->find_dirty = false;
+        for(u_int32_t i = 0; i < buffer->find_block_count; i++) {
+            struct FindBlock* block = &buffer->find_blocks[i];
+            if(block->dirty && budget <= 0) {
+                buffer->find_dirty = true;
+                break;
+            }
+            if(block->dirty) {
+                find_block_build(buffer, block, first);
+                budget -= block->rows + 1;
+            }
+            first += block->rows;
+        }
+    }
+    while(budget > 0 && buffer->find_indexed < rows) {
+        u_int32_t count = rows - buffer->find_indexed;
+        if(count > FIND_BLOCK_ROWS) count = FIND_BLOCK_ROWS;
+        if(count < FIND_BLOCK_ROWS && buffer->loading) break;
+        if(buffer->find_block_count == buffer->find_block_capacity) {
+            buffer->find_block_capacity = buffer->find_block_capacity? buffer->find_block_capacity * 2: 64;
+            buffer->find_blocks = must_realloc(buffer->find_blocks, buffer->find_block_capacity * sizeof(struct FindBlock));
+        }
+        struct FindBlock* block = &buffer->find_blocks[buffer->find_block_count++];
+        *block = (struct FindBlock){ NULL, count, false };
+        find_block_build(buffer, block, buffer->find_indexed);
+        buffer->find_indexed += count;
+        budget -= count;
+    }
+    return buffer->find_dirty || (buffer->find_indexed < rows && !buffer->loading);
+}
+
+// old_rows rows at row at of buffer became new_rows rows, the blocks
+// they were in are dirty and take the new rows
+void find_rows_changed(struct Buffer* buffer, u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    if(!buffer->find_block_count || at > buffer->find_indexed) return;
+    // Edits come in order, like a paste, the search starts where the last one ended
+    u_int32_t block = 0, first = 0;
+    if(buffer->find_hint_block < buffer->find_block_count && buffer->find_hint_first <= at) {
+        block = buffer->find_hint_block;
+        first = buffer->find_hint_first;
+    }
+    while(block + 1 < buffer->find_block_count && first + buffer->find_blocks[block].rows <= at)
+        first += buffer->find_blocks[block++].rows;
+    buffer->find_hint_block = block;
+    buffer->find_hint_first = first;
+    u_int32_t gone = 0, offset = at - first;
+    for(u_int32_t i = block; i < buffer->find_block_count && gone < old_rows; i++, offset = 0) {
+        u_int32_t taken = buffer->find_blocks[i].rows - offset;
+        if(taken > old_rows - gone) taken = old_rows - gone;
+        buffer->find_blocks[i].rows -= taken;
+        buffer->find_blocks[i].dirty = true;
+        gone += taken;
+    }
+    buffer->find_blocks[block].rows += new_rows;
+    buffer->find_blocks[block].dirty = true;
+    buffer->find_indexed = buffer->find_indexed - gone + new_rows;
+    buffer->find_dirty = FIND_PENDING = true;
+}
+
+// The first text in rows first...last - 1 of buffer, in row first only
+// from col on. Blocks whose filter lacks a three character string of
+// text are skipped whole.
+bool find_rows(struct Buffer* buffer, const char* text, u_int32_t first, size_t col, u_int32_t last,
+               u_int32_t* found_row, u_int16_t* found_col) {
+    u_int32_t bits[MAX_NUMBER_OF_COLS];
+    size_t hashes = 0;
+    for(size_t at = 0; text[at] && text[at + 1] && text[at + 2]; at++) bits[hashes++] = FIND_HASH(text + at);
+
+    u_int32_t block = 0, block_first = 0;
+    for(u_int32_t row = first; row < last; row++) {
+        if(hashes && row < buffer->find_indexed) {
+            while(block_first + buffer->find_blocks[block].rows <= row)
+                block_first += buffer->find_blocks[block++].rows;
+            struct FindBlock* filter = &buffer->find_blocks[block];
+            bool possible = filter->dirty;
+            if(!possible) {
+                size_t i = 0;
+                while(i < hashes && (filter->bloom[bits[i] / 64] >> (bits[i] % 64) & 1)) i++;
+                possible = i == hashes;
+            }
+            if(!possible) {
+                row = block_first + filter->rows - 1;
+                continue;
+            }
+        }
+        const char* row_text = buffer->rows[row];
+        size_t start = row == first? col: 0;
+        if(start > strlen(row_text)) continue;
+        const char* match = strstr(row_text + start, text);
+        if(match) {
+            *found_row = row;
+            *found_col = match - row_text;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Move the cursor to the first FIND_TEXT from row and col on, from the
+// top again past the last row
+bool find_next(u_int32_t from_row, size_t from_col) {
+    u_int32_t row;
+    u_int16_t col;
+    buffer_load_all(ACTIVE_BUFFER);
+    if(!find_rows(ACTIVE_BUFFER, FIND_TEXT, from_row, from_col, NUMBER_OF_ROWS + 1, &row, &col) &&
+       !find_rows(ACTIVE_BUFFER, FIND_TEXT, 0, 0, from_row + 1, &row, &col)) {
+        snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "not found: %.100s", FIND_TEXT);
+        return false;
+    }
+    CURRENT_ROW = row;
+    CURRENT_COL = col;
+    return true;
+}
+
+void shortcut_find_next(char ch) {
+    if(ch == 'F' && FIND_TEXT[0]) find_next(CURRENT_ROW, CURRENT_COL + 1);
+}
+
+// The place in set of the first range which ends after row
+size_t row_ranges_after(struct RowRanges* set, u_int32_t row) {
+    size_t low = 0, high = set->count;
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        if(set->ranges[middle].last <= row) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Rows first...last - 1 join set, along with the ranges they touch
+void row_ranges_add(struct RowRanges* set, u_int32_t first, u_int32_t last) {
+    struct RowRange* ranges = set->ranges;
+    size_t count = set->count, i = first? row_ranges_after(set, first - 1): 0, j;
+    for(j = i; j < count && ranges[j].first <= last; j++) {
+        if(ranges[j].first < first) first = ranges[j].first;
+        if(ranges[j].last > last) last = ranges[j].last;
+    }
+    if(i == j) {
+        if(count == set->capacity) {
+            set->capacity = count? count * 2: 8;
+            set->ranges = ranges = must_realloc(ranges, set->capacity * sizeof(struct RowRange));
+        }
+        memmove(ranges + i + 1, ranges + i, (count - i) * sizeof(struct RowRange));
+        set->count++;
+    } else if(j > i + 1) {
+        memmove(ranges + i + 1, ranges + j, (count - j) * sizeof(struct RowRange));
+        set->count -= j - i - 1;
+    }
+    ranges[i] = (struct RowRange){ first, last };
+}
+
+// The rows from at on leave set
+void row_ranges_cut(struct RowRanges* set, u_int32_t at) {
+    size_t i = row_ranges_after(set, at);
+    if(i < set->count && set->ranges[i].first < at) set->ranges[i++].last = at;
+    set->count = i;
+}
+
+// old_rows rows at row at became new_rows rows: the ranges below move,
+// and the ranges over the old rows leave set. The rows from at to the
+// returned row are to be added back, the new rows and the rest of a
+// range which went on past the old rows.
+u_int32_t row_ranges_replaced(struct RowRanges* set, u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    struct RowRange* ranges = set->ranges;
+    size_t count = set->count, i = row_ranges_after(set, at), j;
+    u_int32_t last = at + new_rows;
+    if(i < count && ranges[i].first < at) {
+        if(ranges[i].last > at + old_rows) last = ranges[i].last - old_rows + new_rows;
+        ranges[i++].last = at;
+    }
+    for(j = i; j < count && ranges[j].last <= at + old_rows; j++);
+    if(j < count && ranges[j].first < at + old_rows) ranges[j].first = at + old_rows;
+    if(old_rows != new_rows) {
+        for(size_t k = j; k < count; k++) {
+            ranges[k].first = ranges[k].first - old_rows + new_rows;
+            ranges[k].last = ranges[k].last - old_rows + new_rows;
+        }
+    }
+    if(j > i) memmove(ranges + i, ranges + j, (count - j) * sizeof(struct RowRange));
+    set->count = count - (j - i);
+    return last;
+}
+
+/*
+------------------------------------
+
+- Every C and Python buffer has its definitions
+in SYMBOLS: the functions, structs, unions and
+enums of C, and the defs and classes of Python.
+SYMBOL_TABLE chains them by the hash of their
+name, whatever buffer they are in, so Ctrl + ]
+finds the definition of the word under the
+cursor in one lookup
+
+- A buffer is read SYMBOL_STEP_ROWS rows at a
+time whenever no key is waiting, like the find
+index, and keeps its symbols sorted by row. An
+edit drops the symbols of the rows it changed,
+and leaves those rows to be read again before
+the next jump or idle step, in symbol_dirty,
+like the word index. Once there are
+SYMBOL_DIRTY_RANGES ranges, they become one.
+SYMBOL_PENDING is set while any buffer has rows
+left to read
+
+- The symbols below an edit are not all moved.
+The ones from symbol_shift_at on are yet to move
+by symbol_shift rows, so an edit only moves the
+symbols between it and the edit before, and a
+jump moves the rest
+
+------------------------------------
+*/
+#define SYMBOL_NAME_MAX       64
+#define SYMBOL_BUCKETS        0x10000
+#define SYMBOL_STEP_ROWS      0x10000
+#define SYMBOL_DIRTY_RANGES   1024
+
+struct Symbol {
+    char           name[SYMBOL_NAME_MAX];
+    u_int32_t      hash;
+    u_int32_t      next;
+    struct Buffer* buffer;
+    u_int32_t      row;
+    u_int16_t      col;
+};
+
+// SYMBOLS[0] is never used, a next of 0 ends a chain
+struct Symbol* SYMBOLS = NULL;
+u_int32_t      SYMBOL_COUNT = 1;
+u_int32_t      SYMBOL_CAPACITY = 0;
+u_int32_t      SYMBOL_FREE = 0;
+u_int32_t      SYMBOL_TABLE[SYMBOL_BUCKETS];
+bool           SYMBOL_PENDING = false;
+
+u_int32_t symbol_hash(const char* name, size_t len) {
+    return (u_int32_t)hash_bytes(0xcbf29ce484222325, name, len);
+}
+
+// 'c' for C, 'p' for Python, 0 for a buffer without symbols
+char symbol_kind(struct Buffer* buffer) {
+    if(!buffer->language || buffer->follow || buffer->results) return 0;
+    if(strcmp(buffer->language->name, "C") == 0) return 'c';
+    if(strcmp(buffer->language->name, "PY") == 0) return 'p';
+    return 0;
+}
+
+// The length of the name row defines, 0 if it defines none, and its
+// column in col. A C function starts in the first column with its
+// type and does not end in ';', a struct, union or enum has its body
+// on that row or the next.
+size_t symbol_name(struct Buffer* buffer, const char* row, size_t* col) {
+    const char* at = row;
+    const char* name = NULL;
+    size_t len = 0;
+    if(symbol_kind(buffer) == 'p') {
+        while(*at == ' ' || *at == '\t') at++;
+        if(strncmp(at, "async ", 6) == 0) at += 6;
+        if(strncmp(at, "def ", 4) == 0) at += 4;
+        else if(strncmp(at, "class ", 6) == 0) at += 6;
+        else return 0;
+        while(*at == ' ') at++;
+        name = at;
+        while(lex_is_word(name[len])) len++;
+    } else {
+        size_t end = strlen(row);
+        while(end > 0 && (row[end - 1] == ' ' || row[end - 1] == '\t' || row[end - 1] == '\r')) end--;
+        if(!lex_is_word(*at) || (*at >= '0' && *at <= '9') || (end > 0 && row[end - 1] == ';')) return 0;
+        if(strncmp(at, "typedef ", 8) == 0) at += 8;
+        static const char* tags[] = { "struct ", "union ", "enum " };
+        for(size_t i = 0; i < sizeof(tags) / sizeof(tags[0]) && !name; i++) {
+            size_t tag_len = strlen(tags[i]);
+            if(strncmp(at, tags[i], tag_len) != 0) continue;
+            const char* tagged = at + tag_len;
+            while(*tagged == ' ') tagged++;
+            size_t tagged_len = 0;
+            while(lex_is_word(tagged[tagged_len])) tagged_len++;
+            const char* rest = tagged + tagged_len;
+            while(*rest == ' ') rest++;
+            if(tagged_len && (*rest == '{' || rest >= row + end)) {
+                name = tagged;
+                len = tagged_len;
+            }
+        }
+        const char* paren = name? NULL: strchr(at, '(');
+        if(paren && !memchr(at, '=', paren - at)) {
+            const char* name_end = paren;
+            while(name_end > at && name_end[-1] == ' ') name_end--;
+            name = name_end;
+            while(name > at && lex_is_word(name[-1])) name--;
+            len = name_end - name;
+            // A call or a statement has no type in front of its name
+            if(name == at) len = 0;
+        }
+    }
+    if(!name || len == 0 || len >= SYMBOL_NAME_MAX || (*name >= '0' && *name <= '9')) return 0;
+    char word[SYMBOL_NAME_MAX + 2];
+    snprintf(word, sizeof(word), " %.*s ", (int)len, name);
+    if(strstr(buffer->language->keywords, word)) return 0;
+    *col = name - row;
+    return len;
+}
+
+// The row of the symbol at place i of buffer->symbols
+u_int32_t symbol_row(struct Buffer* buffer, u_int32_t i) {
+    u_int32_t row = SYMBOLS[buffer->symbols[i]].row;
+    return i < buffer->symbol_shift_at? row: row + buffer->symbol_shift;
+}
+
+// Move the symbols at places first...last - 1 of buffer by shift rows
+void symbols_move(struct Buffer* buffer, u_int32_t first, u_int32_t last, int32_t shift) {
+    for(u_int32_t i = first; i < last; i++) SYMBOLS[buffer->symbols[i]].row += shift;
+}
+
+// The symbols from place at on move by shift rows, only the ones
+// between at and symbol_shift_at are moved now
+void symbols_shift(struct Buffer* buffer, u_int32_t at, int32_t shift) {
+    if(!buffer->symbol_shift) buffer->symbol_shift_at = at;
+    if(at < buffer->symbol_shift_at) {
+        symbols_move(buffer, at, buffer->symbol_shift_at, shift);
+    } else {
+        symbols_move(buffer, buffer->symbol_shift_at, at, buffer->symbol_shift);
+        buffer->symbol_shift_at = at;
+    }
+    buffer->symbol_shift += shift;
+}
+
+// Move every symbol of buffer to its row, before rows are read from
+// SYMBOLS directly
+void symbols_shift_all(struct Buffer* buffer) {
+    symbols_move(buffer, buffer->symbol_shift_at, buffer->symbol_count, buffer->symbol_shift);
+    buffer->symbol_shift = 0;
+}
+
+// The place in buffer->symbols of the first symbol on row or below
+u_int32_t symbol_lower_bound(struct Buffer* buffer, u_int32_t row) {
+    u_int32_t low = 0, high = buffer->symbol_count;
+    while(low < high) {
+        u_int32_t middle = low + (high - low) / 2;
+        if(symbol_row(buffer, middle) < row) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Add the symbol row of buffer defines, if it defines one
+void symbol_read_row(struct Buffer* buffer, u_int32_t row) {
+    size_t col;
+    const char* text = buffer->rows[row];
+    size_t len = symbol_name(buffer, text, &col);
+    if(!len || lex_row_start(buffer, row) != buffer->language->start) return;
+
+    u_int32_t id = SYMBOL_FREE;
+    if(id) {
+        SYMBOL_FREE = SYMBOLS[id].next;
+    } else {
+        if(SYMBOL_COUNT >= SYMBOL_CAPACITY) {
+            SYMBOL_CAPACITY = SYMBOL_CAPACITY? SYMBOL_CAPACITY * 2: 256;
+            SYMBOLS = must_realloc(SYMBOLS, (size_t)SYMBOL_CAPACITY * sizeof(struct Symbol));
+        }
+        id = SYMBOL_COUNT++;
+    }
+    struct Symbol* symbol = &SYMBOLS[id];
+    memcpy(symbol->name, text + col, len);
+    symbol->name[len] = '\0';
+    symbol->hash = symbol_hash(symbol->name, len);
+    symbol->next = SYMBOL_TABLE[symbol->hash % SYMBOL_BUCKETS];
+    SYMBOL_TABLE[symbol->hash % SYMBOL_BUCKETS] = id;
+    symbol->buffer = buffer;
+    symbol->col = col;
+
+    if(buffer->symbol_count == buffer->symbol_capacity) {
+        buffer->symbol_capacity = buffer->symbol_capacity? buffer->symbol_capacity * 2: 64;
+        buffer->symbols = must_realloc(buffer->symbols, (size_t)buffer->symbol_capacity * sizeof(u_int32_t));
+    }
+    u_int32_t at = symbol_lower_bound(buffer, row);
+    if(at < buffer->symbol_shift_at) buffer->symbol_shift_at++;
+    symbol->row = at < buffer->symbol_shift_at? row: row - buffer->symbol_shift;
+    memmove(buffer->symbols + at + 1, buffer->symbols + at, (size_t)(buffer->symbol_count - at) * sizeof(u_int32_t));
+    buffer->symbols[at] = id;
+    buffer->symbol_count++;
+}
+
+// Drop the symbols of rows first...last - 1 of buffer
+void symbols_remove(struct Buffer* buffer, u_int32_t first, u_int32_t last) {
+    u_int32_t from = symbol_lower_bound(buffer, first), to = from;
+    for(; to < buffer->symbol_count && symbol_row(buffer, to) < last; to++) {
+        u_int32_t id = buffer->symbols[to];
+        u_int32_t* link = &SYMBOL_TABLE[SYMBOLS[id].hash % SYMBOL_BUCKETS];
+        while(*link != id) link = &SYMBOLS[*link].next;
+        *link = SYMBOLS[id].next;
+        SYMBOLS[id].next = SYMBOL_FREE;
+        SYMBOL_FREE = id;
+    }
+    if(from == to) return;
+    memmove(buffer->symbols + from, buffer->symbols + to, (size_t)(buffer->symbol_count - to) * sizeof(u_int32_t));
+    buffer->symbol_count -= to - from;
+    if(buffer->symbol_shift_at >= to) buffer->symbol_shift_at -= to - from;
+    else if(buffer->symbol_shift_at > from) buffer->symbol_shift_at = from;
+}
+
+// A new language, or none, reads buffer from the start again
+void symbols_drop(struct Buffer* buffer) {
+    symbols_remove(buffer, 0, MAX_NUMBER_OF_ROWS);
+    buffer->symbol_indexed = buffer->symbol_shift_at = 0;
+    buffer->symbol_shift = 0;
+    buffer->symbol_dirty.count = 0;
+    SYMBOL_PENDING = true;
+}
+
+// old_rows rows at row at of buffer became new_rows rows. Their symbols
+// are gone until they are read again, the symbols below them move.
+void symbol_rows_changed(struct Buffer* buffer, u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    if(!buffer->symbol_indexed || at >= buffer->symbol_indexed) return;
+    struct RowRanges* dirty = &buffer->symbol_dirty;
+    SYMBOL_PENDING = true;
+    if(at + old_rows > buffer->symbol_indexed) {
+        symbols_remove(buffer, at, MAX_NUMBER_OF_ROWS);
+        row_ranges_cut(dirty, at);
+        buffer->symbol_indexed = at;
+        return;
+    }
+    symbols_remove(buffer, at, at + old_rows);
+    if(new_rows != old_rows) symbols_shift(buffer, symbol_lower_bound(buffer, at), (int32_t)(new_rows - old_rows));
+    buffer->symbol_indexed = buffer->symbol_indexed - old_rows + new_rows;
+
+    // The rows to read again move like the symbols, and take these rows
+    u_int32_t last = row_ranges_replaced(dirty, at, old_rows, new_rows);
+    if(last <= at) return;
+    if(dirty->count == SYMBOL_DIRTY_RANGES) {
+        dirty->ranges[0].last = dirty->ranges[dirty->count - 1].last;
+        dirty->count = 1;
+    }
+    row_ranges_add(dirty, at, last);
+}
+
+// Read the rows edits left behind again
+void symbol_settle(struct Buffer* buffer) {
+    struct RowRanges* dirty = &buffer->symbol_dirty;
+    if(!dirty->count) return;
+    lex_settle(buffer);
+    for(size_t i = 0; i < dirty->count; i++) {
+        symbols_remove(buffer, dirty->ranges[i].first, dirty->ranges[i].last);
+        for(u_int32_t row = dirty->ranges[i].first; row < dirty->ranges[i].last; row++) symbol_read_row(buffer, row);
+    }
+    dirty->count = 0;
+}
+
+// Read up to SYMBOL_STEP_ROWS more rows of buffer, true while there is
+// more to read. The last row of a file still loading may grow yet.
+bool symbol_index_step(struct Buffer* buffer) {
+    if(!symbol_kind(buffer)) return false;
+    symbol_settle(buffer);
+    u_int32_t rows = buffer->number_of_rows + !buffer->loading;
+    u_int32_t last = rows - buffer->symbol_indexed > SYMBOL_STEP_ROWS? buffer->symbol_indexed + SYMBOL_STEP_ROWS: rows;
+    for(u_int32_t row = buffer->symbol_indexed; row < last; row++) symbol_read_row(buffer, row);
+    if(last > buffer->symbol_indexed) buffer->symbol_indexed = last;
+    return buffer->symbol_indexed < rows;
+}
+
+// Ctrl + ] moves to the definition of the word under the cursor, in
+// whatever buffer it is. On a definition, it moves on to the next one
+// of that name.
+void shortcut_goto_definition(char ch) {
+    if(ch != ']') return;
+    const char* row = DISPLAY_BUFFER[CURRENT_ROW];
+    size_t first = CURRENT_COL, last = CURRENT_COL;
+    while(first > 0 && lex_is_word(row[first - 1])) first--;
+    while(lex_is_word(row[last])) last++;
+    if(first == last || last - first >= SYMBOL_NAME_MAX) return;
+    char name[SYMBOL_NAME_MAX];
+    memcpy(name, row + first, last - first);
+    name[last - first] = '\0';
+
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+        symbol_settle(BUFFERS[i]);
+        symbols_shift_all(BUFFERS[i]);
+    }
+    u_int32_t hash = symbol_hash(name, last - first);
+    // A chain starts with the newest symbol, so the one read first is
+    // last, and the one read after a symbol comes right before it
+    u_int32_t found = 0, next = 0;
+    for(u_int32_t id = SYMBOL_TABLE[hash % SYMBOL_BUCKETS]; id; id = SYMBOLS[id].next) {
+        struct Symbol* symbol = &SYMBOLS[id];
+        if(symbol->hash != hash || strcmp(symbol->name, name) != 0) continue;
+        if(symbol->buffer == ACTIVE_BUFFER && symbol->row == CURRENT_ROW) next = found;
+        found = id;
+    }
+    if(!found) {
+        snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "no definition of %s", name);
+        return;
+    }
+    struct Symbol* symbol = &SYMBOLS[next? next: found];
+    if(symbol->buffer != ACTIVE_BUFFER) view_show(symbol->buffer);
+    CURRENT_ROW = symbol->row;
+    CURRENT_COL = symbol->col;
+}
+
+/*
+------------------------------------
+
+- The bracket matching the one under the cursor
+is highlighted, and Ctrl + R moves to it. A
+bracket in a string or a comment does not count
+
+- The rows of a buffer are the nodes of a treap
+in row order, a segment tree rows can be put in
+and taken out of in O(log n). Every node keeps
+the opening minus the closing brackets of its
+row, and the lowest that count gets from the
+start of the row, and both for its subtree, so
+one descent finds the row holding the match
+instead of reading every row in between
+
+- A node also keeps the lexer state its row
+starts in. An edit marks the rows it changed to
+be read again, and the rows below them as long
+as they start in another state than before
+
+- The rows are read BRACKET_STEP_ROWS at a time
+whenever no key is waiting, like the find index,
+BRACKET_PENDING is set until all of them are
+
+------------------------------------
+*/
+#define BRACKET_STEP_ROWS     0x8000
+
+// brackets[0] stands for no node, all of it stays 0
+struct BracketNode {
+    u_int32_t left;
+    u_int32_t right;
+    u_int32_t size;
+    int32_t   sum;
+    int32_t   low;
+    int16_t   row_sum;
+    int16_t   row_low;
+    u_int16_t state;
+};
+
+bool BRACKET_PENDING = false;
+
+u_int32_t bracket_priority(u_int32_t node) {
+    node ^= node >> 16;
+    node *= 0x85ebca6b;
+    node ^= node >> 13;
+    node *= 0xc2b2ae35;
+    return node ^ (node >> 16);
+}
+
+void bracket_pull(struct Buffer* buffer, u_int32_t id) {
+    struct BracketNode* node = &buffer->brackets[id];
+    struct BracketNode* left = &buffer->brackets[node->left];
+    struct BracketNode* right = &buffer->brackets[node->right];
+    node->size = left->size + 1 + right->size;
+    node->sum = left->sum + node->row_sum + right->sum;
+    node->low = left->low;
+    if(left->sum + node->row_low < node->low) node->low = left->sum + node->row_low;
+    if(left->sum + node->row_sum + right->low < node->low) node->low = left->sum + node->row_sum + right->low;
+}
+
+// The first count rows of node go to left, the others to right
+void bracket_split(struct Buffer* buffer, u_int32_t node, u_int32_t count, u_int32_t* left, u_int32_t* right) {
+    if(!node) {
+        *left = *right = 0;
+        return;
+    }
+    u_int32_t above = buffer->brackets[buffer->brackets[node].left].size;
+    if(count <= above) {
+        bracket_split(buffer, buffer->brackets[node].left, count, left, &buffer->brackets[node].left);
+        *right = node;
+    } else {
+        bracket_split(buffer, buffer->brackets[node].right, count - above - 1, &buffer->brackets[node].right, right);
+        *left = node;
+    }
+    bracket_pull(buffer, node);
+}
+
+u_int32_t bracket_merge(struct Buffer* buffer, u_int32_t left, u_int32_t right) {
+    if(!left || !right) return left? left: right;
+    if(bracket_priority(left) > bracket_priority(right)) {
+        buffer->brackets[left].right = bracket_merge(buffer, buffer->brackets[left].right, right);
+        bracket_pull(buffer, left);
+        return left;
+    }
+    buffer->brackets[right].left = bracket_merge(buffer, left, buffer->brackets[right].left);
+    bracket_pull(buffer, right);
+    return right;
+}
+
+// A node for a row which is not read yet
+u_int32_t bracket_new(struct Buffer* buffer) {
+    u_int32_t id = buffer->bracket_free;
+    if(id) {
+        buffer->bracket_free = buffer->brackets[id].left;
+    } else {
+        if(buffer->bracket_count + 1 >= buffer->bracket_capacity) {
+            buffer->bracket_capacity = buffer->bracket_capacity? buffer->bracket_capacity * 2: 256;
+            buffer->brackets = must_realloc(buffer->brackets, (size_t)buffer->bracket_capacity * sizeof(struct BracketNode));
+            if(buffer->bracket_count == 0) memset(&buffer->brackets[0], 0, sizeof(struct BracketNode));
+        }
+        id = ++buffer->bracket_count;
+    }
+    buffer->brackets[id] = (struct BracketNode){ 0, 0, 1, 0, 0, 0, 0, 0 };
+    return id;
+}
+
+void bracket_release(struct Buffer* buffer, u_int32_t node) {
+    if(!node) return;
+    bracket_release(buffer, buffer->brackets[node].left);
+    bracket_release(buffer, buffer->brackets[node].right);
+    buffer->brackets[node].left = buffer->bracket_free;
+    buffer->bracket_free = node;
+}
 
-    for (size_t i = start; i < finish; i++) {
-        char ch = i < len? row[i]: ' ';
-        const char* color = i < len? plugin_color_at(row, i): "";
-        if(plugin_is_selected(line_no, i)) {
-            ptr += sprintf(ptr, "%s\033[48;5;24m%c\033[0m", color, ch);
-        } else if(line_no == CURRENT_ROW && i == CURRENT_COL) {
-            ptr += sprintf(ptr, "%s\033[7m%c\033[0m", color, ch);
+u_int32_t bracket_at(struct Buffer* buffer, u_int32_t row) {
+    u_int32_t node = buffer->bracket_root;
+    while(node) {
+        u_int32_t above = buffer->brackets[buffer->brackets[node].left].size;
+        if(row == above) return node;
+        if(row < above) {
+            node = buffer->brackets[node].left;
         } else {
-            ptr += sprintf(ptr, "%s%c\033[0m", color, ch);
+            row -= above + 1;
+            node = buffer->brackets[node].right;
         }
     }
-    ptr += sprintf(ptr, "\n");
+    return 0;
+}
 
-    strcat(result, temp_line);
+// Every node on the way to row takes what changed in it
+void bracket_pull_path(struct Buffer* buffer, u_int32_t node, u_int32_t row) {
+    u_int32_t above = buffer->brackets[buffer->brackets[node].left].size;
+    if(row < above) bracket_pull_path(buffer, buffer->brackets[node].left, row);
+    else if(row > above) bracket_pull_path(buffer, buffer->brackets[node].right, row - above - 1);
+    bracket_pull(buffer, node);
 }
 
-// Keep the important state visible without taking space from the buffer.
-void plugin_status_bar() {
-    char status[PATHMAX + 128];
-    const char* filename = INIT_FILE? INIT_ARG_FNAME: "[scratch]";
-    const char* language = FILE_LANGUAGE == LANGUAGE_C? "C":
-                           FILE_LANGUAGE == LANGUAGE_PYTHON? "PY": "TEXT";
-    if(CONFIRM_EXIT && INIT_FILE) {
-        snprintf(status, sizeof(status), " Save changes before exit?  y save | n discard | c cancel ");
-    } else if(CONFIRM_EXIT) {
-        snprintf(status, sizeof(status), " No filename: c cancel, then use =filename and Ctrl+N | n discard ");
+// counted[i] is 1 for an opening bracket of row which counts, -1 for
+// a closing one and 0 for anything else. Returns the state the next
+// row starts in.
+u_int16_t bracket_lex(struct Buffer* buffer, const char* row, u_int16_t state, int8_t* counted) {
+    for(size_t i = 0; row[i]; i++) {
+        if(buffer->language) state = LEX_NEXT[state * LEX_CLASSES + LEX_CLASS[(unsigned char)row[i]]] & LEX_STATE_MAX;
+        counted[i] = 0;
+        if(buffer->language && LEX_COLOR[state] != LEX_PLAIN) continue;
+        if(row[i] == '(' || row[i] == '[' || row[i] == '{') counted[i] = 1;
+        else if(row[i] == ')' || row[i] == ']' || row[i] == '}') counted[i] = -1;
+    }
+    return buffer->language? LEX_CARRY[state]: 0;
+}
+
+// Read row, the row of node, as starting in state
+u_int16_t bracket_read_row(struct Buffer* buffer, u_int32_t node, u_int32_t row, u_int16_t state) {
+    int8_t counted[MAX_NUMBER_OF_COLS];
+    const char* text = buffer->rows[row];
+    u_int16_t next = bracket_lex(buffer, text, state, counted);
+    int16_t sum = 0, low = 0;
+    for(size_t i = 0; text[i]; i++) {
+        sum += counted[i];
+        if(sum < low) low = sum;
+    }
+    buffer->brackets[node].state = state;
+    buffer->brackets[node].row_sum = sum;
+    buffer->brackets[node].row_low = low;
+    return next;
+}
+
+// Forget every bracket of buffer, it is read from the start again
+void brackets_drop(struct Buffer* buffer) {
+    bracket_release(buffer, buffer->bracket_root);
+    buffer->bracket_root = buffer->bracket_indexed = 0;
+    buffer->bracket_dirty_first = buffer->bracket_dirty_last = 0;
+    BRACKET_PENDING = true;
+}
+
+// old_rows rows at row at of buffer became new_rows rows, those are
+// read again, with the rows below them which start in another state
+void bracket_rows_changed(struct Buffer* buffer, u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    BRACKET_PENDING = true;
+    if(at >= buffer->bracket_indexed) return;
+    u_int32_t first = buffer->bracket_dirty_first, last = buffer->bracket_dirty_last;
+    u_int32_t left, middle, right;
+    if(at + old_rows > buffer->bracket_indexed) {
+        buffer->bracket_state = buffer->brackets[bracket_at(buffer, at)].state;
+        bracket_split(buffer, buffer->bracket_root, at, &left, &right);
+        bracket_release(buffer, right);
+        buffer->bracket_root = left;
+        buffer->bracket_indexed = at;
+        if(last > at) buffer->bracket_dirty_last = at;
+        return;
+    }
+    if(old_rows != new_rows) {
+        bracket_split(buffer, buffer->bracket_root, at, &left, &right);
+        bracket_split(buffer, right, old_rows, &middle, &right);
+        bracket_release(buffer, middle);
+        for(u_int32_t i = 0; i < new_rows; i++) left = bracket_merge(buffer, left, bracket_new(buffer));
+        buffer->bracket_root = bracket_merge(buffer, left, right);
+        buffer->bracket_indexed = buffer->bracket_indexed - old_rows + new_rows;
+    }
+
+    // The rows to read again move with the rows, the row after removed
+    // rows may start in another state now
+    if(first < last) {
+        first = first >= at + old_rows? first - old_rows + new_rows: first > at? at: first;
+        last = last >= at + old_rows? last - old_rows + new_rows: last > at? at: last;
+    }
+    u_int32_t changed = at + (new_rows? new_rows: 1);
+    if(changed > buffer->bracket_indexed) changed = buffer->bracket_indexed;
+    if(first >= last) {
+        first = at;
+        last = changed;
     } else {
-        snprintf(status, sizeof(status), " light | %s | %s | %s%s | %d:%d | ^Space select  Enter copy  d delete  ^V paste ",
-                 SELECT_ACTIVE? "SELECT": "EDIT", language, filename, BUFFER_DIRTY? " [+]": "",
-                 CURRENT_ROW + 1, CURRENT_COL + 1);
+        if(at < first) first = at;
+        if(changed > last) last = changed;
     }
-    printf("\033[%d;1H\033[7m%-*.*s\033[0m", TERM_ROW, TERM_COL, TERM_COL, status);
+    buffer->bracket_dirty_first = first;
+    buffer->bracket_dirty_last = last;
 }
 
+// Read the rows edits left behind again, BRACKET_STEP_ROWS at most.
+// The rows from bracket_dirty_first on are not known until the rest
+// is read in the next idle step.
+void bracket_settle(struct Buffer* buffer) {
+    if(buffer->bracket_dirty_first >= buffer->bracket_dirty_last) return;
+    u_int32_t row = buffer->bracket_dirty_first, last = row + BRACKET_STEP_ROWS;
+    u_int16_t state = buffer->language? buffer->language->start: 0;
+    if(row > 0) state = lex_row_end(buffer->brackets[bracket_at(buffer, row - 1)].state, buffer->rows[row - 1]);
+    if(!buffer->language) state = 0;
+    for(; row < buffer->bracket_indexed && row < last; row++) {
+        u_int32_t node = bracket_at(buffer, row);
+        if(row >= buffer->bracket_dirty_last && buffer->brackets[node].state == state) break;
+        state = bracket_read_row(buffer, node, row, state);
+        bracket_pull_path(buffer, buffer->bracket_root, row);
+    }
+    if(row == buffer->bracket_indexed) buffer->bracket_state = state;
+    if(row < buffer->bracket_indexed && row == last) {
+        buffer->bracket_dirty_first = row;
+        if(buffer->bracket_dirty_last <= row) buffer->bracket_dirty_last = row + 1;
+        BRACKET_PENDING = true;
+        return;
+    }
+    buffer->bracket_dirty_first = buffer->bracket_dirty_last = 0;
+}
 
-// plugins and shortcuts go hand in hand, this is an example
-// where a plugin might call a shortcut 
-void shortcut_delete_curr_line(char);
-void normalize_COL();
+// Read up to BRACKET_STEP_ROWS more rows of buffer, true while there
+// is more to read. The last row of a file still loading may grow yet.
+bool bracket_index_step(struct Buffer* buffer) {
+    if(buffer->follow || buffer->results) return false;
+    bracket_settle(buffer);
+    if(buffer->bracket_indexed == 0) buffer->bracket_state = buffer->language? buffer->language->start: 0;
+    u_int32_t rows = buffer->number_of_rows + !buffer->loading;
+    u_int32_t last = rows - buffer->bracket_indexed > BRACKET_STEP_ROWS? buffer->bracket_indexed + BRACKET_STEP_ROWS: rows;
+    for(u_int32_t row = buffer->bracket_indexed; row < last; row++) {
+        u_int32_t node = bracket_new(buffer);
+        buffer->bracket_state = bracket_read_row(buffer, node, row, buffer->bracket_state);
+        bracket_pull(buffer, node);
+        buffer->bracket_root = bracket_merge(buffer, buffer->bracket_root, node);
+    }
+    if(last > buffer->bracket_indexed) buffer->bracket_indexed = last;
+    return buffer->bracket_indexed < rows;
+}
 
-// Concatenate strings in DISPLAY_BUFFER with newline character
-// char* result iterates over all ROWS and COLUMNS, this is a 
-// nice place to use your plugins
-char* join_display_buffer() {
-    get_terminal_size();
-    int viewport_rows = TERM_ROW > 1? TERM_ROW - 1: 1;
-    int start_line = VIEW_START_ROW;
-    int latest_start = NUMBER_OF_ROWS - viewport_rows + 1;
-    if(CURRENT_ROW < start_line) start_line = CURRENT_ROW;
-    if(CURRENT_ROW >= start_line + viewport_rows) start_line = CURRENT_ROW - viewport_rows + 1;
-    if(start_line < 0) start_line = 0;
-    if(latest_start < 0) latest_start = 0;
-    if(start_line > latest_start) start_line = latest_start;
-    int end_line = start_line + viewport_rows - 1;
-    if(end_line > NUMBER_OF_ROWS) end_line = NUMBER_OF_ROWS;
-    VIEW_START_ROW = start_line;
+// The bracket matching the one at row and col of buffer. There is none
+// for brackets of another kind, or while the rows it may be in are not
+// read yet.
+bool bracket_match(struct Buffer* buffer, u_int32_t row, u_int16_t col, u_int32_t* match_row, u_int16_t* match_col) {
+    bracket_settle(buffer);
+    u_int32_t known = buffer->bracket_dirty_first < buffer->bracket_dirty_last? buffer->bracket_dirty_first: buffer->bracket_indexed;
+    if(row >= known) return false;
+    int8_t counted[MAX_NUMBER_OF_COLS];
+    const char* text = buffer->rows[row];
+    size_t len = strlen(text);
+    bracket_lex(buffer, text, buffer->brackets[bracket_at(buffer, row)].state, counted);
+    if(col >= len || !counted[col]) return false;
+
+    // Most matches are on the same row
+    int32_t depth = 0;
+    int8_t step = counted[col];
+    size_t found = MAX_NUMBER_OF_COLS;
+    if(step > 0) {
+        for(size_t i = col + 1; i < len && found == MAX_NUMBER_OF_COLS; i++) if((depth += counted[i]) < 0) found = i;
+    } else {
+        for(size_t i = col; i-- > 0 && found == MAX_NUMBER_OF_COLS;) if((depth -= counted[i]) < 0) found = i;
+    }
+
+    // Or in the first row below, or the last row above, which closes
+    // more than the rows in between opened
+    u_int32_t target = row;
+    if(found == MAX_NUMBER_OF_COLS) {
+        u_int32_t left, right, node;
+        bracket_split(buffer, buffer->bracket_root, step > 0? row + 1: row, &left, &right);
+        struct BracketNode* brackets = buffer->brackets;
+        bool in_row = false;
+        if(step > 0 && depth + brackets[right].low < 0) {
+            target = row + 1;
+            for(node = right; node;) {
+                struct BracketNode* above = &brackets[brackets[node].left];
+                if(depth + above->low < 0) {
+                    node = brackets[node].left;
+                    continue;
+                }
+                depth += above->sum;
+                if(depth + brackets[node].row_low < 0) {
+                    target += above->size;
+                    in_row = true;
+                    break;
+                }
+                depth += brackets[node].row_sum;
+                target += above->size + 1;
+                node = brackets[node].right;
+            }
+        } else if(step < 0 && depth - (brackets[left].sum - brackets[left].low) < 0) {
+            target = 0;
+            for(node = left; node;) {
+                struct BracketNode* after = &brackets[brackets[node].right];
+                if(depth - (after->sum - after->low) < 0) {
+                    target += brackets[brackets[node].left].size + 1;
+                    node = brackets[node].right;
+                    continue;
+                }
+                depth -= after->sum;
+                if(depth - (brackets[node].row_sum - brackets[node].row_low) < 0) {
+                    target += brackets[brackets[node].left].size;
+                    in_row = true;
+                    break;
+                }
+                depth -= brackets[node].row_sum;
+                node = brackets[node].left;
+            }
+        }
+        buffer->bracket_root = bracket_merge(buffer, left, right);
+        if(!in_row || target >= known) return false;
+
+        const char* other = buffer->rows[target];
+        size_t other_len = strlen(other);
+        bracket_lex(buffer, other, buffer->brackets[bracket_at(buffer, target)].state, counted);
+        if(step > 0) {
+            for(size_t i = 0; i < other_len && found == MAX_NUMBER_OF_COLS; i++) if((depth += counted[i]) < 0) found = i;
+        } else {
+            for(size_t i = other_len; i-- > 0 && found == MAX_NUMBER_OF_COLS;) if((depth -= counted[i]) < 0) found = i;
+        }
+        if(found == MAX_NUMBER_OF_COLS) return false;
+    }
+
+    const char* pairs = "()[]{}";
+    char open = step > 0? text[col]: buffer->rows[target][found];
+    char close = step > 0? buffer->rows[target][found]: text[col];
+    if(strchr(pairs, open)[1] != close) return false;
+    *match_row = target;
+    *match_col = found;
+    return true;
+}
+
+
+// Ctrl + R moves to the bracket matching the one under the cursor
+void shortcut_goto_bracket(char ch) {
+    u_int32_t row;
+    u_int16_t col;
+    if(ch == 'R' && bracket_match(ACTIVE_BUFFER, CURRENT_ROW, CURRENT_COL, &row, &col)) {
+        CURRENT_ROW = row;
+        CURRENT_COL = col;
+    }
+}
+
+/*
+------------------------------------
+
+- Ctrl + S completes the word before the cursor
+with a word of any open buffer which starts
+with it, pressed again it puts the next one in
+its place, alphabetically
+
+- The words of every buffer are counted in one
+trie, WORD_NODES. The children of a node are
+kept in order, and every node knows how many
+words are below it, so the first word after
+another which starts the same is found with one
+walk down and a few steps back up, however many
+words there are. WORD_CHILDREN finds the child
+of a node for a character in one lookup, which
+is what counting a row takes. A word is a run of the
+characters Ctrl + Left stops at which does not
+start with a digit
+
+- The rows are read WORD_STEP_ROWS at a time
+whenever no key is waiting, like the find index.
+An edit takes the words of the rows it changes
+out of the counts before it changes them, and
+leaves the rows to be read again before the next
+completion or idle step, in word_dirty. Once
+there are WORD_DIRTY_RANGES ranges, as after an
+edit at many cursors, they are read at once, so
+keeping them sorted stays cheap
+
+------------------------------------
+*/
+#define WORD_MAX              64
+#define WORD_STEP_ROWS        0x10000
+#define WORD_DIRTY_RANGES     1024
+
+// WORD_NODES[0] is the root, a child or next of 0 is none
+struct WordNode {
+    u_int32_t child;
+    u_int32_t next;
+    u_int32_t count;
+    u_int32_t total;
+    u_int32_t parent;
+    char      ch;
+};
 
-    size_t total_len = 0;
-    for (int i = start_line; i <= end_line; i++) {
-        total_len += strlen(DISPLAY_BUFFER[i]) + 1;   
+struct WordNode* WORD_NODES = NULL;
+u_int32_t        WORD_NODE_COUNT = 0;
+u_int32_t        WORD_NODE_CAPACITY = 0;
+u_int32_t*       WORD_CHILDREN = NULL;
+u_int32_t        WORD_CHILDREN_BITS = 0;
+bool             WORD_PENDING = false;
+
+// The completion Ctrl + S put in last, a second Ctrl + S right after
+// it replaces it with the next one
+struct Buffer*   COMPLETE_BUFFER = NULL;
+u_int32_t        COMPLETE_ROW;
+u_int16_t        COMPLETE_COL;
+u_int32_t        COMPLETE_CHANGES;
+char             COMPLETE_PREFIX[WORD_MAX];
+char             COMPLETE_WORD[WORD_MAX];
+
+// The slot of WORD_CHILDREN to look for the child of parent for ch
+// from, the next ones follow when it is taken
+u_int32_t word_slot(u_int32_t parent, char ch) {
+    return ((parent << 8 | (unsigned char)ch) * 0x9e3779b1u) >> (32 - WORD_CHILDREN_BITS);
+}
+
+// The child of node for ch, which is made when make is set, else 0
+u_int32_t word_child(u_int32_t node, char ch, bool make) {
+    u_int32_t mask = (1u << WORD_CHILDREN_BITS) - 1, slot = word_slot(node, ch), id;
+    for(; (id = WORD_CHILDREN[slot]); slot = (slot + 1) & mask) {
+        if(WORD_NODES[id].parent == node && WORD_NODES[id].ch == ch) return id;
     }
+    if(!make) return 0;
+    if(WORD_NODE_COUNT >= WORD_NODE_CAPACITY) {
+        WORD_NODE_CAPACITY = WORD_NODE_CAPACITY * 2;
+        WORD_NODES = must_realloc(WORD_NODES, (size_t)WORD_NODE_CAPACITY * sizeof(struct WordNode));
+    }
+    id = WORD_NODE_COUNT++;
+    u_int32_t* link = &WORD_NODES[node].child;
+    while(*link && WORD_NODES[*link].ch < ch) link = &WORD_NODES[*link].next;
+    WORD_NODES[id] = (struct WordNode){ 0, *link, 0, 0, node, ch };
+    *link = id;
+    WORD_CHILDREN[slot] = id;
+
+    // Half full, every child goes to a table twice the size
+    if(WORD_NODE_COUNT > mask / 2) {
+        free(WORD_CHILDREN);
+        WORD_CHILDREN_BITS++;
+        WORD_CHILDREN = must_realloc(NULL, ((size_t)1 << WORD_CHILDREN_BITS) * sizeof(u_int32_t));
+        memset(WORD_CHILDREN, 0, ((size_t)1 << WORD_CHILDREN_BITS) * sizeof(u_int32_t));
+        mask = (1u << WORD_CHILDREN_BITS) - 1;
+        for(u_int32_t child = 1; child < WORD_NODE_COUNT; child++) {
+            for(slot = word_slot(WORD_NODES[child].parent, WORD_NODES[child].ch); WORD_CHILDREN[slot];) slot = (slot + 1) & mask;
+            WORD_CHILDREN[slot] = child;
+        }
+    }
+    return id;
+}
 
-    // line number + highlight escape codes + the cursor's extra blank
-    size_t visible_rows = end_line - start_line + 1;
-    size_t decoration_len = total_len * 24 + visible_rows * 48 + 1;
-    char *result = malloc(total_len + decoration_len);
-    if (!result) return NULL;
+// Count the word of len characters once more, or once less for a
+// step of -1. Its nodes stay when it is gone, with a total of 0.
+void word_count(const char* word, size_t len, int step) {
+    if(!WORD_NODES) {
+        WORD_NODE_CAPACITY = 1024;
+        WORD_NODES = must_realloc(NULL, (size_t)WORD_NODE_CAPACITY * sizeof(struct WordNode));
+        WORD_NODES[0] = (struct WordNode){ 0, 0, 0, 0, 0, '\0' };
+        WORD_NODE_COUNT = 1;
+        WORD_CHILDREN_BITS = 11;
+        WORD_CHILDREN = must_realloc(NULL, ((size_t)1 << WORD_CHILDREN_BITS) * sizeof(u_int32_t));
+        memset(WORD_CHILDREN, 0, ((size_t)1 << WORD_CHILDREN_BITS) * sizeof(u_int32_t));
+    }
+    u_int32_t node = 0;
+    WORD_NODES[0].total += step;
+    for(size_t i = 0; i < len; i++) {
+        node = word_child(node, word[i], true);
+        WORD_NODES[node].total += step;
+    }
+    WORD_NODES[node].count += step;
+}
 
-    result[0] = '\0'; 
-    for (int i = start_line; i <= end_line; i++) {
-            
-        // Add your plugins here
-        plugin_show_line_colored(result, i);
-        plugin_highlight(result, DISPLAY_BUFFER[i], i);
+void word_count_row(const char* row, int step) {
+    for(size_t i = 0; row[i];) {
+        if(!lex_is_word(row[i])) {
+            i++;
+            continue;
+        }
+        size_t first = i;
+        while(lex_is_word(row[i])) i++;
+        if(row[first] >= '0' && row[first] <= '9') continue;
+        if(i - first < WORD_MAX) word_count(row + first, i - first, step);
     }
+}
 
-    return result;
+// Count the rows edits left behind again
+void word_settle(struct Buffer* buffer) {
+    struct RowRanges* dirty = &buffer->word_dirty;
+    for(size_t i = 0; i < dirty->count; i++) {
+        for(u_int32_t row = dirty->ranges[i].first; row < dirty->ranges[i].last; row++)
+            word_count_row(buffer->rows[row], 1);
+    }
+    dirty->count = 0;
 }
 
-// normal IO compared to before scatter gather io
-bool write_all(int fd, const char* buffer, size_t len) {
-    while(len > 0) {
-        ssize_t written = write(fd, buffer, len);
-        if(written < 0) {
-            if(errno == EINTR) continue;
-            return false;
+// Rows first..last-1 of buffer are to be read again
+void word_dirty_add(struct Buffer* buffer, u_int32_t first, u_int32_t last) {
+    if(buffer->word_dirty.count == WORD_DIRTY_RANGES) word_settle(buffer);
+    row_ranges_add(&buffer->word_dirty, first, last);
+}
+
+// Take the words of count rows at row at of buffer out of the counts,
+// before they change. Rows which are out already are left alone.
+void words_uncount(struct Buffer* buffer, u_int32_t at, u_int32_t count) {
+    u_int32_t last = at + count < buffer->word_indexed? at + count: buffer->word_indexed;
+    if(at >= last) return;
+    struct RowRanges* dirty = &buffer->word_dirty;
+    struct RowRange* ranges = dirty->ranges;
+    size_t i = row_ranges_after(dirty, at);
+    for(u_int32_t row = at; row < last;) {
+        while(i < dirty->count && ranges[i].last <= row) i++;
+        if(i < dirty->count && ranges[i].first <= row) {
+            row = ranges[i].last;
+            continue;
         }
-        buffer += written;
-        len -= written;
+        u_int32_t stop = i < dirty->count && ranges[i].first < last? ranges[i].first: last;
+        for(; row < stop; row++) word_count_row(buffer->rows[row], -1);
     }
-    return true;
+    word_dirty_add(buffer, at, last);
+    WORD_PENDING = true;
 }
 
-void save_buffer_to_file(const char* filename, bool called_through_shortcut) {
-    if(filename == NULL || filename[0] == '\0') {
-        fprintf(stderr, "Can not save: filename is empty\n");
+// old_rows rows at row at of buffer, taken out of the counts already,
+// became new_rows rows. Those are read again, the rows below move,
+// and a range which went on past the old rows still goes on past them.
+void word_rows_changed(struct Buffer* buffer, u_int32_t at, u_int32_t old_rows, u_int32_t new_rows) {
+    WORD_PENDING = true;
+    if(at >= buffer->word_indexed) return;
+    // The rows were taken out of the counts, and are left to be read again
+    if(old_rows == new_rows && at + old_rows <= buffer->word_indexed) return;
+    if(at + old_rows > buffer->word_indexed) {
+        row_ranges_cut(&buffer->word_dirty, at);
+        buffer->word_indexed = at;
         return;
     }
+    u_int32_t last = row_ranges_replaced(&buffer->word_dirty, at, old_rows, new_rows);
+    buffer->word_indexed = buffer->word_indexed - old_rows + new_rows;
+    if(last > at) word_dirty_add(buffer, at, last);
+}
 
-    char temporary[PATHMAX + 16];
-    if(snprintf(temporary, sizeof(temporary), "%s.light-XXXXXX", filename) >= (int)sizeof(temporary)) {
-        fprintf(stderr, "Can not save: file path is too long\n");
-        return;
+// Read up to WORD_STEP_ROWS more rows of buffer, true while there is
+// more to read
+bool word_index_step(struct Buffer* buffer) {
+    if(buffer->follow || buffer->results) return false;
+    word_settle(buffer);
+    u_int32_t rows = buffer->number_of_rows + 1;
+    u_int32_t last = rows - buffer->word_indexed > WORD_STEP_ROWS? buffer->word_indexed + WORD_STEP_ROWS: rows;
+    for(u_int32_t row = buffer->word_indexed; row < last; row++) word_count_row(buffer->rows[row], 1);
+    if(last > buffer->word_indexed) buffer->word_indexed = last;
+    return buffer->word_indexed < rows;
+}
+
+// The first word at or below node, which spells word up to depth
+bool word_first(u_int32_t node, char* word, size_t depth) {
+    if(WORD_NODES[node].count) {
+        word[depth] = '\0';
+        return true;
+    }
+    for(u_int32_t child = WORD_NODES[node].child; child; child = WORD_NODES[child].next) {
+        if(!WORD_NODES[child].total) continue;
+        word[depth] = WORD_NODES[child].ch;
+        return word_first(child, word, depth + 1);
     }
+    return false;
+}
 
-    struct stat old_file;
-    mode_t mode = stat(filename, &old_file) == 0? old_file.st_mode & 0777: 0644;
-    int fd = mkstemp(temporary);
-    if (fd == -1) {
-        perror("save");
-        return;
+// The first word after word which starts with its first prefix_len
+// characters, in word. False when there is none.
+bool word_after(char* word, size_t prefix_len) {
+    if(!WORD_NODES) return false;
+    u_int32_t path[WORD_MAX + 1];
+    size_t len = strlen(word), depth = 0;
+    path[0] = 0;
+    while(depth < len && (path[depth + 1] = word_child(path[depth], word[depth], false))) depth++;
+    if(depth < prefix_len) return false;
+    // Below the whole word every word comes after it, below a part of
+    // it only the children after its next character do
+    for(;; depth--) {
+        for(u_int32_t child = WORD_NODES[path[depth]].child; child; child = WORD_NODES[child].next) {
+            if(!WORD_NODES[child].total || (depth < len && WORD_NODES[child].ch <= word[depth])) continue;
+            word[depth] = WORD_NODES[child].ch;
+            if(word_first(child, word, depth + 1)) return true;
+        }
+        if(depth == prefix_len) return false;
     }
-    fchmod(fd, mode);
+}
 
-    for (int i = 0; i <= NUMBER_OF_ROWS; i++) {
-        size_t len = strlen(DISPLAY_BUFFER[i]);
+// Ctrl + S completes the word before the cursor, and again right after
+// a completion puts the next one in its place. After the last one the
+// word is as it was typed.
+void shortcut_complete(char ch) {
+    if(ch != 'S') return;
+    char* row = DISPLAY_BUFFER[CURRENT_ROW];
+    bool again = COMPLETE_BUFFER == ACTIVE_BUFFER && COMPLETE_ROW == CURRENT_ROW &&
+                 COMPLETE_CHANGES == BUFFER_CHANGES &&
+                 CURRENT_COL == COMPLETE_COL + strlen(COMPLETE_WORD);
+    if(!again) {
+        size_t first = CURRENT_COL;
+        while(first > 0 && lex_is_word(row[first - 1])) first--;
+        if(first == CURRENT_COL || CURRENT_COL - first >= WORD_MAX || (row[first] >= '0' && row[first] <= '9')) return;
+        COMPLETE_COL = first;
+        memcpy(COMPLETE_PREFIX, row + first, CURRENT_COL - first);
+        COMPLETE_PREFIX[CURRENT_COL - first] = '\0';
+        strcpy(COMPLETE_WORD, COMPLETE_PREFIX);
+    }
 
-        if(!write_all(fd, DISPLAY_BUFFER[i], len)) {
-            perror("write");
-            close(fd);
-            unlink(temporary);
+    for(size_t i = 0; i < BUFFER_COUNT; i++) word_settle(BUFFERS[i]);
+    char word[WORD_MAX];
+    strcpy(word, COMPLETE_WORD);
+    if(!word_after(word, strlen(COMPLETE_PREFIX))) {
+        if(!again) {
+            snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "no word starts with %s", COMPLETE_PREFIX);
             return;
         }
+        strcpy(word, COMPLETE_PREFIX);
+    }
 
-        if(i < NUMBER_OF_ROWS || BUFFER_ENDS_NEWLINE) {
-          if(!write_all(fd, "\n", 1)) {
-            perror("write");
-            close(fd);
-            unlink(temporary);
-            return;
-          }
+    size_t old_len = strlen(COMPLETE_WORD), new_len = strlen(word), len = strlen(row);
+    if(len - old_len + new_len >= MAX_NUMBER_OF_COLS) return;
+    row = row_write(CURRENT_ROW, len - old_len + new_len);
+    memmove(row + COMPLETE_COL + new_len, row + COMPLETE_COL + old_len, len - COMPLETE_COL - old_len + 1);
+    memcpy(row + COMPLETE_COL, word, new_len);
+    strcpy(COMPLETE_WORD, word);
+    CURRENT_COL = COMPLETE_COL + new_len;
+    COMPLETE_BUFFER = ACTIVE_BUFFER;
+    COMPLETE_ROW = CURRENT_ROW;
+    COMPLETE_CHANGES = BUFFER_CHANGES;
+}
+
+/*
+------------------------------------
+
+- :filter <command> sends the whole buffer
+through command, run by /bin/sh, and puts what
+it prints in place of the buffer. | in the
+selection mode sends the selected rows through
+the command of the last :filter
+
+- The rows are written to the command straight
+from DISPLAY_BUFFER, FILTER_PIECES of them a
+writev, while poll reads what it prints at the
+same time, so neither side waits on the other
+however much text there is. The output is cut
+into rows as it comes, and they take the place
+of the old rows at once, as one undo group
+
+- A command which fails leaves the rows as they
+were, and the status bar shows its exit status
+and the start of what it wrote to stderr
+
+------------------------------------
+*/
+#define FILTER_PIECES         1024
+#define FILTER_POLL_MS        100
+
+char FILTER_COMMAND[MAX_NUMBER_OF_COLS] = "";
+
+extern char** environ;
+
+// The rows still to be written, offset counts into row and its '\n'
+struct FilterInput {
+    u_int32_t row;
+    u_int32_t last;
+    size_t    offset;
+    bool      newline_last;
+};
+
+// The rows printed so far, partial is the row still going on, and
+// full is set once more than room rows were printed
+struct FilterOutput {
+    char**    rows;
+    u_int32_t count;
+    u_int32_t capacity;
+    u_int32_t room;
+    bool      full;
+    char      partial[MAX_NUMBER_OF_COLS];
+    size_t    partial_len;
+    bool      ends_newline;
+};
+
+size_t filter_row_len(struct FilterInput* input, u_int32_t row) {
+    return strlen(DISPLAY_BUFFER[row]) + (row < input->last || input->newline_last);
+}
+
+// Write as much as fd takes, false once every row is written or the
+// command stopped reading
+bool filter_give(int fd, struct FilterInput* input) {
+    struct iovec pieces[FILTER_PIECES];
+    size_t count = 0, offset = input->offset;
+    for(u_int32_t row = input->row; row <= input->last && count + 2 <= FILTER_PIECES; row++) {
+        size_t len = strlen(DISPLAY_BUFFER[row]);
+        if(offset < len) pieces[count++] = (struct iovec){ DISPLAY_BUFFER[row] + offset, len - offset };
+        if(row < input->last || input->newline_last) pieces[count++] = (struct iovec){ (char*)"\n", 1 };
+        offset = 0;
+    }
+    ssize_t wrote = count? writev(fd, pieces, count): 0;
+    if(wrote < 0) return errno == EAGAIN || errno == EINTR;
+    while(input->row <= input->last) {
+        size_t left = filter_row_len(input, input->row) - input->offset;
+        if((size_t)wrote < left) {
+            input->offset += wrote;
+            break;
         }
+        wrote -= left;
+        input->row++;
+        input->offset = 0;
     }
+    return input->row <= input->last;
+}
 
-    if(fsync(fd) == -1 || close(fd) == -1) {
-        perror("save");
-        unlink(temporary);
+void filter_row_add(struct FilterOutput* output, const char* text, size_t len) {
+    if(output->count == output->room) {
+        output->full = true;
         return;
     }
-    if(rename(temporary, filename) == -1) {
-        perror("rename");
-        unlink(temporary);
-        return;
+    if(output->count == output->capacity) {
+        output->capacity = output->capacity? output->capacity * 2: 1024;
+        output->rows = must_realloc(output->rows, (size_t)output->capacity * sizeof(char*));
     }
+    char* row = output->rows[output->count++] = row_alloc(len);
+    memcpy(row, text, len);
+    row[len] = '\0';
+}
 
-    BUFFER_DIRTY = false;
-
-    if (called_through_shortcut) {
-        IGN_FILE = SAVE_FILE = EXIT_FLAG = false;
-    } else {
-        IGN_FILE = false;
-        SAVE_FILE = true;
-        EXIT_FLAG = true;
+// Rows are cut from bytes like buffer_load cuts them from a file, the
+// end of bytes waits in partial for the rest of its row
+void filter_take(struct FilterOutput* output, const char* bytes, size_t len) {
+    const char* at = bytes;
+    while(at < bytes + len && !output->full) {
+        size_t room = MAX_NUMBER_OF_COLS - 1 - output->partial_len;
+        size_t most = (size_t)(bytes + len - at) < room? (size_t)(bytes + len - at): room;
+        const char* newline = memchr(at, '\n', most);
+        size_t take = newline? (size_t)(newline - at): most;
+        if(!newline && take < room) {
+            memcpy(output->partial + output->partial_len, at, take);
+            output->partial_len += take;
+            break;
+        }
+        if(output->partial_len) {
+            memcpy(output->partial + output->partial_len, at, take);
+            filter_row_add(output, output->partial, output->partial_len + take);
+            output->partial_len = 0;
+        } else {
+            filter_row_add(output, at, take);
+        }
+        output->ends_newline = newline != NULL;
+        at += take + (newline != NULL);
     }
-
-    check_EXIT((char*)filename, called_through_shortcut); // type checker : discard const qualifier
 }
 
-// A line containing =<filename> chooses a filename. Ctrl+N remains
-// the only shortcut which writes the buffer.
-bool checkpoint() {
-    char* command = DISPLAY_BUFFER[NUMBER_OF_ROWS];
-    if(command[0] != '=') return false;
-
-    char filename[PATHMAX];
-    size_t len = strcspn(command + 1, " \t");
-    if(len == 0 || len >= sizeof(filename)) {
-        fprintf(stderr, "Can not save: invalid filename\n");
-        return false;
+// Send rows first...last through FILTER_COMMAND, and put what it prints
+// in their place
+void filter_rows(u_int32_t first, u_int32_t last) {
+    buffer_load_all(ACTIVE_BUFFER);
+    bool whole = first == 0 && last == NUMBER_OF_ROWS;
+    int input[2] = { -1, -1 }, output[2] = { -1, -1 }, errors[2] = { -1, -1 };
+    pid_t child = -1;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    sigset_t pipe_signal;
+    // Every fd of light is O_CLOEXEC, so the command only gets the pipes
+    if(pipe2(input, O_CLOEXEC) == -1 || pipe2(output, O_CLOEXEC) == -1 || pipe2(errors, O_CLOEXEC) == -1) {
+        snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "filter: %s", strerror(errno));
+    } else {
+        // SIGPIPE is ignored by light, not by the command, which gets a
+        // process group of its own to be stopped with everything it starts
+        sigemptyset(&pipe_signal);
+        sigaddset(&pipe_signal, SIGPIPE);
+        posix_spawnattr_init(&attributes);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setsigdefault(&attributes, &pipe_signal);
+        posix_spawnattr_setpgroup(&attributes, 0);
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, errors[1], STDERR_FILENO);
+        char* argv[] = { "sh", "-c", FILTER_COMMAND, NULL };
+        int failed = posix_spawn(&child, "/bin/sh", &actions, &attributes, argv, environ);
+        if(failed) snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "filter: %s", strerror(failed));
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        if(failed) child = -1;
+    }
+    if(input[0] != -1) close(input[0]);
+    if(output[1] != -1) close(output[1]);
+    if(errors[1] != -1) close(errors[1]);
+    if(child == -1) {
+        if(input[1] != -1) close(input[1]);
+        if(output[0] != -1) close(output[0]);
+        if(errors[0] != -1) close(errors[0]);
+        return;
     }
 
-    memcpy(filename, command + 1, len);
-    filename[len] = '\0';
-
-    memset(DISPLAY_BUFFER[NUMBER_OF_ROWS], 0, MAX_NUMBER_OF_COLS);
-    if(NUMBER_OF_ROWS > 0) {
-        NUMBER_OF_ROWS--;
-        BUFFER_ENDS_NEWLINE = true;
+    struct FilterInput give = { first, last, 0, !whole || BUFFER_ENDS_NEWLINE };
+    struct FilterOutput* take = must_realloc(NULL, sizeof(struct FilterOutput));
+    memset(take, 0, sizeof(struct FilterOutput));
+    take->room = MAX_NUMBER_OF_ROWS - 1 - NUMBER_OF_ROWS + (last - first + 1);
+    char chunk[0x10000], message[96] = "";
+    size_t message_len = 0;
+    bool interrupted = false;
+    struct pollfd polls[3] = { { input[1], POLLOUT, 0 }, { output[0], POLLIN, 0 }, { errors[0], POLLIN, 0 } };
+    for(size_t i = 0; i < 3; i++) fcntl(polls[i].fd, F_SETFL, O_NONBLOCK);
+    while(polls[1].fd != -1 || polls[2].fd != -1) {
+        interrupted = key_queue_take_interrupt();
+        if(interrupted || take->full) {
+            kill(-child, SIGKILL);
+            break;
+        }
+        int ready = poll(polls, 3, FILTER_POLL_MS);
+        if(ready == -1 && errno != EINTR) break;
+        if(ready <= 0) continue;
+        if(polls[0].revents && !filter_give(polls[0].fd, &give)) {
+            close(polls[0].fd);
+            polls[0].fd = -1;
+        }
+        for(size_t i = 1; i < 3; i++) {
+            if(!polls[i].revents) continue;
+            ssize_t got = read(polls[i].fd, chunk, sizeof(chunk));
+            if(got > 0 && i == 1) {
+                filter_take(take, chunk, got);
+            } else if(got > 0) {
+                size_t keep = (size_t)got < sizeof(message) - 1 - message_len? (size_t)got: sizeof(message) - 1 - message_len;
+                memcpy(message + message_len, chunk, keep);
+                message_len += keep;
+            } else if(got == 0 || errno != EAGAIN) {
+                close(polls[i].fd);
+                polls[i].fd = -1;
+            }
+        }
+    }
+    for(size_t i = 0; i < 3; i++) if(polls[i].fd != -1) close(polls[i].fd);
+    int status = 0;
+    while(waitpid(child, &status, 0) == -1 && errno == EINTR);
+    if(take->partial_len && !take->full) {
+        filter_row_add(take, take->partial, take->partial_len);
+        take->ends_newline = false;
+    }
+    if(whole && take->count == 0) filter_row_add(take, "", 0);
+
+    message[strcspn(message, "\n")] = '\0';
+    if(interrupted || take->full) {
+        if(interrupted) snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "filter: stopped");
+        else snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "filter: stopped after %u rows", take->room);
+        for(u_int32_t i = 0; i < take->count; i++) row_free(take->rows[i]);
+    } else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "filter: exit %d: %s",
+                 WIFEXITED(status)? WEXITSTATUS(status): 128 + WTERMSIG(status), message);
+        for(u_int32_t i = 0; i < take->count; i++) row_free(take->rows[i]);
     } else {
-        BUFFER_ENDS_NEWLINE = false;
+        u_int32_t old_rows = last - first + 1, new_rows = take->count;
+        remember_for_undo();
+        words_uncount(ACTIVE_BUFFER, first, old_rows);
+        undo_record(first, old_rows, new_rows, DISPLAY_BUFFER + first);
+        rows_reserve(ACTIVE_BUFFER, NUMBER_OF_ROWS + 1 - old_rows + new_rows);
+        memmove(DISPLAY_BUFFER + first + new_rows, DISPLAY_BUFFER + last + 1,
+                (size_t)(NUMBER_OF_ROWS - last) * sizeof(char*));
+        memcpy(DISPLAY_BUFFER + first, take->rows, (size_t)new_rows * sizeof(char*));
+        NUMBER_OF_ROWS = NUMBER_OF_ROWS + new_rows - old_rows;
+        buffer_rows_replaced(first, old_rows, new_rows);
+        if(whole) BUFFER_ENDS_NEWLINE = take->ends_newline;
+        CURRENT_ROW = first <= NUMBER_OF_ROWS? first: NUMBER_OF_ROWS;
+        CURRENT_COL = 0;
+        BUFFER_DIRTY = true;
     }
-    strcpy(INIT_ARG_FNAME, filename);
-    detect_language(INIT_ARG_FNAME);
-    INIT_FILE = true;
-    BUFFER_DIRTY = true;
-    CURRENT_ROW = NUMBER_OF_ROWS;
-    CURRENT_COL = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
-    return true;
+    free(take->rows);
+    free(take);
 }
 
 // :<row-number> is a transient command: Enter removes it, then jumps.
@@ -689,6 +5508,7 @@ bool shortcut_goto_typed_line() {
     }
 
     unsigned long target = strtoul(command + 1, NULL, 10);
+    if(target > NUMBER_OF_ROWS) buffer_load_all(ACTIVE_BUFFER);
     if(target > NUMBER_OF_ROWS) return false;
 
     shortcut_delete_curr_line('D');
@@ -698,6 +5518,65 @@ bool shortcut_goto_typed_line() {
     return true;
 }
 
+// :wrap, :e <file>, :b <n>, :split, :vsplit, :close, :find <text>,
+// :grep <text>, :cursors <text>, :macro <n> and :filter <command> are
+// transient too, Enter removes them. :wrap toggles SOFT_WRAP, :e opens
+// a file in another buffer, or switches to it if it is open already,
+// and :b switches to buffer n. :split and :vsplit show the buffer in a
+// second view below or beside this one, and :close closes this view.
+// :find moves to the next text after the cursor, :grep finds text in
+// the files below the current directory, :cursors puts a cursor at
+// every text of the buffer, :macro plays the recorded keys n times,
+// and :filter sends the buffer through command.
+bool shortcut_typed_command() {
+    char command[MAX_NUMBER_OF_COLS];
+    strcpy(command, DISPLAY_BUFFER[CURRENT_ROW]);
+    bool wrap = strcmp(command, ":wrap") == 0;
+    bool edit = strncmp(command, ":e ", 3) == 0 && command[3] != '\0';
+    bool pick = strncmp(command, ":b ", 3) == 0 && command[3] >= '1' && command[3] <= '9';
+    bool split = strcmp(command, ":split") == 0 || strcmp(command, ":vsplit") == 0;
+    bool close = strcmp(command, ":close") == 0;
+    bool find = strncmp(command, ":find ", 6) == 0 && command[6] != '\0';
+    bool grep = strncmp(command, ":grep ", 6) == 0 && command[6] != '\0';
+    bool cursors = strncmp(command, ":cursors ", 9) == 0 && command[9] != '\0';
+    bool macro = strncmp(command, ":macro ", 7) == 0 && command[7] >= '1' && command[7] <= '9';
+    bool filter = strncmp(command, ":filter ", 8) == 0 && command[8] != '\0';
+    if(!wrap && !edit && !pick && !split && !close && !find && !grep && !cursors && !macro && !filter) return false;
+
+    shortcut_delete_curr_line('D');
+    BUFFER_DIRTY = true;
+    if(wrap) {
+        SOFT_WRAP = !SOFT_WRAP;
+        VIEW_START_WRAP = 0;
+        CURRENT_VIEW_COL = 0;
+        view_layout();
+    } else if(split) {
+        view_split(command[1] == 'v');
+    } else if(close) {
+        view_close();
+    } else if(find) {
+        strcpy(FIND_TEXT, command + 6);
+        find_next(CURRENT_ROW, 0);
+    } else if(grep) {
+        grep_start(command + 6);
+    } else if(cursors) {
+        if(!multi_from_text(command + 9)) snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "no %.64s", command + 9);
+    } else if(macro) {
+        macro_play(strtoul(command + 7, NULL, 10));
+    } else if(filter) {
+        strcpy(FILTER_COMMAND, command + 8);
+        filter_rows(0, NUMBER_OF_ROWS);
+    } else if(edit) {
+        struct Buffer* open = buffer_find(command + 3);
+        if(open) view_show(open);
+        else buffer_open(command + 3);
+    } else {
+        unsigned long target = strtoul(command + 3, NULL, 10);
+        if(target <= BUFFER_COUNT) view_show(BUFFERS[target - 1]);
+    }
+    return true;
+}
+
 // Check for overflow and underflow in CURRENT_ROW 
 void normalize_ROW() {
     if(CURRENT_ROW > NUMBER_OF_ROWS) {
@@ -724,83 +5603,117 @@ void normalize_COL() {
     return;
 }
 
+void clipboard_free(struct Clipboard* clipboard) {
+    for(size_t i = 0; i < clipboard->count; i++) row_unpin(clipboard->pieces[i].row);
+    free(clipboard->pieces);
+    free(clipboard);
+}
+
+// clipboard becomes TEXT_CLIPBOARD, and goes to the terminal after the
+// next frame. The one it replaces is freed once render_output is not
+// writing it any more.
+void clipboard_set(struct Clipboard* clipboard) {
+    struct Clipboard* old = TEXT_CLIPBOARD;
+    pthread_mutex_lock(&frame_lock);
+    if(CLIPBOARD_RETIRED && CLIPBOARD_RETIRED != CLIPBOARD_EXPORT) {
+        clipboard_free(CLIPBOARD_RETIRED);
+        CLIPBOARD_RETIRED = NULL;
+    }
+    if(old && old == CLIPBOARD_EXPORT) {
+        CLIPBOARD_CANCEL = true;
+        CLIPBOARD_RETIRED = old;
+        old = NULL;
+    }
+    CLIPBOARD_NEXT = clipboard;
+    pthread_mutex_unlock(&frame_lock);
+    if(old) clipboard_free(old);
+    TEXT_CLIPBOARD = clipboard;
+}
+
+// The selection is kept as pieces of its rows, so copying even most
+// of a large file costs one piece for every row, and no text
 void copy_selection_to_terminal() {
     if(!SELECT_VISIBLE || selection_compare(SELECT_START_ROW, SELECT_START_COL,
        SELECT_END_ROW, SELECT_END_COL) == 0) return;
 
-    u_int16_t first_row = SELECT_START_ROW, first_col = SELECT_START_COL;
-    u_int16_t last_row = SELECT_END_ROW, last_col = SELECT_END_COL;
+    u_int32_t first_row = SELECT_START_ROW, last_row = SELECT_END_ROW;
+    u_int16_t first_col = SELECT_START_COL, last_col = SELECT_END_COL;
     if(selection_compare(first_row, first_col, last_row, last_col) > 0) {
         first_row = SELECT_END_ROW; first_col = SELECT_END_COL;
         last_row = SELECT_START_ROW; last_col = SELECT_START_COL;
     }
 
-    size_t capacity = 1;
-    for(u_int16_t row = first_row; row <= last_row; row++) {
-        capacity += strlen(DISPLAY_BUFFER[row]) + 1;
-        if(row == last_row) break;
-    }
-    if(capacity > 1024 * 1024) return; // terminal clipboards dislike enormous OSC messages
-
-    char* plain = malloc(capacity);
-    if(!plain) return;
-    size_t used = 0;
-    for(u_int16_t row = first_row; row <= last_row; row++) {
-        size_t begin = row == first_row? first_col: 0;
-        size_t end = row == last_row? last_col: strlen(DISPLAY_BUFFER[row]);
+    struct Clipboard* clipboard = must_realloc(NULL, sizeof(struct Clipboard));
+    clipboard->count = (size_t)last_row - first_row + 1;
+    clipboard->pieces = must_realloc(NULL, clipboard->count * sizeof(struct ClipPiece));
+    clipboard->len = clipboard->count - 1;
+    for(u_int32_t row = first_row; row <= last_row; row++) {
         size_t row_len = strlen(DISPLAY_BUFFER[row]);
+        size_t begin = row == first_row? first_col: 0;
+        size_t end = row == last_row? last_col: row_len;
         if(begin > row_len) begin = row_len;
+        if(end < begin) end = begin;
         if(end > row_len) end = row_len;
-        if(end > begin) {
-            memcpy(plain + used, DISPLAY_BUFFER[row] + begin, end - begin);
-            used += end - begin;
-        }
-        if(row != last_row) plain[used++] = '\n';
+        row_pin(DISPLAY_BUFFER[row]);
+        clipboard->pieces[row - first_row] = (struct ClipPiece){ DISPLAY_BUFFER[row], begin, end - begin };
+        clipboard->len += end - begin;
         if(row == last_row) break;
     }
+    clipboard_set(clipboard);
+}
 
-    char* clipboard = malloc(used + 1);
-    if(!clipboard) { free(plain); return; }
-    memcpy(clipboard, plain, used);
-    clipboard[used] = '\0';
-    free(TEXT_CLIPBOARD);
-    TEXT_CLIPBOARD = clipboard;
-    TEXT_CLIPBOARD_LEN = used;
-
-    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    size_t encoded_len = ((used + 2) / 3) * 4;
-    char* encoded = malloc(encoded_len + 1);
-    if(!encoded) { free(plain); return; }
-    size_t out = 0;
-    for(size_t i = 0; i < used; i += 3) {
-        unsigned int value = (unsigned char)plain[i] << 16;
-        if(i + 1 < used) value |= (unsigned char)plain[i + 1] << 8;
-        if(i + 2 < used) value |= (unsigned char)plain[i + 2];
-        encoded[out++] = alphabet[(value >> 18) & 63];
-        encoded[out++] = alphabet[(value >> 12) & 63];
-        encoded[out++] = i + 1 < used? alphabet[(value >> 6) & 63]: '=';
-        encoded[out++] = i + 2 < used? alphabet[value & 63]: '=';
-    }
-    encoded[out] = '\0';
-    printf("\033]52;c;%s\a", encoded);
-    free(encoded);
-    free(plain);
+// The wheel scrolls view by delta rows without focusing it, its
+// cursor is kept in view
+void view_scroll(struct View* view, int delta) {
+    struct View* focused = ACTIVE_VIEW;
+    ACTIVE_VIEW = view;
+    if(SOFT_WRAP) {
+        long row = (long)CURRENT_ROW + delta;
+        CURRENT_ROW = row < 0? 0: row > NUMBER_OF_ROWS? NUMBER_OF_ROWS: row;
+    } else {
+        long start = (long)VIEW_START_ROW + delta;
+        long latest_start = (long)NUMBER_OF_ROWS - VIEW_ROWS + 1;
+        if(start > latest_start) start = latest_start;
+        if(start < 0) start = 0;
+        VIEW_START_ROW = start;
+        if(CURRENT_ROW < start) CURRENT_ROW = start;
+        if(CURRENT_ROW >= start + VIEW_ROWS) CURRENT_ROW = start + VIEW_ROWS - 1;
+        normalize_ROW();
+    }
+    normalize_COL();
+    ACTIVE_VIEW = focused;
 }
 
+// A click into another view moves the keys there, the wheel
+// (buttons 64 and 65) scrolls the view under the pointer
 void shortcut_mouse(struct Key key) {
-    if(key.mouse_y < 1 || key.mouse_y >= TERM_ROW) return;
-    unsigned int row = VIEW_START_ROW + key.mouse_y - 1;
+    struct View* view = view_at(key.mouse_x, key.mouse_y);
+    if(view && key.mouse_pressed && (key.mouse_button & 64)) {
+        view_scroll(view, (key.mouse_button & 1)? 3: -3);
+        return;
+    }
+    if(!view || !key.mouse_pressed || (key.mouse_button & 32) || (key.mouse_button & 3) != 0) return;
+    if(view != ACTIVE_VIEW) view_focus(view);
+    if(SELECT_VISIBLE) buffer_damage(ACTIVE_BUFFER, 0, MAX_NUMBER_OF_ROWS);
+    int y = key.mouse_y - VIEW_TOP + 1;
+    int x = key.mouse_x - VIEW_LEFT + 1;
+
+    unsigned int row = VIEW_START_ROW + y - 1;
+    unsigned int col = x > LINE_GUTTER? x - LINE_GUTTER - 1: 0;
+    if(SOFT_WRAP) {
+        u_int32_t before;
+        u_int32_t screen = wrap_rows_before(VIEW_START_ROW) + VIEW_START_WRAP + y - 1;
+        row = wrap_find_row(screen, &before);
+        col += (screen - before) * wrap_width();
+    }
     if(row > NUMBER_OF_ROWS) row = NUMBER_OF_ROWS;
-    unsigned int col = key.mouse_x > LINE_GUTTER? key.mouse_x - LINE_GUTTER - 1: 0;
     if(row == CURRENT_ROW) col += CURRENT_VIEW_COL;
     size_t row_len = strlen(DISPLAY_BUFFER[row]);
     if(col > row_len) col = row_len;
 
-    if(key.mouse_pressed && !(key.mouse_button & 32) && (key.mouse_button & 3) == 0) {
-        CURRENT_ROW = row;
-        CURRENT_COL = col;
-        SELECT_VISIBLE = SELECT_ACTIVE = false;
-    }
+    CURRENT_ROW = row;
+    CURRENT_COL = col;
+    SELECT_VISIBLE = SELECT_ACTIVE = false;
 }
 
 void shortcut_select(char ch) {
@@ -830,8 +5743,8 @@ void shortcut_copy(char ch) {
 
 void delete_selected_text() {
     if(!SELECT_VISIBLE) return;
-    u_int16_t first_row = SELECT_START_ROW, first_col = SELECT_START_COL;
-    u_int16_t last_row = SELECT_END_ROW, last_col = SELECT_END_COL;
+    u_int32_t first_row = SELECT_START_ROW, last_row = SELECT_END_ROW;
+    u_int16_t first_col = SELECT_START_COL, last_col = SELECT_END_COL;
     if(selection_compare(first_row, first_col, last_row, last_col) > 0) {
         first_row = SELECT_END_ROW; first_col = SELECT_END_COL;
         last_row = SELECT_START_ROW; last_col = SELECT_START_COL;
@@ -839,103 +5752,351 @@ void delete_selected_text() {
     if(selection_compare(first_row, first_col, last_row, last_col) == 0) return;
 
     if(first_row == last_row) {
-        memmove(DISPLAY_BUFFER[first_row] + first_col,
-                DISPLAY_BUFFER[first_row] + last_col,
-                strlen(DISPLAY_BUFFER[first_row] + last_col) + 1);
+        char* row = row_write(first_row, 0);
+        memmove(row + first_col, row + last_col, strlen(row + last_col) + 1);
     } else {
         size_t prefix = first_col;
         size_t suffix = strlen(DISPLAY_BUFFER[last_row] + last_col);
         if(prefix + suffix < MAX_NUMBER_OF_COLS) {
-            memcpy(DISPLAY_BUFFER[first_row] + prefix,
+            memcpy(row_write(first_row, prefix + suffix) + prefix,
                    DISPLAY_BUFFER[last_row] + last_col, suffix + 1);
-        } else DISPLAY_BUFFER[first_row][prefix] = '\0';
+        } else row_write(first_row, 0)[prefix] = '\0';
+
+        rows_delete(first_row + 1, last_row - first_row);
+    }
+    CURRENT_ROW = first_row;
+    CURRENT_COL = first_col;
+    SELECT_VISIBLE = SELECT_ACTIVE = false;
+}
+
+// Every row the clipboard adds is inserted at once, and every piece
+// is written into its row with one copy
+void shortcut_paste_text(char ch) {
+    if(ch != 'V' || !TEXT_CLIPBOARD || TEXT_CLIPBOARD->len == 0) return;
+    delete_selected_text();
+
+    size_t added = TEXT_CLIPBOARD->count - 1;
+    if(added > MAX_NUMBER_OF_ROWS - 1 - NUMBER_OF_ROWS) added = MAX_NUMBER_OF_ROWS - 1 - NUMBER_OF_ROWS;
+    char tail[MAX_NUMBER_OF_COLS];
+    size_t tail_len = strlen(DISPLAY_BUFFER[CURRENT_ROW] + CURRENT_COL);
+    memcpy(tail, DISPLAY_BUFFER[CURRENT_ROW] + CURRENT_COL, tail_len + 1);
+    row_write(CURRENT_ROW, 0)[CURRENT_COL] = '\0';
+    if(added) rows_insert(CURRENT_ROW + 1, added);
+
+    for(size_t i = 0; i <= added; i++) {
+        struct ClipPiece* piece = &TEXT_CLIPBOARD->pieces[i];
+        size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+        size_t after = i == added? tail_len: 0;
+        size_t room = MAX_NUMBER_OF_COLS - 1 - len - after;
+        size_t text = piece->len < room? piece->len: room;
+        char* row = row_write(CURRENT_ROW, len + text + after);
+        memcpy(row + len, piece->row + piece->begin, text);
+        memcpy(row + len + text, tail, after);
+        row[len + text + after] = '\0';
+        CURRENT_COL = len + text;
+        if(i < added) CURRENT_ROW++;
+    }
+    BUFFER_DIRTY = true;
+}
+
+// One honest undo is more useful than a complicated history that lies.
+// Only the rows an edit touches are kept, see row_write.
+void remember_for_undo() {
+    if(MACRO_PLAYING) return;
+    history_drop(ACTIVE_BUFFER);
+    undo_forget(&UNDO_STATE);
+    UNDO_STATE.group = ++UNDO_GROUPS;
+    UNDO_STATE.row = CURRENT_ROW;
+    UNDO_STATE.col = CURRENT_COL;
+    UNDO_STATE.ends_newline = BUFFER_ENDS_NEWLINE;
+    UNDO_STATE.undone = false;
+    UNDO_STATE.valid = true;
+}
+
+// Undo replays the edits backwards, pressing it again replays them forwards
+void shortcut_undo(char ch) {
+    if(ch != 'Z') return;
+    if(!UNDO_STATE.valid) history_restore(ACTIVE_BUFFER);
+    if(!UNDO_STATE.valid) return;
+
+    for(size_t i = 0; i < UNDO_STATE.count; i++) {
+        undo_replay(&UNDO_STATE.ops[UNDO_STATE.undone? i: UNDO_STATE.count - 1 - i]);
+    }
+    UNDO_STATE.undone = !UNDO_STATE.undone;
+
+    u_int32_t old_row = CURRENT_ROW;
+    CURRENT_ROW = UNDO_STATE.row;
+    UNDO_STATE.row = old_row;
+    u_int16_t old_col = CURRENT_COL;
+    CURRENT_COL = UNDO_STATE.col;
+    UNDO_STATE.col = old_col;
+    bool old_ending = BUFFER_ENDS_NEWLINE;
+    BUFFER_ENDS_NEWLINE = UNDO_STATE.ends_newline;
+    UNDO_STATE.ends_newline = old_ending;
+    BUFFER_DIRTY = true;
+}
+
+// Reload ACTIVE_BUFFER from its file after another program wrote it.
+// Rows which are the same as the lines at the start and at the end of
+// the file are kept as they are, only the rows between are replaced,
+// so the cursor and the views keep their place and only the changed
+// part is repainted. The last edit stays undoable when it was above
+// the replaced rows, otherwise the reload becomes the edit Ctrl+Z undoes.
+void buffer_reload() {
+    history_restore(ACTIVE_BUFFER);
+    buffer_load_all(ACTIVE_BUFFER);
+    int fd = open(INIT_ARG_FNAME, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd == -1 || fstat(fd, &info) == -1) {
+        if(fd != -1) close(fd);
+        return;
+    }
+    char* text = info.st_size? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0): NULL;
+    close(fd);
+    if(text == MAP_FAILED) return;
+
+    // Split the file the way buffer_open does, a line is cut after
+    // MAX_NUMBER_OF_COLS - 1 characters
+    struct { size_t start; u_int16_t len; }* lines = NULL;
+    u_int32_t count = 0, capacity = 0;
+    bool ends_newline = false;
+    for(size_t at = 0; at < (size_t)info.st_size && count < MAX_NUMBER_OF_ROWS;) {
+        size_t take = info.st_size - at < MAX_NUMBER_OF_COLS - 1? info.st_size - at: MAX_NUMBER_OF_COLS - 1;
+        char* newline = memchr(text + at, '\n', take);
+        size_t len = newline? (size_t)(newline - text - at): take;
+        if(count == capacity) {
+            capacity = capacity? capacity * 2: 1024;
+            lines = must_realloc(lines, (size_t)capacity * sizeof(*lines));
+        }
+        lines[count].start = at;
+        lines[count++].len = len;
+        ends_newline = newline != NULL;
+        at += len + ends_newline;
+    }
+    if(count == 0) {
+        lines = must_realloc(lines, sizeof(*lines));
+        lines[count].start = 0;
+        lines[count++].len = 0;
+    }
+
+    #define RELOAD_SAME(row, line) (strlen(DISPLAY_BUFFER[row]) == lines[line].len && \
+        memcmp(DISPLAY_BUFFER[row], text + lines[line].start, lines[line].len) == 0)
+    u_int32_t rows = NUMBER_OF_ROWS + 1, prefix = 0, suffix = 0;
+    while(prefix < rows && prefix < count && RELOAD_SAME(prefix, prefix)) prefix++;
+    while(suffix < rows - prefix && suffix < count - prefix &&
+          RELOAD_SAME(rows - 1 - suffix, count - 1 - suffix)) suffix++;
+    #undef RELOAD_SAME
+    u_int32_t old_rows = rows - prefix - suffix, new_rows = count - prefix - suffix;
+
+    // Every edit of the last group, moved by every row it inserted,
+    // must end above the replaced rows to still be replayed correctly
+    bool keep_undo = UNDO_STATE.valid && BUFFER_ENDS_NEWLINE == ends_newline;
+    u_int32_t touched = 0, grown = 0;
+    for(size_t i = 0; i < UNDO_STATE.count; i++) {
+        struct EditOp* op = &UNDO_STATE.ops[i];
+        u_int32_t end = op->row + (op->old_rows > op->new_rows? op->old_rows: op->new_rows);
+        if(end > touched) touched = end;
+        if(op->new_rows > op->old_rows) grown += op->new_rows - op->old_rows;
+    }
+    if(touched + grown > prefix) keep_undo = false;
 
-        u_int16_t removed_rows = last_row - first_row;
-        for(u_int16_t row = first_row + 1; row + removed_rows <= NUMBER_OF_ROWS; row++) {
-            memcpy(DISPLAY_BUFFER[row], DISPLAY_BUFFER[row + removed_rows], MAX_NUMBER_OF_COLS);
+    if(old_rows || new_rows) {
+        words_uncount(ACTIVE_BUFFER, prefix, old_rows);
+        if(keep_undo) {
+            for(u_int32_t i = 0; i < old_rows; i++) row_free(DISPLAY_BUFFER[prefix + i]);
+        } else {
+            remember_for_undo();
+            undo_record(prefix, old_rows, new_rows, DISPLAY_BUFFER + prefix);
+        }
+        rows_reserve(ACTIVE_BUFFER, rows - old_rows + new_rows);
+        memmove(DISPLAY_BUFFER + prefix + new_rows, DISPLAY_BUFFER + prefix + old_rows,
+                (size_t)suffix * sizeof(char*));
+        for(u_int32_t i = 0; i < new_rows; i++) {
+            size_t len = lines[prefix + i].len;
+            char* row = DISPLAY_BUFFER[prefix + i] = row_alloc(len);
+            memcpy(row, text + lines[prefix + i].start, len);
+            row[len] = '\0';
         }
-        for(u_int16_t row = NUMBER_OF_ROWS - removed_rows + 1; row <= NUMBER_OF_ROWS; row++) {
-            memset(DISPLAY_BUFFER[row], 0, MAX_NUMBER_OF_COLS);
-            if(row == NUMBER_OF_ROWS) break;
+        NUMBER_OF_ROWS = rows - old_rows + new_rows - 1;
+        buffer_rows_replaced(prefix, old_rows, new_rows);
+
+        if(CURRENT_ROW >= prefix + old_rows) CURRENT_ROW = CURRENT_ROW - old_rows + new_rows;
+        else if(CURRENT_ROW >= prefix + new_rows) CURRENT_ROW = prefix + new_rows;
+        if(VIEW_START_ROW >= prefix + old_rows) VIEW_START_ROW = VIEW_START_ROW - old_rows + new_rows;
+        normalize_ROW();
+        if(VIEW_START_ROW > CURRENT_ROW) VIEW_START_ROW = CURRENT_ROW;
+        normalize_COL();
+    }
+
+    // The rows hold the lines of the file again, except the ones which
+    // were cut, see DELTA_SAVE
+    if(DELTA_SAVE) {
+        off_t* offsets = must_realloc(NULL, ((size_t)count + 1) * sizeof(off_t));
+        for(u_int32_t i = 0; i < count; i++) offsets[i] = lines[i].start;
+        offsets[count] = info.st_size;
+        origins_take(ACTIVE_BUFFER, offsets, ends_newline, &info);
+        for(u_int32_t i = 0; i + 1 < count; i++) {
+            if(lines[i + 1].start != lines[i].start + lines[i].len + 1) ROW_HEADER(DISPLAY_BUFFER[i])->origin = 0;
         }
-        NUMBER_OF_ROWS -= removed_rows;
     }
-    CURRENT_ROW = first_row;
-    CURRENT_COL = first_col;
-    SELECT_VISIBLE = SELECT_ACTIVE = false;
+
+    BUFFER_ENDS_NEWLINE = ends_newline;
+    BUFFER_DIRTY = false;
+    ACTIVE_BUFFER->disk = info;
+    ACTIVE_BUFFER->disk_changed = false;
+    free(lines);
+    if(text) munmap(text, info.st_size);
+    plugins_event(LIGHT_EVENT_RELOAD);
+}
+
+// light_api, see light_plugin.h. It always means the buffer being
+// drawn or edited, edits are only taken from a key hook.
+const char* api_filename() {
+    return INIT_FILE? INIT_ARG_FNAME: NULL;
+}
+
+u_int32_t api_rows() {
+    return NUMBER_OF_ROWS + 1;
+}
+
+const char* api_row(u_int32_t row) {
+    return row <= NUMBER_OF_ROWS? DISPLAY_BUFFER[row]: NULL;
+}
+
+void api_cursor(u_int32_t* row, u_int16_t* col) {
+    if(row) *row = CURRENT_ROW;
+    if(col) *col = CURRENT_COL;
+}
+
+// Every edit of one key hook is in the same undo group
+bool api_edit() {
+    if(!PLUGIN_EDITS) return false;
+    if(!PLUGIN_EDITED) remember_for_undo();
+    PLUGIN_EDITED = BUFFER_DIRTY = true;
+    return true;
+}
+
+void api_set_cursor(u_int32_t row, u_int16_t col) {
+    if(!PLUGIN_EDITS) return;
+    CURRENT_ROW = row;
+    CURRENT_COL = col;
+    normalize_ROW();
+    normalize_COL();
+}
+
+void api_set_row(u_int32_t row, const char* text) {
+    if(row > NUMBER_OF_ROWS || !api_edit()) return;
+    size_t len = strnlen(text, MAX_NUMBER_OF_COLS - 1);
+    char* target = row_write(row, len);
+    memcpy(target, text, len);
+    target[len] = '\0';
+}
+
+void api_insert_rows(u_int32_t at, u_int32_t count) {
+    if(at > NUMBER_OF_ROWS + 1 || count == 0 || count > MAX_NUMBER_OF_ROWS - 1 - NUMBER_OF_ROWS) return;
+    if(api_edit()) rows_insert(at, count);
+}
+
+// One row always stays, deleting every row leaves it empty
+void api_delete_rows(u_int32_t at, u_int32_t count) {
+    if(at > NUMBER_OF_ROWS || count == 0 || !api_edit()) return;
+    if(count > NUMBER_OF_ROWS + 1 - at) count = NUMBER_OF_ROWS + 1 - at;
+    if(count > NUMBER_OF_ROWS) {
+        row_write(at, 0)[0] = '\0';
+        at++;
+        count--;
+    }
+    if(count) rows_delete(at, count);
+}
+
+void api_message(const char* text) {
+    snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "%s", text);
+}
+
+const struct light_api LIGHT_API = {
+    LIGHT_PLUGIN_ABI, api_filename, api_rows, api_row, api_cursor, api_set_cursor,
+    api_set_row, api_insert_rows, api_delete_rows, span_add, api_message
+};
+
+void plugin_load(const char* path, const char* name) {
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    const struct light_plugin* (*init)(const struct light_api*) = NULL;
+    if(handle) init = (const struct light_plugin* (*)(const struct light_api*))dlsym(handle, "light_plugin_init");
+    const struct light_plugin* hooks = init? init(&LIGHT_API): NULL;
+    if(!hooks || hooks->abi != LIGHT_PLUGIN_ABI) {
+        snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "plugin %s not loaded: %s", name,
+                 handle? "no light_plugin_init for this light": dlerror());
+        if(handle) dlclose(handle);
+        return;
+    }
+    PLUGINS = must_realloc(PLUGINS, (PLUGIN_COUNT + 1) * sizeof(struct Plugin));
+    PLUGINS[PLUGIN_COUNT++] = (struct Plugin){ hooks, 0, false };
 }
 
-void shortcut_paste_text(char ch) {
-    if(ch != 'V' || !TEXT_CLIPBOARD || TEXT_CLIPBOARD_LEN == 0) return;
-    delete_selected_text();
+// ~/.config/light/plugins/*.so are loaded in name order, one which
+// can not be loaded is named in the status bar
+void plugins_load() {
+    const char* budget = getenv("LIGHT_PLUGIN_BUDGET");
+    if(budget && atol(budget) > 0) PLUGIN_BUDGET = atol(budget) * 1000;
+    const char* home = getenv("HOME");
+    char directory[PATHMAX];
+    if(!home || snprintf(directory, sizeof(directory), "%s/.config/light/plugins", home) >= (int)sizeof(directory)) return;
+
+    struct dirent** entries;
+    int count = scandir(directory, &entries, NULL, alphasort);
+    for(int i = 0; i < count; i++) {
+        char path[PATHMAX];
+        const char* name = entries[i]->d_name;
+        size_t len = strlen(name);
+        if(len > 3 && strcmp(name + len - 3, ".so") == 0 &&
+           snprintf(path, sizeof(path), "%s/%s", directory, name) < (int)sizeof(path)) plugin_load(path, name);
+        free(entries[i]);
+    }
+    if(count > 0) free(entries);
+}
 
-    for(size_t at = 0; at < TEXT_CLIPBOARD_LEN; at++) {
-        if(TEXT_CLIPBOARD[at] == '\n') {
-            if(NUMBER_OF_ROWS >= MAX_NUMBER_OF_ROWS - 1) break;
-            for(int row = NUMBER_OF_ROWS; row > CURRENT_ROW; row--) {
-                memcpy(DISPLAY_BUFFER[row + 1], DISPLAY_BUFFER[row], MAX_NUMBER_OF_COLS);
-            }
-            char tail[MAX_NUMBER_OF_COLS];
-            strcpy(tail, DISPLAY_BUFFER[CURRENT_ROW] + CURRENT_COL);
-            DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL] = '\0';
-            strcpy(DISPLAY_BUFFER[CURRENT_ROW + 1], tail);
-            NUMBER_OF_ROWS++;
-            CURRENT_ROW++;
-            CURRENT_COL = 0;
-        } else {
-            size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
-            if(len + 1 >= MAX_NUMBER_OF_COLS) continue;
-            memmove(DISPLAY_BUFFER[CURRENT_ROW] + CURRENT_COL + 1,
-                    DISPLAY_BUFFER[CURRENT_ROW] + CURRENT_COL,
-                    len - CURRENT_COL + 1);
-            DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL++] = TEXT_CLIPBOARD[at];
-        }
+// Typed characters go to the key hooks first, the first hook which
+// uses one keeps it from light
+bool plugins_key(struct Key key) {
+    if(key.type != KEY_CHAR && key.type != KEY_CTRL) return false;
+    bool used = false;
+    PLUGIN_EDITS = true;
+    PLUGIN_EDITED = false;
+    for(size_t i = 0; i < PLUGIN_COUNT && !used; i++) {
+        struct Plugin* plugin = &PLUGINS[i];
+        if(plugin->disabled || !plugin->hooks->key) continue;
+        long begin = plugin_clock();
+        used = plugin->hooks->key(key.type == KEY_CTRL, key.ch) != 0;
+        plugin->cost += plugin_clock() - begin;
     }
-    BUFFER_DIRTY = true;
+    PLUGIN_EDITS = false;
+    normalize_ROW();
+    normalize_COL();
+    return used;
 }
 
-// One honest undo is more useful than a complicated history that lies.
-// The snapshot only contains rows currently in use.
-void remember_for_undo() {
-    size_t bytes = ((size_t)NUMBER_OF_ROWS + 1) * MAX_NUMBER_OF_COLS;
-    char* snapshot = malloc(bytes);
-    if(!snapshot) return;
-    memcpy(snapshot, DISPLAY_BUFFER, bytes);
-    free(UNDO_STATE.buffer);
-    UNDO_STATE.buffer = snapshot;
-    UNDO_STATE.rows = NUMBER_OF_ROWS;
-    UNDO_STATE.row = CURRENT_ROW;
-    UNDO_STATE.col = CURRENT_COL;
-    UNDO_STATE.ends_newline = BUFFER_ENDS_NEWLINE;
-    UNDO_STATE.valid = true;
+void plugins_event(enum light_event event) {
+    for(size_t i = 0; i < PLUGIN_COUNT; i++) {
+        struct Plugin* plugin = &PLUGINS[i];
+        if(plugin->disabled || !plugin->hooks->event) continue;
+        long begin = plugin_clock();
+        plugin->hooks->event(event);
+        plugin->cost += plugin_clock() - begin;
+    }
 }
 
-void shortcut_undo(char ch) {
-    if(ch != 'Z' || !UNDO_STATE.valid) return;
-
-    size_t current_bytes = ((size_t)NUMBER_OF_ROWS + 1) * MAX_NUMBER_OF_COLS;
-    size_t undo_bytes = ((size_t)UNDO_STATE.rows + 1) * MAX_NUMBER_OF_COLS;
-    char* redo = malloc(current_bytes);
-    if(!redo) return;
-    memcpy(redo, DISPLAY_BUFFER, current_bytes);
-    memset(DISPLAY_BUFFER, 0, current_bytes > undo_bytes? current_bytes: undo_bytes);
-    memcpy(DISPLAY_BUFFER, UNDO_STATE.buffer, undo_bytes);
-
-    free(UNDO_STATE.buffer);
-    UNDO_STATE.buffer = redo;
-    u_int16_t old_rows = NUMBER_OF_ROWS;
-    NUMBER_OF_ROWS = UNDO_STATE.rows;
-    UNDO_STATE.rows = old_rows;
-    u_int16_t old_row = CURRENT_ROW;
-    CURRENT_ROW = UNDO_STATE.row;
-    UNDO_STATE.row = old_row;
-    u_int16_t old_col = CURRENT_COL;
-    CURRENT_COL = UNDO_STATE.col;
-    UNDO_STATE.col = old_col;
-    bool old_ending = BUFFER_ENDS_NEWLINE;
-    BUFFER_ENDS_NEWLINE = UNDO_STATE.ends_newline;
-    UNDO_STATE.ends_newline = old_ending;
-    BUFFER_DIRTY = true;
+// Once a frame: a plugin which took more than PLUGIN_BUDGET since the
+// last one is disabled, so one slow plugin can not make light slow
+void plugins_check_costs() {
+    for(size_t i = 0; i < PLUGIN_COUNT; i++) {
+        struct Plugin* plugin = &PLUGINS[i];
+        if(!plugin->disabled && plugin->cost > PLUGIN_BUDGET) {
+            plugin->disabled = true;
+            snprintf(STATUS_MESSAGE, sizeof(STATUS_MESSAGE), "plugin %s disabled: took %ld us, the budget is %ld us",
+                     plugin->hooks->name? plugin->hooks->name: "?", plugin->cost / 1000, PLUGIN_BUDGET / 1000);
+        }
+        plugin->cost = 0;
+    }
 }
 
 // This is a shortcut to get a newline above your current line
@@ -943,13 +6104,7 @@ void shortcut_undo(char ch) {
 void shortcut_newline_above(char ch) {
     if (ch == 'O') {
         if (NUMBER_OF_ROWS < MAX_NUMBER_OF_ROWS - 1) {
-            for (int i = NUMBER_OF_ROWS; i >= CURRENT_ROW; i--) {
-                strncpy(DISPLAY_BUFFER[i + 1], DISPLAY_BUFFER[i], MAX_NUMBER_OF_COLS);
-            }
-
-            memset(DISPLAY_BUFFER[CURRENT_ROW], 0, MAX_NUMBER_OF_COLS);
-
-            NUMBER_OF_ROWS++; 
+            rows_insert(CURRENT_ROW, 1);
             CURRENT_COL = 0;
         }
     }
@@ -974,7 +6129,7 @@ void shortcut_newline_below(char ch) {
 // with Ctrl + X
 void shortcut_clear_curr_line(char ch) {
     if(ch == 'X') {
-        memset(DISPLAY_BUFFER[CURRENT_ROW], 0, MAX_NUMBER_OF_COLS);
+        row_write(CURRENT_ROW, 0)[0] = '\0';
         CURRENT_COL = 0;
     }
 
@@ -987,18 +6142,12 @@ void shortcut_clear_curr_line(char ch) {
 void shortcut_delete_curr_line(char ch) {
     if(ch == 'D') {
         if (NUMBER_OF_ROWS == 0) {
-            memset(DISPLAY_BUFFER[0], 0, MAX_NUMBER_OF_COLS);
+            row_write(0, 0)[0] = '\0';
             CURRENT_COL = 0;
             return;
         }
 
-        for (int i = CURRENT_ROW; i < NUMBER_OF_ROWS; i++) {
-            memmove(DISPLAY_BUFFER[i], DISPLAY_BUFFER[i+1], MAX_NUMBER_OF_COLS);
-        }
-
-        memset(DISPLAY_BUFFER[NUMBER_OF_ROWS], 0, MAX_NUMBER_OF_COLS);
-
-        NUMBER_OF_ROWS--;
+        rows_delete(CURRENT_ROW, 1);
         if(CURRENT_ROW > NUMBER_OF_ROWS) CURRENT_ROW = NUMBER_OF_ROWS;
         normalize_COL();
     }
@@ -1032,9 +6181,9 @@ void shortcut_add_tab(char ch) {
     if(ch == 'T') {
         size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
         if(len + TABSPACE >= MAX_NUMBER_OF_COLS) return;
-        memmove(DISPLAY_BUFFER[CURRENT_ROW] + TABSPACE,
-                DISPLAY_BUFFER[CURRENT_ROW], len + 1);
-        memset(DISPLAY_BUFFER[CURRENT_ROW], ' ', TABSPACE);
+        char* row = row_write(CURRENT_ROW, len + TABSPACE);
+        memmove(row + TABSPACE, row, len + 1);
+        memset(row, ' ', TABSPACE);
         CURRENT_COL += TABSPACE;
     }
 
@@ -1047,19 +6196,17 @@ void shortcut_remove_tab(char ch) {
     size_t remove = 0;
     while(remove < TABSPACE && DISPLAY_BUFFER[CURRENT_ROW][remove] == ' ') remove++;
     if(remove == 0) return;
-    memmove(DISPLAY_BUFFER[CURRENT_ROW], DISPLAY_BUFFER[CURRENT_ROW] + remove,
-            strlen(DISPLAY_BUFFER[CURRENT_ROW] + remove) + 1);
+    char* row = row_write(CURRENT_ROW, 0);
+    memmove(row, row + remove, strlen(row + remove) + 1);
     CURRENT_COL = CURRENT_COL > remove? CURRENT_COL - remove: 0;
 }
 
 // Ctrl + G duplicates the current line below it.
 void shortcut_duplicate_line(char ch) {
     if(ch != 'G' || NUMBER_OF_ROWS >= MAX_NUMBER_OF_ROWS - 1) return;
-    for(int i = NUMBER_OF_ROWS; i > CURRENT_ROW; i--) {
-        memcpy(DISPLAY_BUFFER[i + 1], DISPLAY_BUFFER[i], MAX_NUMBER_OF_COLS);
-    }
-    memcpy(DISPLAY_BUFFER[CURRENT_ROW + 1], DISPLAY_BUFFER[CURRENT_ROW], MAX_NUMBER_OF_COLS);
-    NUMBER_OF_ROWS++;
+    rows_insert(CURRENT_ROW + 1, 1);
+    size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+    memcpy(row_write(CURRENT_ROW + 1, len), DISPLAY_BUFFER[CURRENT_ROW], len + 1);
     CURRENT_ROW++;
     normalize_COL();
 }
@@ -1067,23 +6214,20 @@ void shortcut_duplicate_line(char ch) {
 // Ctrl + K cuts a line, Ctrl + Y pastes it below the cursor.
 void shortcut_cut_line(char ch) {
     if(ch != 'K') return;
-    memcpy(LINE_CLIPBOARD, DISPLAY_BUFFER[CURRENT_ROW], MAX_NUMBER_OF_COLS);
+    strcpy(LINE_CLIPBOARD, DISPLAY_BUFFER[CURRENT_ROW]);
     shortcut_delete_curr_line('D');
 }
 
 void shortcut_paste_line(char ch) {
     if(ch != 'Y' || LINE_CLIPBOARD[0] == '\0' || NUMBER_OF_ROWS >= MAX_NUMBER_OF_ROWS - 1) return;
     if(NUMBER_OF_ROWS == 0 && DISPLAY_BUFFER[0][0] == '\0') {
-        memcpy(DISPLAY_BUFFER[0], LINE_CLIPBOARD, MAX_NUMBER_OF_COLS);
+        strcpy(row_write(0, strlen(LINE_CLIPBOARD)), LINE_CLIPBOARD);
         normalize_COL();
         return;
     }
-    for(int i = NUMBER_OF_ROWS; i > CURRENT_ROW; i--) {
-        memcpy(DISPLAY_BUFFER[i + 1], DISPLAY_BUFFER[i], MAX_NUMBER_OF_COLS);
-    }
-    NUMBER_OF_ROWS++;
+    rows_insert(CURRENT_ROW + 1, 1);
     CURRENT_ROW++;
-    memcpy(DISPLAY_BUFFER[CURRENT_ROW], LINE_CLIPBOARD, MAX_NUMBER_OF_COLS);
+    strcpy(row_write(CURRENT_ROW, strlen(LINE_CLIPBOARD)), LINE_CLIPBOARD);
     normalize_COL();
 }
 
@@ -1099,6 +6243,7 @@ void shortcut_goto_first_line(char ch) {
 // Go to last line, using Ctrl + A
 void shortcut_goto_last_line(char ch) {
     if(ch == 'A') {
+        buffer_load_all(ACTIVE_BUFFER);
         CURRENT_ROW = NUMBER_OF_ROWS;
     }
 
@@ -1120,7 +6265,7 @@ void shortcut_save_file(char ch) {
 
 void shortcut_quit(char ch) {
     if(ch == 'Q') {
-        if(BUFFER_DIRTY) CONFIRM_EXIT = true;
+        if(BUFFER_DIRTY || buffer_switch_to_dirty()) CONFIRM_EXIT = true;
         else EXIT_FLAG = true;
     }
 }
@@ -1129,57 +6274,203 @@ void shortcut_quit(char ch) {
 // This function, pads the string output vertically, 
 // because RAW_MODE disables scrolling
 char* resize_string(const char* result) {
-    int viewport_rows = TERM_ROW > 1? TERM_ROW - 1: 1;
+    int viewport_rows = VIEW_ROWS;
     int used_rows = 0;
     for(size_t i = 0; result[i] != '\0'; i++) if(result[i] == '\n') used_rows++;
     size_t result_len = strlen(result);
-    char* res = malloc(result_len + (viewport_rows - used_rows) * 5 + 1);
+    char* res = malloc(result_len + (viewport_rows - used_rows) + 1);
     if(!res) return NULL;
     memcpy(res, result, result_len + 1);
-    for(int row = used_rows; row < viewport_rows; row++) strcat(res, "\033[2K\n");
+    for(int row = used_rows; row < viewport_rows; row++) strcat(res, "\n");
     return res;
 }
 
+// Rows are drawn into the text area of ACTIVE_VIEW only: the old row is
+// erased with ECH instead of EL, which would reach into the next view
+void view_print_line(int screen_row, const char* line) {
+    frame_printf("\033[%d;%dH\033[%dX%.*s", VIEW_TOP + screen_row - 1, VIEW_LEFT, VIEW_COLS,
+           (int)strcspn(line, "\n"), line);
+}
+
+// Every row of ACTIVE_VIEW, and its frame
+void render_viewport() {
+    char* joined = join_display_buffer();
+    char* resized = joined? resize_string(joined): NULL;
+    if(resized) {
+        char* line = resized;
+        for(int screen_row = 1; screen_row <= VIEW_ROWS; screen_row++) {
+            view_print_line(screen_row, line);
+            line += strcspn(line, "\n") + 1;
+        }
+    }
+    plugin_view_separator();
+    plugin_view_title();
+    free(resized);
+    free(joined);
+}
+
+// A wrapped row is repainted piece by piece, pieces out of view are skipped.
+void render_wrapped_row(u_int32_t buffer_row) {
+    int viewport_rows = VIEW_ROWS;
+    if(buffer_row < VIEW_START_ROW || buffer_row > NUMBER_OF_ROWS) return;
+    int screen_row = wrap_screen_row(buffer_row);
+    if(screen_row > viewport_rows) return;
+
+    size_t width = wrap_width();
+    u_int16_t lines = wrap_measure(buffer_row);
+    char* row = malloc(width * SPAN_COL_BYTES + 128);
+    if(!row) return;
+    for(u_int16_t piece = 0; piece < lines && screen_row <= viewport_rows; piece++, screen_row++) {
+        if(screen_row < 1) continue;
+        row[0] = '\0';
+        if(piece == 0) plugin_show_line_colored(row, buffer_row);
+        else plugin_show_wrap_gutter(row);
+        plugin_highlight_piece(row, DISPLAY_BUFFER[buffer_row], buffer_row, piece * width);
+        view_print_line(screen_row, row);
+    }
+    free(row);
+}
+
 // Most edits touch one row. Repainting only that row avoids flashing the
 // entire viewport for every character typed.
-void render_buffer_row(u_int16_t buffer_row) {
-    if(buffer_row < VIEW_START_ROW || buffer_row >= VIEW_START_ROW + TERM_ROW - 1) return;
+void render_buffer_row(u_int32_t buffer_row) {
+    if(SOFT_WRAP) {
+        render_wrapped_row(buffer_row);
+        return;
+    }
+    if(buffer_row < VIEW_START_ROW || buffer_row >= VIEW_START_ROW + VIEW_ROWS) return;
+    int screen_row = buffer_row - VIEW_START_ROW + 1;
+    if(buffer_row > NUMBER_OF_ROWS) {
+        view_print_line(screen_row, "");
+        return;
+    }
     size_t len = strlen(DISPLAY_BUFFER[buffer_row]);
-    char* row = malloc((len + 1) * 24 + 128);
+    char* row = malloc((len + 1) * SPAN_COL_BYTES + 128);
     if(!row) return;
     row[0] = '\0';
     plugin_show_line_colored(row, buffer_row);
     plugin_highlight(row, DISPLAY_BUFFER[buffer_row], buffer_row);
-    int screen_row = buffer_row - VIEW_START_ROW + 1;
-    printf("\033[%d;1H%s", screen_row, row);
+    view_print_line(screen_row, row);
     free(row);
 }
 
-void render_current_row() {
-    printf("\033[?2026h");
-    render_buffer_row(CURRENT_ROW);
-    plugin_status_bar();
-    printf("\033[?2026l");
-    fflush(stdout);
+// With SOFT_WRAP, a damaged row which gained or lost a piece moves
+// every row below it, so the damage reaches to the end of the view
+void wrap_damage_layout() {
+    struct View* view = ACTIVE_VIEW;
+    u_int32_t first = view->damage_first > VIEW_START_ROW? view->damage_first: VIEW_START_ROW;
+    for(u_int32_t row = first; row <= view->damage_last && row <= NUMBER_OF_ROWS &&
+        row - VIEW_START_ROW < VIEW_ROWS; row++) {
+        wrap_reserve(row);
+        u_int16_t lines = WRAP_ROWS[row].lines;
+        if(wrap_measure(row) != lines) {
+            view->damage_last = MAX_NUMBER_OF_ROWS;
+            return;
+        }
+    }
 }
 
-void render_vertical_move(u_int16_t old_row, u_int16_t old_view_start) {
-    int viewport_rows = TERM_ROW > 1? TERM_ROW - 1: 1;
-    printf("\033[?2026h");
+// Repaint what changed in ACTIVE_VIEW since it was drawn. A viewport
+// which moved by one row is scrolled on screen, when nothing else
+// shares its screen rows.
+void render_view() {
+    struct View* view = ACTIVE_VIEW;
+    bool full = !view->drawn;
+    u_int32_t uncovered_first = 1, uncovered_last = 0;
+    if(SOFT_WRAP) {
+        wrap_damage_layout();
+        wrap_follow_cursor(VIEW_ROWS);
+        full = full || VIEW_START_ROW != view->drawn_start_row ||
+               VIEW_START_WRAP != view->drawn_start_wrap ||
+               view->damage_last > NUMBER_OF_ROWS;
+    } else {
+        view_follow_cursor();
+        // A move by less than the viewport scrolls what is on screen
+        // with SU or SD, and paints only the rows it uncovers
+        bool moved = !full && VIEW_START_ROW != view->drawn_start_row;
+        bool full_width = VIEW_LEFT == 1 && VIEW_COLS == TERM_COL;
+        long delta = (long)VIEW_START_ROW - (long)view->drawn_start_row;
+        if(moved && full_width && labs(delta) < VIEW_ROWS) {
+            frame_printf("\033[%d;%dr\033[%ld%c\033[r", VIEW_TOP, VIEW_TOP + VIEW_ROWS - 1,
+                         labs(delta), delta > 0? 'S': 'T');
+            uncovered_first = delta > 0? VIEW_START_ROW + VIEW_ROWS - delta: VIEW_START_ROW;
+            uncovered_last = delta > 0? VIEW_START_ROW + VIEW_ROWS - 1: VIEW_START_ROW - delta - 1;
+        } else if(moved) full = true;
+        full = full || (view->damage_first <= VIEW_START_ROW &&
+                        view->damage_last >= VIEW_START_ROW + VIEW_ROWS - 1);
+    }
+
+    // The rows of the bracket matched before and the one matched now
+    u_int32_t match_row = 0;
+    u_int16_t match_col = 0;
+    bool match = bracket_match(ACTIVE_BUFFER, CURRENT_ROW, CURRENT_COL, &match_row, &match_col);
+    if(view->match && !(match && match_row == view->match_row && match_col == view->match_col)) {
+        view_damage(view, view->match_row, view->match_row);
+        if(match) view_damage(view, match_row, match_row);
+    } else if(match && !view->match) {
+        view_damage(view, match_row, match_row);
+    }
+    view->match = match;
+    view->match_row = match_row;
+    view->match_col = match_col;
 
-    if(CURRENT_ROW < old_view_start) {
-        VIEW_START_ROW = CURRENT_ROW;
-        printf("\033[1;%dr\033[1;1H\033M\033[r", viewport_rows);
-    } else if(CURRENT_ROW >= old_view_start + viewport_rows) {
-        VIEW_START_ROW = CURRENT_ROW - viewport_rows + 1;
-        printf("\033[1;%dr\033[%d;1H\033D\033[r", viewport_rows, viewport_rows);
+    if(full) {
+        render_viewport();
+    } else {
+        u_int32_t first = view->damage_first > VIEW_START_ROW? view->damage_first: VIEW_START_ROW;
+        for(u_int32_t row = first; row <= view->damage_last &&
+            row - VIEW_START_ROW < VIEW_ROWS; row++) render_buffer_row(row);
+        #define VIEW_DAMAGED(row) ((row) >= view->damage_first && (row) <= view->damage_last)
+        for(u_int32_t row = uncovered_first; row <= uncovered_last; row++) {
+            if(!VIEW_DAMAGED(row)) render_buffer_row(row);
+        }
+        bool cursor_moved = view->drawn_row != CURRENT_ROW || view->drawn_col != CURRENT_COL;
+        if(cursor_moved && view->drawn_row != CURRENT_ROW && !VIEW_DAMAGED(view->drawn_row) &&
+           !(view->drawn_row >= uncovered_first && view->drawn_row <= uncovered_last)) {
+            render_buffer_row(view->drawn_row);
+        }
+        if(cursor_moved && !VIEW_DAMAGED(CURRENT_ROW) &&
+           !(CURRENT_ROW >= uncovered_first && CURRENT_ROW <= uncovered_last)) {
+            render_buffer_row(CURRENT_ROW);
+        }
+        #undef VIEW_DAMAGED
+        plugin_view_title();
     }
 
-    render_buffer_row(old_row);
-    if(old_row != CURRENT_ROW) render_buffer_row(CURRENT_ROW);
+    view->drawn = true;
+    view->drawn_row = CURRENT_ROW;
+    view->drawn_col = CURRENT_COL;
+    view->drawn_start_row = VIEW_START_ROW;
+    view->drawn_start_wrap = VIEW_START_WRAP;
+    view->damage_first = MAX_NUMBER_OF_ROWS;
+    view->damage_last = 0;
+}
+
+// One frame for every key: each view repaints only its own damage,
+// and the status bar describes ACTIVE_VIEW
+void render_views() {
+    // Costs are checked on frames which are not drawn too, so hooks run
+    // for many keys between two drawn frames are not added up
+    plugins_check_costs();
+    if(!frame_idle()) return;
+    for(size_t i = 0; i < BUFFER_COUNT; i++) {
+        lex_settle(BUFFERS[i]);
+        bracket_settle(BUFFERS[i]);
+    }
+    u_int16_t term_row = TERM_ROW, term_col = TERM_COL;
+    get_terminal_size();
+    if(term_row != TERM_ROW || term_col != TERM_COL) view_layout();
+
+    struct View* focused = ACTIVE_VIEW;
+    frame_printf("\033[?2026h");
+    for(size_t i = 0; i < VIEW_COUNT; i++) {
+        ACTIVE_VIEW = VIEWS[i];
+        render_view();
+    }
+    ACTIVE_VIEW = focused;
     plugin_status_bar();
-    printf("\033[?2026l");
-    fflush(stdout);
+    frame_printf("\033[?2026l");
+    frame_send();
 }
 
 // EHHHH code duplication is not always so avoidable is it
@@ -1191,11 +6482,9 @@ void shortcut_delete_backwards(char ch) {
         if(CURRENT_COL > 0) {
             CURRENT_COL -= 1;
 
-            memmove(&DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL],
-                    &DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL + 1],
-                    MAX_NUMBER_OF_COLS - CURRENT_COL - 1);
-
-            DISPLAY_BUFFER[CURRENT_ROW][MAX_NUMBER_OF_COLS - 1] = '\0';
+            char* row = row_write(CURRENT_ROW, 0);
+            memmove(&row[CURRENT_COL], &row[CURRENT_COL + 1],
+                    strlen(row + CURRENT_COL + 1) + 1);
         }
         }
     }
@@ -1273,62 +6562,38 @@ type,
 
 ------------------------------------
 */
-void* buffer_display(void* unused) {
-  (void)unused;
-  while(true) {
-    // lock the mutex acquired by current_char_lock and wait
-    // for a signal to be broadcasted
-    pthread_mutex_lock(&current_char_lock);
-    while(key_queue_read == key_queue_write && !EXIT_FLAG) {
-        struct timespec wake_time;
-        clock_gettime(CLOCK_REALTIME, &wake_time);
-        wake_time.tv_nsec += 100000000;
-        if(wake_time.tv_nsec >= 1000000000) {
-            wake_time.tv_sec++;
-            wake_time.tv_nsec -= 1000000000;
-        }
-        pthread_cond_timedwait(&current_char_cond, &current_char_lock, &wake_time);
-    }
-    if(EXIT_FLAG && key_queue_read == key_queue_write) {
-        pthread_mutex_unlock(&current_char_lock);
-        check_EXIT("", !CALLED_THROUGH_SHORTCUT);
-        break;
-    }
-    current_char = key_queue[key_queue_read];
-    key_queue_read = (key_queue_read + 1) % KEY_QUEUE_LEN;
-    pthread_cond_signal(&current_char_cond);
-    pthread_mutex_unlock(&current_char_lock);
-    u_int16_t old_row = CURRENT_ROW;
-    u_int16_t old_view_start = VIEW_START_ROW;
+// Apply current_char to the active buffer, drawing nothing. The
+// return is false when only the rows the key changed are to be drawn
+// again, vertical is set when the cursor moved to another row.
+bool key_apply(bool* vertical) {
     bool redraw_viewport = true;
     bool redraw_vertical = false;
 
-    if(CONFIRM_EXIT) {
-        if(current_char.type == KEY_CHAR && (current_char.ch == 'y' || current_char.ch == 'Y')) {
-            if(INIT_FILE) {
-                save_buffer_to_file(INIT_ARG_FNAME, CALLED_THROUGH_SHORTCUT);
-                if(!BUFFER_DIRTY) {
-                    CONFIRM_EXIT = false;
-                    EXIT_FLAG = true;
-                }
-            }
-        } else if(current_char.type == KEY_CHAR && (current_char.ch == 'n' || current_char.ch == 'N')) {
-            CONFIRM_EXIT = false;
-            BUFFER_DIRTY = false;
-            EXIT_FLAG = true;
-        } else if(current_char.type == KEY_CHAR && (current_char.ch == 'c' || current_char.ch == 'C')) {
-            CONFIRM_EXIT = false;
-        }
-        render_current_row();
-        continue;
+    // A followed file is read-only, only moving, selecting and copying
+    // work, and so are the hits of :grep
+    if((ACTIVE_BUFFER->follow || ACTIVE_BUFFER->results) && (current_char.type == KEY_CHAR || current_char.type == KEY_BACKSPACE ||
+       (current_char.type == KEY_ENTER && !SELECT_ACTIVE) ||
+       (current_char.type == KEY_CTRL && strchr("OLDXTPUGKYVNZS", current_char.ch)))) {
+        current_char.type = KEY_UNKNOWN;
     }
 
+    // Loaded plugins see typed characters before light does
+    if(!SELECT_ACTIVE && !MACRO_PLAYING && plugins_key(current_char)) current_char.type = KEY_UNKNOWN;
+
     if(current_char.type == KEY_CHAR || current_char.type == KEY_ENTER ||
        current_char.type == KEY_BACKSPACE ||
-       (current_char.type == KEY_CTRL && strchr("OLDXTPUGKYV", current_char.ch))) {
+       (current_char.type == KEY_CTRL && strchr("OLDXTPUGKYVS", current_char.ch))) {
         remember_for_undo();
     }
 
+    // Extra cursors take the keys they know, any other key but a save
+    // leaves them
+    if(MULTI_COUNT) {
+        if(MULTI_BUFFER == ACTIVE_BUFFER && multi_key(current_char)) current_char.type = KEY_UNKNOWN;
+        else if(current_char.type != KEY_UNKNOWN && current_char.type != KEY_REDRAW &&
+                current_char.type != KEY_GREP_HITS && !(current_char.type == KEY_CTRL && current_char.ch == 'N')) multi_clear();
+    }
+
     if(SELECT_ACTIVE) {
         if(current_char.type == KEY_ENTER) {
             copy_selection_to_terminal();
@@ -1338,6 +6603,13 @@ void* buffer_display(void* unused) {
             if(current_char.ch == 'd') {
                 delete_selected_text();
                 BUFFER_DIRTY = true;
+            } else if(current_char.ch == 'c') {
+                multi_from_selection();
+            } else if(current_char.ch == '|' && FILTER_COMMAND[0]) {
+                u_int32_t first = SELECT_START_ROW < SELECT_END_ROW? SELECT_START_ROW: SELECT_END_ROW;
+                u_int32_t last = SELECT_START_ROW < SELECT_END_ROW? SELECT_END_ROW: SELECT_START_ROW;
+                SELECT_ACTIVE = SELECT_VISIBLE = false;
+                filter_rows(first, last);
             }
             current_char.type = KEY_UNKNOWN;
         } else if(current_char.type == KEY_BACKSPACE ||
@@ -1352,6 +6624,7 @@ void* buffer_display(void* unused) {
                 size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
                 size_t added = current_char.ch == '\t'? TABSPACE: 1;
                 if(len + added >= MAX_NUMBER_OF_COLS) break;
+                row_write(CURRENT_ROW, len + added)[len + added] = '\0';
 
                 // Check if we are inserting in the middle of a row
                 // instead of appending to the end
@@ -1375,27 +6648,25 @@ void* buffer_display(void* unused) {
             break;
 
         case KEY_ENTER:
-            if(shortcut_goto_typed_line()) break;
+            if(shortcut_goto_typed_line()) {
+                redraw_viewport = false;
+                break;
+            }
+            if(shortcut_typed_command()) break;
             if(checkpoint()) break;
             if (NUMBER_OF_ROWS < MAX_NUMBER_OF_ROWS - 1) {
 
-                // From bottom up, visit each row upto CURRENT_ROW, and shift it 
-                // 1 row down. 
-                for (int i = NUMBER_OF_ROWS; i > CURRENT_ROW; i--) {
-                    strncpy(DISPLAY_BUFFER[i + 1], DISPLAY_BUFFER[i], MAX_NUMBER_OF_COLS);
-                }
+                rows_insert(CURRENT_ROW + 1, 1);
 
-                // If, we are in the middle of the row, split that row, and save into 'new_line'
-                // the part of the row beginning from CURRENT_COL..srtlen(DISPLAY_BUFFER[CURRENT_ROW])
-                char new_line[MAX_NUMBER_OF_COLS] = {0};
-                if (CURRENT_COL < strlen(DISPLAY_BUFFER[CURRENT_ROW])) {
-                    strncpy(new_line, &DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL], MAX_NUMBER_OF_COLS - 1);
-                    DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL] = '\0';
+                // If, we are in the middle of the row, split that row, and move into
+                // the new row the part beginning from CURRENT_COL..strlen(DISPLAY_BUFFER[CURRENT_ROW])
+                size_t len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
+                if (CURRENT_COL < len) {
+                    memcpy(row_write(CURRENT_ROW + 1, len - CURRENT_COL),
+                           &DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL], len - CURRENT_COL + 1);
+                    row_write(CURRENT_ROW, 0)[CURRENT_COL] = '\0';
                 }
 
-                strncpy(DISPLAY_BUFFER[CURRENT_ROW + 1], new_line, MAX_NUMBER_OF_COLS);
-
-                NUMBER_OF_ROWS++;
                 CURRENT_ROW++;
                 CURRENT_COL = 0;
                 BUFFER_DIRTY = true;
@@ -1497,18 +6768,22 @@ void* buffer_display(void* unused) {
           break;
 
         case KEY_PAGE_UP: {
-          u_int16_t jump = TERM_ROW > 2? TERM_ROW - 2: 1;
+          u_int32_t jump = VIEW_ROWS > 1? VIEW_ROWS - 1: 1;
           CURRENT_ROW = CURRENT_ROW > jump? CURRENT_ROW - jump: 0;
           normalize_COL();
           selection_follows_cursor();
+          redraw_viewport = false;
+          redraw_vertical = true;
           break;
         }
 
         case KEY_PAGE_DOWN: {
-          u_int16_t jump = TERM_ROW > 2? TERM_ROW - 2: 1;
+          u_int32_t jump = VIEW_ROWS > 1? VIEW_ROWS - 1: 1;
           CURRENT_ROW = CURRENT_ROW + jump < NUMBER_OF_ROWS? CURRENT_ROW + jump: NUMBER_OF_ROWS;
           normalize_COL();
           selection_follows_cursor();
+          redraw_viewport = false;
+          redraw_vertical = true;
           break;
         }
 
@@ -1516,18 +6791,16 @@ void* buffer_display(void* unused) {
           if(CURRENT_COL > 0) {
             CURRENT_COL -= 1;
 
-            memmove(&DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL],
-                    &DISPLAY_BUFFER[CURRENT_ROW][CURRENT_COL + 1],
-                    MAX_NUMBER_OF_COLS - CURRENT_COL - 1);
-
-            DISPLAY_BUFFER[CURRENT_ROW][MAX_NUMBER_OF_COLS - 1] = '\0';
+            char* row = row_write(CURRENT_ROW, 0);
+            memmove(&row[CURRENT_COL], &row[CURRENT_COL + 1],
+                    strlen(row + CURRENT_COL + 1) + 1);
             BUFFER_DIRTY = true;
             redraw_viewport = false;
           } else if(CURRENT_ROW > 0) {
             size_t previous_len = strlen(DISPLAY_BUFFER[CURRENT_ROW - 1]);
             size_t current_len = strlen(DISPLAY_BUFFER[CURRENT_ROW]);
             if(previous_len + current_len < MAX_NUMBER_OF_COLS) {
-              memcpy(DISPLAY_BUFFER[CURRENT_ROW - 1] + previous_len,
+              memcpy(row_write(CURRENT_ROW - 1, previous_len + current_len) + previous_len,
                      DISPLAY_BUFFER[CURRENT_ROW], current_len + 1);
               shortcut_delete_curr_line('D');
               CURRENT_COL = previous_len;
@@ -1538,6 +6811,27 @@ void* buffer_display(void* unused) {
 
         case KEY_MOUSE:
           shortcut_mouse(current_char);
+          redraw_viewport = false;
+          break;
+
+        // Alt + Right and Alt + Left walk through the open buffers
+        case KEY_NEXT_BUFFER:
+          buffer_switch(1);
+          break;
+
+        case KEY_PREVIOUS_BUFFER:
+          buffer_switch(-1);
+          break;
+
+        // Alt + Down and Alt + Up move the keys to another view
+        case KEY_NEXT_VIEW:
+          view_cycle(1);
+          redraw_viewport = false;
+          break;
+
+        case KEY_PREVIOUS_VIEW:
+          view_cycle(-1);
+          redraw_viewport = false;
           break;
 
         // With Ctrl, you have the ability to add Shortcuts
@@ -1564,101 +6858,399 @@ void* buffer_display(void* unused) {
             shortcut_copy(current_char.ch);
             shortcut_paste_text(current_char.ch);
             shortcut_undo(current_char.ch);
+            shortcut_find_next(current_char.ch);
+            shortcut_goto_definition(current_char.ch);
+            shortcut_goto_bracket(current_char.ch);
+            shortcut_complete(current_char.ch);
             shortcut_quit(current_char.ch);
-            if(strchr("BEWA", current_char.ch) != NULL) selection_follows_cursor();
-            if(strchr("OLDXTPUGKYV", current_char.ch) != NULL) BUFFER_DIRTY = true;
-            if(strchr("BEPTUX", current_char.ch) != NULL) redraw_viewport = false;
+            if(strchr("BEWAR", current_char.ch) != NULL) selection_follows_cursor();
+            if(strchr("OLDXTPUGKYVS", current_char.ch) != NULL) BUFFER_DIRTY = true;
+            if(strchr("BEPTUXWAS", current_char.ch) != NULL) redraw_viewport = false;
+            if(strchr("WA", current_char.ch) != NULL) redraw_vertical = true;
+            break;
+
+        // F3 records a macro, F4 plays it
+        case KEY_MACRO_RECORD:
+            macro_record();
+            redraw_viewport = false;
+            break;
+
+        case KEY_MACRO_PLAY:
+            macro_play(1);
             break;
 
         default: break;
     }
 
+    *vertical = redraw_vertical;
+    return redraw_viewport;
+}
+
+void* buffer_display(void* unused) {
+  (void)unused;
+  while(true) {
+    // lock the mutex acquired by current_char_lock and wait
+    // for a signal to be broadcasted
+    pthread_mutex_lock(&current_char_lock);
+    while(key_queue_read == key_queue_write && !EXIT_FLAG && !LOAD_PENDING && !FIND_PENDING && !SYMBOL_PENDING &&
+          !BRACKET_PENDING && !WORD_PENDING) {
+        struct timespec wake_time;
+        clock_gettime(CLOCK_REALTIME, &wake_time);
+        wake_time.tv_nsec += 100000000;
+        if(wake_time.tv_nsec >= 1000000000) {
+            wake_time.tv_sec++;
+            wake_time.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&current_char_cond, &current_char_lock, &wake_time);
+    }
+    if(EXIT_FLAG && key_queue_read == key_queue_write) {
+        pthread_mutex_unlock(&current_char_lock);
+        check_EXIT("", !CALLED_THROUGH_SHORTCUT);
+        break;
+    }
+    // Files are loaded and indexed further only while no key is waiting
+    if(key_queue_read == key_queue_write) {
+        pthread_mutex_unlock(&current_char_lock);
+        FIND_PENDING = SYMBOL_PENDING = BRACKET_PENDING = WORD_PENDING = false;
+        for(size_t i = 0; i < BUFFER_COUNT; i++) {
+            if(BUFFERS[i]->loading) buffer_load(BUFFERS[i], LOAD_STEP);
+            if(find_index_step(BUFFERS[i])) FIND_PENDING = true;
+            if(symbol_index_step(BUFFERS[i])) SYMBOL_PENDING = true;
+            if(bracket_index_step(BUFFERS[i])) BRACKET_PENDING = true;
+            if(word_index_step(BUFFERS[i])) WORD_PENDING = true;
+        }
+        render_views();
+        continue;
+    }
+    current_char = key_queue[key_queue_read];
+    key_queue_read = (key_queue_read + 1) % KEY_QUEUE_LEN;
+    pthread_cond_signal(&current_char_cond);
+    pthread_mutex_unlock(&current_char_lock);
+    u_int32_t old_row = CURRENT_ROW;
+
+    if(current_char.type == KEY_REDRAW) {
+        render_views();
+        continue;
+    }
+
+    if(current_char.type == KEY_FILE_CHANGED) {
+        file_changes();
+        render_views();
+        continue;
+    }
+
+    if(current_char.type == KEY_GREP_HITS) {
+        if(grep_hits_take()) render_views();
+        continue;
+    }
+    STATUS_MESSAGE[0] = '\0';
+
+    // Every buffer with unsaved changes is asked about in turn
+    if(CONFIRM_EXIT) {
+        if(current_char.type == KEY_CHAR && (current_char.ch == 'y' || current_char.ch == 'Y')) {
+            if(INIT_FILE) save_buffer_to_file(INIT_ARG_FNAME, CALLED_THROUGH_SHORTCUT);
+            if(ACTIVE_BUFFER->disk_changed) CONFIRM_EXIT = false;
+        } else if(current_char.type == KEY_CHAR && (current_char.ch == 'n' || current_char.ch == 'N')) {
+            BUFFER_DIRTY = false;
+        } else if(current_char.type == KEY_CHAR && (current_char.ch == 'c' || current_char.ch == 'C')) {
+            CONFIRM_EXIT = false;
+        }
+        if(CONFIRM_EXIT && !BUFFER_DIRTY && !buffer_switch_to_dirty()) {
+            CONFIRM_EXIT = false;
+            EXIT_FLAG = true;
+        }
+        render_views();
+        continue;
+    }
+
+    // Another program wrote the file, the next key reloads it or keeps
+    // this buffer as it is, Ctrl+N would then overwrite the file
+    if(ACTIVE_BUFFER->disk_changed && !CONFIRM_EXIT) {
+        if(current_char.type == KEY_CHAR && (current_char.ch == 'r' || current_char.ch == 'R')) {
+            buffer_reload();
+        } else if(current_char.type == KEY_CHAR && (current_char.ch == 'k' || current_char.ch == 'K')) {
+            stat(INIT_ARG_FNAME, &ACTIVE_BUFFER->disk);
+            origins_drop(ACTIVE_BUFFER);
+            ACTIVE_BUFFER->disk_changed = false;
+            BUFFER_DIRTY = true;
+        }
+        render_views();
+        continue;
+    }
+
+    // Enter on a hit of :grep opens it
+    if(ACTIVE_BUFFER->results && current_char.type == KEY_ENTER && !SELECT_ACTIVE) {
+        grep_open_hit();
+        render_views();
+        continue;
+    }
 
-    if(redraw_vertical) {
-      render_vertical_move(old_row, old_view_start);
-    } else if(redraw_viewport) {
-      char* joined = join_display_buffer();
-      char* resized = joined? resize_string(joined): NULL;
-      // Synchronized output prevents the terminal from showing a half-drawn frame.
-      printf("\033[?2026h\033[H%s", resized? resized: "");
-      plugin_status_bar();
-      printf("\033[?2026l");
-      fflush(stdout);
-      free(resized);
-      free(joined);
-    } else render_current_row();
+    // Keys of a macro being recorded are kept as they are typed
+    if(MACRO_RECORDING) macro_record_key(current_char);
+    u_int32_t changes = BUFFER_CHANGES;
+    bool redraw_vertical = false;
+    bool redraw_viewport = key_apply(&redraw_vertical);
+
+    if(BUFFER_CHANGES != changes) plugins_event(LIGHT_EVENT_EDIT);
+
+    // Edits have damaged the rows they changed already, what is left
+    // is the cursor, or the whole view when the key asks for it. A
+    // selection which followed the cursor changed every row in between,
+    // render_view repaints the row the cursor left otherwise
+    if(redraw_viewport) view_damage(ACTIVE_VIEW, 0, MAX_NUMBER_OF_ROWS);
+    if(redraw_vertical && SELECT_VISIBLE) view_damage(ACTIVE_VIEW, old_row, old_row);
+    view_damage(ACTIVE_VIEW, CURRENT_ROW, CURRENT_ROW);
+    render_views();
    
   }
 
   return NULL;
 }
 
-int main(int argc, char* argv[]) {
+/*
+------------------------------------
 
-    // Start by checking, if filename is provided, or buffer
-    // is to be created from scratch. If filename, is provided 
-    // construct a buffer using its contents, else zero out
-    // memory of DISPLAY_BUFFER
-    if (argc > 1) {
-        char* open_file = argv[1];
-        FILE* fd_open_file = fopen(open_file, "r+");
-        if(fd_open_file == NULL && errno == ENOENT) fd_open_file = fopen(open_file, "w+");
-
-        if (fd_open_file == NULL) {
-            fprintf(stderr, "could, not open file: %s\n", open_file);
-            INIT_FILE = false; 
-        } else {
-            char* temp_line = malloc(MAX_NUMBER_OF_COLS);
-            if (!temp_line) {
-                perror("malloc failed");
-                exit(1);
-            }
+- light --script edits.lk file runs the commands
+of edits.lk on file, one per line, without a
+terminal, and saves file once they all worked:
+
+    goto <row>            the row, counted from 0
+    find <text>           the next text after the cursor
+    replace /old/new/     on the row of the cursor
+    replace-all /old/new/ on every row
+    delete [n]            n rows from the cursor on
+    insert <text>         a row above the cursor
+    append <text>         a row below, the cursor follows
+    keys <keys>           the macro, <enter>, <c-d>, ...
+    macro <n>             plays it n times
+
+- Lines starting with # are comments. A command
+which fails stops the script with its line on
+stderr, and the file is left as it was
+
+- The edits go through the same rows and
+row_write as typed ones. Nothing is indexed, and
+each command forgets the undo of the one before,
+so a script costs what its edits cost
 
-            if(strlen(argv[1]) >= sizeof(INIT_ARG_FNAME)) {
-                fprintf(stderr, "File path is too long\n");
-                free(temp_line);
-                fclose(fd_open_file);
-                return 1;
-            }
-            strcpy(INIT_ARG_FNAME, argv[1]);
-            detect_language(INIT_ARG_FNAME);
+------------------------------------
+*/
+struct ScriptKey {
+    const char*  name;
+    enum KeyType type;
+    char         ch;
+};
 
-            int i = 0;
-            while (fgets(temp_line, MAX_NUMBER_OF_COLS, fd_open_file)) {
-                if (i >= MAX_NUMBER_OF_ROWS) {
-                    fprintf(stderr, "File too long, truncating at %d lines\n", MAX_NUMBER_OF_ROWS);
-                    break;
-                }
-                // copy line safely
-                strncpy(DISPLAY_BUFFER[i], temp_line, MAX_NUMBER_OF_COLS - 1);
-                DISPLAY_BUFFER[i][MAX_NUMBER_OF_COLS-1] = '\0';
-
-                size_t len = strlen(DISPLAY_BUFFER[i]);
-                if (len > 0 && DISPLAY_BUFFER[i][len - 1] == '\n') {
-                    DISPLAY_BUFFER[i][len - 1] = '\0';
-                    BUFFER_ENDS_NEWLINE = true;
-                } else {
-                    BUFFER_ENDS_NEWLINE = false;
-                }
+const struct ScriptKey SCRIPT_KEYS[] = {
+    { "enter", KEY_ENTER, 0 },         { "tab", KEY_CHAR, '\t' },
+    { "backspace", KEY_BACKSPACE, 0 }, { "up", KEY_ARROW_UP, 0 },
+    { "down", KEY_ARROW_DOWN, 0 },     { "left", KEY_ARROW_LEFT, 0 },
+    { "right", KEY_ARROW_RIGHT, 0 },   { "home", KEY_HOME, 0 },
+    { "end", KEY_END, 0 },             { "pageup", KEY_PAGE_UP, 0 },
+    { "pagedown", KEY_PAGE_DOWN, 0 },  { "lt", KEY_CHAR, '<' }
+};
 
-                i++;
+// keys is typed as it is, but for <name> of SCRIPT_KEYS and <c-x>
+void script_keys(const char* keys) {
+    MACRO_COUNT = 0;
+    for(const char* at = keys; *at;) {
+        struct Key key = { .type = KEY_CHAR, .ch = *at };
+        const char* end = *at == '<'? strchr(at, '>'): NULL;
+        size_t len = end? end - at - 1: 0;
+        bool named = false;
+        if(len == 3 && (at[1] == 'c' || at[1] == 'C') && at[2] == '-' &&
+           ((at[3] >= 'a' && at[3] <= 'z') || (at[3] >= 'A' && at[3] <= 'Z'))) {
+            key = (struct Key){ .type = KEY_CTRL, .ch = at[3] >= 'a'? at[3] - 'a' + 'A': at[3] };
+            named = true;
+        }
+        for(size_t i = 0; len && !named && i < sizeof(SCRIPT_KEYS) / sizeof(SCRIPT_KEYS[0]); i++) {
+            if(strlen(SCRIPT_KEYS[i].name) == len && strncmp(SCRIPT_KEYS[i].name, at + 1, len) == 0) {
+                key = (struct Key){ .type = SCRIPT_KEYS[i].type, .ch = SCRIPT_KEYS[i].ch };
+                named = true;
             }
+        }
+        at = named? end + 1: at + 1;
+        macro_record_key(key);
+    }
+}
+
+// Every old of row from column from on is replaced by new, false when
+// the row would be too long
+bool script_replace_row(u_int32_t row, size_t from, const char* old, const char* new) {
+    const char* text = DISPLAY_BUFFER[row];
+    if(from > strlen(text) || !strstr(text + from, old)) return true;
+    char result[MAX_NUMBER_OF_COLS];
+    size_t old_len = strlen(old), new_len = strlen(new), out = from;
+    memcpy(result, text, from);
+    const char* at = text + from;
+    for(const char* match; (match = strstr(at, old)); at = match + old_len) {
+        if(out + (match - at) + new_len >= MAX_NUMBER_OF_COLS) return false;
+        memcpy(result + out, at, match - at);
+        out += match - at;
+        memcpy(result + out, new, new_len);
+        out += new_len;
+    }
+    size_t rest = strlen(at);
+    if(out + rest >= MAX_NUMBER_OF_COLS) return false;
+    memcpy(result + out, at, rest + 1);
+    memcpy(row_write(row, out + rest), result, out + rest + 1);
+    return true;
+}
+
+// One command of a script, NULL when it worked, else what went wrong
+const char* script_command(char* line, bool* exact) {
+    u_int32_t changes = BUFFER_CHANGES;
+    char* argument = line + strcspn(line, " ");
+    if(*argument) *argument++ = '\0';
+    if(strcmp(line, "goto") == 0) {
+        char* end;
+        unsigned long row = strtoul(argument, &end, 10);
+        if(end == argument || *end || row > NUMBER_OF_ROWS) return "no such row";
+        CURRENT_ROW = row;
+        CURRENT_COL = 0;
+        *exact = true;
+    } else if(strcmp(line, "find") == 0) {
+        u_int32_t row;
+        u_int16_t col;
+        size_t from = *exact? CURRENT_COL: CURRENT_COL + 1;
+        if(!*argument || !find_rows(ACTIVE_BUFFER, argument, CURRENT_ROW, from, NUMBER_OF_ROWS + 1, &row, &col))
+            return "not found";
+        CURRENT_ROW = row;
+        CURRENT_COL = col;
+        *exact = false;
+    } else if(strcmp(line, "replace") == 0 || strcmp(line, "replace-all") == 0) {
+        char delimiter = argument[0];
+        char* old = argument + (delimiter? 1: 0);
+        char* new = delimiter? strchr(old, delimiter): NULL;
+        char* end = new? strchr(new + 1, delimiter): NULL;
+        if(!end || end[1] || new == old) return "replace takes /old/new/";
+        *new++ = *end = '\0';
+        bool all = line[7] == '-';
+        for(u_int32_t row = all? 0: CURRENT_ROW; row <= (all? NUMBER_OF_ROWS: CURRENT_ROW); row++) {
+            if(!script_replace_row(row, all? 0: CURRENT_COL, old, new)) return "row too long";
+        }
+        normalize_COL();
+    } else if(strcmp(line, "delete") == 0) {
+        char* end = argument;
+        unsigned long count = *argument? strtoul(argument, &end, 10): 1;
+        if(*argument && (end == argument || *end || argument[0] == '-' || count == 0)) return "delete takes a count";
+        if(count > NUMBER_OF_ROWS + 1 - CURRENT_ROW) count = NUMBER_OF_ROWS + 1 - CURRENT_ROW;
+        if(count > NUMBER_OF_ROWS) {
+            rows_delete(0, NUMBER_OF_ROWS);
+            row_write(0, 0)[0] = '\0';
+        } else {
+            rows_delete(CURRENT_ROW, count);
+        }
+        if(CURRENT_ROW > NUMBER_OF_ROWS) CURRENT_ROW = NUMBER_OF_ROWS;
+        CURRENT_COL = 0;
+        *exact = true;
+    } else if(strcmp(line, "insert") == 0 || strcmp(line, "append") == 0) {
+        size_t len = strlen(argument);
+        if(len >= MAX_NUMBER_OF_COLS) return "row too long";
+        u_int32_t at = line[0] == 'a'? CURRENT_ROW + 1: CURRENT_ROW;
+        rows_insert(at, 1);
+        memcpy(row_write(at, len), argument, len + 1);
+        CURRENT_ROW++;
+        CURRENT_COL = 0;
+        *exact = true;
+    } else if(strcmp(line, "keys") == 0) {
+        script_keys(argument);
+    } else if(strcmp(line, "macro") == 0) {
+        char* end;
+        unsigned long times = strtoul(argument, &end, 10);
+        if(end == argument || *end || argument[0] == '-' || times == 0 || !MACRO_COUNT)
+            return "macro takes a count, after keys";
+        // The keys which jump by an index find it built, as typed keys
+        // do once light was idle
+        for(size_t i = 0; i < MACRO_COUNT; i++) {
+            if(MACRO_KEYS[i].type != KEY_CTRL) continue;
+            if(MACRO_KEYS[i].ch == 'R') while(bracket_index_step(ACTIVE_BUFFER));
+            if(MACRO_KEYS[i].ch == 'S') while(word_index_step(ACTIVE_BUFFER));
+        }
+        macro_play(times);
+        *exact = false;
+    } else {
+        return "unknown command";
+    }
+    if(BUFFER_CHANGES != changes) BUFFER_DIRTY = true;
+    undo_forget(&UNDO_STATE);
+    return NULL;
+}
 
-            NUMBER_OF_ROWS = i > 0? i - 1: 0;
-            INIT_FILE = true; 
-            free(temp_line);
-            fclose(fd_open_file);
+int script_run(const char* script, const char* path) {
+    FILE* commands = fopen(script, "re");
+    if(!commands) {
+        perror(script);
+        return 1;
+    }
+    if(access(path, F_OK) != 0) {
+        perror(path);
+        return 1;
+    }
+    if(!buffer_open(path)) return 1;
+    buffer_load_all(ACTIVE_BUFFER);
+
+    // A longer line is cut into rows, which would be saved as lines of
+    // their own, with no one to see it
+    for(u_int32_t row = 0; row <= NUMBER_OF_ROWS; row++) {
+        if(strlen(DISPLAY_BUFFER[row]) >= MAX_NUMBER_OF_COLS - 1) {
+            fprintf(stderr, "%s:%lu: line longer than %d characters, not edited\n", path,
+                    (unsigned long)row + 1, MAX_NUMBER_OF_COLS - 2);
+            return 1;
+        }
+    }
 
-            // Begin buffer at row number 0
-            CURRENT_ROW = 0;  
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    bool exact = true;
+    for(unsigned long number = 1; (len = getline(&line, &capacity, commands)) != -1; number++) {
+        if(len && line[len - 1] == '\n') line[--len] = '\0';
+        char* command = line + strspn(line, " \t");
+        if(*command == '\0' || *command == '#') continue;
+        const char* error = script_command(command, &exact);
+        if(error) {
+            fprintf(stderr, "%s:%lu: %s\n", script, number, error);
+            return 1;
         }
     }
+    free(line);
+    fclose(commands);
+    if(!BUFFER_DIRTY) return 0;
+    save_buffer_to_file(INIT_ARG_FNAME, CALLED_THROUGH_SHORTCUT);
+    if(ACTIVE_BUFFER->disk_changed) fprintf(stderr, "%s: file changed on disk, not saved\n", path);
+    return BUFFER_DIRTY? 1: 0;
+}
 
+int main(int argc, char* argv[]) {
+    // Plugins and languages come first, they are needed by the files
+    // opened below
+    // light --script edits.lk file edits file without a terminal, and
+    // without the plugins, which are there for typed keys
+    bool script = argc == 4 && strcmp(argv[1], "--script") == 0;
+    const char* delta = getenv("LIGHT_DELTA_SAVE");
+    DELTA_SAVE = delta && strcmp(delta, "1") == 0;
+    languages_load();
+    if(!script) plugins_load();
+
+    // Start by checking, if filenames are provided, or buffer
+    // is to be created from scratch. Every file gets a buffer
+    // of its own, the first one is shown
+    // One view owns the whole screen to begin with
+    view_new();
+    ACTIVE_VIEW->x1 = ACTIVE_VIEW->y1 = LAYOUT_ONE;
+    if(script) return script_run(argv[2], argv[3]);
+    for (int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) buffer_follow(argv[++i]);
+        else buffer_open(argv[i]);
+    }
 
-  if(INIT_FILE == false) {
-    // zero out DISPLAY_BUFFER
-    for(int i=0; i<MAX_NUMBER_OF_ROWS; i++) memset(DISPLAY_BUFFER[i], 0, MAX_NUMBER_OF_COLS);
-  }
+    if (BUFFER_COUNT == 0) {
+        buffer_new();
+        rows_reserve(ACTIVE_BUFFER, 1);
+        DISPLAY_BUFFER[0] = row_alloc(0);
+    }
+    view_show(BUFFERS[0]);
 
   // current_char at the beginning is set to KEY_UNKNOWN
   current_char = (struct Key){ .type = KEY_UNKNOWN, .ch = 0 }; 
@@ -1669,21 +7261,17 @@ int main(int argc, char* argv[]) {
   sigemptyset(&interrupt_action.sa_mask);
   sigaction(SIGINT, &interrupt_action, NULL);
 
+  // a :filter command which stops reading early must not end light
+  signal(SIGPIPE, SIG_IGN);
+
   // set terminal to raw mode
   set_terminal_raw_mode(true);
 
   // clear the screen and print the initial empty DISPLAY_BUFFER
   // or the file-content initialized DISPLAY_BUFFER: all the same, to me
-  char* joined = join_display_buffer();
-  char* resized = joined? resize_string(joined): NULL;
-  printf("\033[?2026h\033[H\033[2J%s", resized? resized: "");
-  plugin_status_bar();
-  printf("\033[?2026l");
-  free(resized);
-  free(joined);
-
-  // get terminal sizes
-  get_terminal_size();
+  frame_start();
+  frame_printf("\033[H\033[2J");
+  render_views();
 
   // create two worker threads, one to check for input at
   // the terminal, and the other to manipulate the 
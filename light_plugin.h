@@ -0,0 +1,67 @@
+//
+// light_plugin.h is all a plugin needs to be loaded by light. Build it
+// as a shared object, and put it in ~/.config/light/plugins/:
+//
+//     cc -shared -fPIC my_plugin.c -o ~/.config/light/plugins/my_plugin.so
+//
+// light calls light_plugin_init once at startup, and then the hooks of
+// the light_plugin it returns. Everything a hook gets from light_api is
+// about the buffer being drawn, or edited, at that moment.
+//
+// light_plugin_init runs before any buffer is open, it may keep the
+// light_api pointer but must not call it, only hooks may.
+//
+
+#ifndef LIGHT_PLUGIN_H
+#define LIGHT_PLUGIN_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+// A plugin built against another LIGHT_PLUGIN_ABI is not loaded
+#define LIGHT_PLUGIN_ABI      1
+
+// A span field which is left to the spans added before it
+#define LIGHT_SPAN_KEEP      -1
+
+enum light_event {
+    LIGHT_EVENT_OPEN,
+    LIGHT_EVENT_SAVE,
+    LIGHT_EVENT_RELOAD,
+    LIGHT_EVENT_EDIT
+};
+
+// What light offers a plugin. Rows are NUL-terminated, and counted
+// from 0. set_row, insert_rows and delete_rows only work in the key
+// hook, and are undone together by Ctrl + Z.
+struct light_api {
+    int         abi;
+    const char* (*filename)(void);
+    uint32_t    (*rows)(void);
+    const char* (*row)(uint32_t row);
+    void        (*cursor)(uint32_t* row, uint16_t* col);
+    void        (*set_cursor)(uint32_t row, uint16_t col);
+    void        (*set_row)(uint32_t row, const char* text);
+    void        (*insert_rows)(uint32_t at, uint32_t count);
+    void        (*delete_rows)(uint32_t at, uint32_t count);
+    void        (*span)(size_t first, size_t last, int fg, int bg, int style);
+    void        (*message)(const char* text);
+};
+
+// What a plugin offers light, every hook may be NULL.
+// - spans colors the row line_no through api->span, fg and bg are
+// 256-color palette entries, and style is an SGR code, like 1 for bold
+// - key gets every typed character, with ctrl set for Ctrl + ch, and
+// returns nonzero when it used the key, light then ignores it
+// - event tells about the buffer being opened, saved, reloaded or edited
+struct light_plugin {
+    int         abi;
+    const char* name;
+    void        (*spans)(const char* row, size_t len, uint32_t line_no);
+    int         (*key)(int ctrl, char ch);
+    void        (*event)(enum light_event event);
+};
+
+const struct light_plugin* light_plugin_init(const struct light_api* api);
+
+#endif
@@ -0,0 +1,144 @@
+//
+// delta_save runs light with LIGHT_DELTA_SAVE=1 on a pseudo-terminal,
+// and checks what its saves leave in the file:
+//
+//     make test
+//
+// A save copies the lines which did not change from the file, so after
+// another program rewrote the file at the same size, and k kept the
+// buffer, a save must write the rows of the buffer and not the lines
+// the other program left there.
+//
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdbool.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<signal.h>
+#include<fcntl.h>
+#include<time.h>
+#include<poll.h>
+#include<pty.h>
+#include<sys/wait.h>
+
+#define ROWS                  5000
+#define ROW_LEN               40
+
+int   TERMINAL;
+pid_t LIGHT;
+
+// Read what light draws until it shows text, false after ms
+bool wait_for(const char* text, int ms) {
+    char seen[4096 + 64];
+    size_t kept = 0, len = strlen(text);
+    struct pollfd wait = { TERMINAL, POLLIN, 0 };
+    while(poll(&wait, 1, ms) == 1) {
+        ssize_t got = read(TERMINAL, seen + kept, 4096);
+        if(got <= 0) return false;
+        size_t total = kept + got;
+        if(memmem(seen, total, text, len)) return true;
+        kept = total < len? total: len - 1;
+        memmove(seen, seen + total - kept, kept);
+    }
+    return false;
+}
+
+// Keep reading what light draws for ms, so it never waits on the terminal
+void drain(int ms) {
+    char ignored[4096];
+    struct pollfd wait = { TERMINAL, POLLIN, 0 };
+    while(poll(&wait, 1, ms) == 1 && read(TERMINAL, ignored, sizeof(ignored)) > 0);
+}
+
+// ROWS rows of ROW_LEN letters, the first one after first
+void write_rows(const char* path, const char* first, char letter) {
+    FILE* file = fopen(path, "w");
+    for(int row = 0; row < ROWS; row++) {
+        if(row == 0) fputs(first, file);
+        for(int len = 0; len < ROW_LEN; len++) fputc(letter, file);
+        fputc('\n', file);
+    }
+    fclose(file);
+}
+
+// The file holds what write_rows(first, letter) writes, waits up to
+// two seconds for a save to end
+bool holds(const char* path, const char* first, char letter) {
+    char expected[] = "/tmp/light-test-expected-XXXXXX";
+    close(mkstemp(expected));
+    write_rows(expected, first, letter);
+    char command[256];
+    snprintf(command, sizeof(command), "cmp -s %s %s", path, expected);
+    bool same = false;
+    for(int i = 0; i < 40 && !same; i++) {
+        drain(50);
+        same = system(command) == 0;
+    }
+    unlink(expected);
+    return same;
+}
+
+void type(const char* keys) {
+    if(write(TERMINAL, keys, strlen(keys)) < 0) return;
+    drain(100);
+}
+
+int main(int argc, char* argv[]) {
+    char light[4096];
+    if(!realpath(argc > 1? argv[1]: "./light", light)) return 1;
+    char directory[] = "/tmp/light-test-XXXXXX";
+    if(!mkdtemp(directory) || chdir(directory) == -1) return 1;
+    const char* path = "rows.txt";
+    write_rows(path, "", 'A');
+
+    setenv("LIGHT_DELTA_SAVE", "1", 1);
+    setenv("HOME", directory, 1);
+    struct winsize size = { .ws_row = 40, .ws_col = 120 };
+    LIGHT = forkpty(&TERMINAL, NULL, NULL, &size);
+    if(LIGHT == -1) return 1;
+    if(LIGHT == 0) {
+        execl(light, light, path, (char*)NULL);
+        _exit(127);
+    }
+    drain(500);
+
+    int failed = 0;
+    type("X");
+    type("\016");
+    if(!holds(path, "X", 'A')) {
+        printf("FAIL: an edit saved with LIGHT_DELTA_SAVE=1\n");
+        failed = 1;
+    }
+
+    // Another program rewrites every line in place, at the same size
+    char rewritten[] = "/tmp/light-test-rewritten-XXXXXX";
+    close(mkstemp(rewritten));
+    write_rows(rewritten, "X", 'B');
+    char command[256];
+    snprintf(command, sizeof(command), "dd if=%s of=%s conv=notrunc status=none", rewritten, path);
+    if(system(command) != 0) failed = 1;
+    unlink(rewritten);
+    if(!wait_for("changed on disk", 3000)) {
+        printf("FAIL: the rewrite was not noticed\n");
+        failed = 1;
+    }
+    type("k");
+    type("Y");
+    type("\016");
+    if(!holds(path, "XY", 'A')) {
+        printf("FAIL: a save after k kept lines another program wrote\n");
+        failed = 1;
+    }
+
+    kill(LIGHT, SIGKILL);
+    waitpid(LIGHT, NULL, 0);
+    close(TERMINAL);
+    unlink(path);
+    char cleanup[256];
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s", directory);
+    if(system(cleanup) != 0) failed = 1;
+    if(!failed) printf("delta save: ok\n");
+    return failed;
+}